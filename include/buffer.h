@@ -28,6 +28,28 @@
 #include <string>
 #include <list>
 #include <memory>
+#include <atomic>
+#include <vector>
+#include <sys/uio.h>
+
+// 帧标志，参考 writer::commit()。
+// 关键帧：读者可以从该帧开始解码，参考 reader::discard_keyframe_。
+#define JGB_FRAME_KEYFRAME      0x100
+// 可以丢弃的帧：丢弃后不影响解码其他帧。
+#define JGB_FRAME_DISCARDABLE   0x200
+// 一个单元（例如分成多帧写入的一幅图像）的最后一帧。
+#define JGB_FRAME_END_OF_UNIT   0x400
+// 分块帧：载荷大于 buffer::chunk_size_ 的帧分成连续的多帧（块）写入。
+// 除最后一块外均设置 JGB_FRAME_CONTINUED，除第一块外均设置 JGB_FRAME_CHUNK。
+// 读者可以用 request_frames() 按帧标志获取各块，或者用 reader::read_chunked() 获取拼接后的载荷。
+#define JGB_FRAME_CONTINUED     0x800
+#define JGB_FRAME_CHUNK         0x1000
+// LZ4 压缩的帧：载荷为 4 字节的原始长度（主机字节序）及 LZ4 块，参考 buffer::compress_。
+// 写者提交时设置该标志表示载荷已经压缩，不再压缩。
+#define JGB_FRAME_LZ4           0x2000
+// 完整性校验失败的帧：载荷与写者提交时计算的 CRC32C 不一致，参考 buffer::crc_。
+// 只由读者设置，写者提交时不能设置。
+#define JGB_FRAME_CORRUPTED     0x4000
 
 namespace jgb
 {
@@ -38,10 +60,71 @@ struct frame
     int start_offset; // payload 开始位置相对帧开始位置的偏移量。
     // start_offset + len 要向上对齐到 4 的整数倍。
     //int end_offset; // payload 结束位置相对帧结束位置的偏移量。 目前看不出需要这个。
+    int64_t timestamp; // 写者提交该帧的时间，参考 frame_clock()。
+    int flags; // 写者提交该帧时设置的帧标志，JGB_FRAME_*。
+};
+
+// 帧时间戳所使用的单调时钟（CLOCK_MONOTONIC）的当前时间，单位纳秒。跨进程可比较。
+int64_t frame_clock();
+
+// HDR 风格的延迟直方图，单位纳秒。
+// 小于 16 的值各占一个区间；此后每个 2 的幂区间再均分为 8 个子区间，相对误差不超过 12.5%。
+// 不小于 2^37 纳秒（约 137 秒）的值计入最后一个区间。
+class latency_histogram
+{
+public:
+    static const int buckets = 280;
+
+    latency_histogram();
+
+    void record(int64_t ns);
+    void reset();
+    // 百分位 p（0 ~ 100）所在区间的上限，没有记录时返回 0。
+    int64_t percentile(double p) const;
+
+    // 第 i 个区间的下限。
+    static int64_t bucket_low(int i);
+    static int bucket_index(int64_t ns);
+
+public:
+    int64_t count_;
+    int64_t sum_;
+    int64_t max_;
+    int64_t counts_[buckets];
 };
 
 class buffer;
 
+struct frame_pin;
+
+// 引用计数的帧句柄，参考 reader::request_frame(frame_handle*, int)。
+// 存在引用该帧的句柄期间，帧的数据保留在缓冲区中，写者跳过该帧；读者无需复制即可一直访问。
+// 复制句柄增加引用，最后一个引用该帧的句柄析构或者 reset() 后，写者才可以覆盖该帧。
+// 须在删除缓冲区之前释放所有句柄。
+class frame_handle
+{
+public:
+    frame_handle();
+    frame_handle(const frame_handle& other);
+    frame_handle(frame_handle&& other);
+    frame_handle& operator=(const frame_handle& other);
+    frame_handle& operator=(frame_handle&& other);
+    ~frame_handle();
+
+    // 释放引用。
+    void reset();
+    bool valid() const
+    {
+        return pin_ != nullptr;
+    }
+    // 所引用的帧，valid() 为 true 时才可以调用。
+    const struct frame& get() const;
+
+private:
+    friend class reader;
+    struct frame_pin* pin_;
+};
+
 class reader
 {
 public:
@@ -50,8 +133,47 @@ public:
 
     // 请求从缓冲区获取一帧数据。
     int request_frame(struct frame* frm, int timeout = 100);
-    // 释放已请求获取的数据。
-    void release();
+    // 请求从缓冲区获取最多 max 帧数据，实际获取的帧数保存在 count 中。
+    // 至少有一帧可读时立即返回全部已提交的帧（不超过 max 帧），重定向帧不会返回给调用者。
+    int request_frames(struct frame* frms, int max, int* count, int timeout = 100);
+    // 请求获取一帧，并以 handle 引用：相当于 request_frame() 之后立即 release()，
+    // 但在释放所有引用该帧的句柄之前，写者不会覆盖该帧。handle 原有的引用先被释放。
+    // 持有帧时返回 JGB_ERR_DENIED；共享内存、leaky、多写者模式不支持。
+    int request_frame(frame_handle* handle, int timeout = 100);
+    // 释放已请求获取的 n 帧数据。
+    void release(int n = 1);
+    // 获取一帧完整的载荷，分块帧的各块拼接后复制到 data，flags 为各块的帧标志（不包括分块标志）。
+    // 各块复制后即释放，帧可以大于缓冲区；超时返回时保留已拼接的部分，下次调用继续。
+    // 缺少开始的块、中间的块被丢弃或覆盖、写者中途失败的帧被丢弃，参考 stat_chunks_dropped_。
+    // 消费者组的成员不支持。
+    int read_chunked(std::vector<uint8_t>* data, int* flags = nullptr, int timeout = 100);
+
+    // request_frame()/request_frames() 获取 LZ4 压缩的帧（JGB_FRAME_LZ4）时，默认解压到读者的缓冲区，
+    // 解压后的数据在下一次请求之前有效。keep_compressed_ 为 true 时原样获取，例如直接写入文件的读者。
+    // 帧句柄总是引用原样的帧。
+    bool keep_compressed_;
+    // leaky 模式下，所持有的帧是否已经开始被写者覆盖。
+    // 读者复制帧的数据后检查，返回 false 时所复制的数据完整。其他模式下总是返回 false。
+    bool overwritten();
+
+    // 有可读帧时可读的 eventfd，用于 epoll 等同时等待多个缓冲区及其他文件描述符。
+    // 可读后以 timeout 为 0 调用 request_frame()/request_frames()；没有可读帧时清空 eventfd。
+    // 不受通知策略的影响。eventfd 由读者所有，共享内存模式不支持。
+    int event_fd();
+
+    // 读取位置，参考 seek()。
+    enum seek_mode
+    {
+        seek_next,   // 下一个提交的帧（新读者的默认位置）
+        seek_latest, // 最近提交的帧
+        seek_oldest, // 缓冲区中保留的最早的帧
+        seek_time,   // 提交时间不早于 arg 的第一帧，参考 frame_clock()
+        seek_flags   // 最近提交的、帧标志包含 arg 中任一标志的帧
+    };
+    // 移动读取位置，用于后加入的读者从已提交的帧开始读取，例如“2 秒之前”。
+    // 除 seek_next 外，需要缓冲区设置了 index_size_；持有帧时不能移动。
+    // 没有符合条件的帧时，移动到下一个提交的帧；seek_flags 没有找到时返回 JGB_ERR_NOT_FOUND。
+    int seek(seek_mode whence, int64_t arg = 0);
 
     buffer* get_buffer()
     {
@@ -64,20 +186,46 @@ public:
     int64_t stat_timeout_;
     int64_t stat_bytes_discarded_;
     int64_t stat_frames_discarded_;
+    // leaky 模式下被写者覆盖、未能读取的帧数。
+    int64_t stat_frames_lost_;
+    // read_chunked() 因不完整而丢弃的块数。
+    int64_t stat_chunks_dropped_;
+    // 完整性校验失败的帧数，参考 JGB_FRAME_CORRUPTED。
+    int64_t stat_crc_errors_;
+
+    // 延迟统计：提交到请求（帧在缓冲区中等待的时长）、请求到释放（读者持有帧的时长）。
+    // stat_latency_ 为 false 时不统计，避免读取时钟。
+    bool stat_latency_;
+    latency_histogram stat_commit_latency_;
+    latency_histogram stat_hold_latency_;
 
     buffer* buf_;
     std::string id_;
     // 读指针。
-    uint8_t* cur_;
+    // lock_free 模式下由写者和读者无锁访问，故使用原子变量。
+    std::atomic<uint8_t*> cur_;
     // 可读帧数。
-    int stored_;
+    std::atomic<int> stored_;
     // 期待读取的帧序号。
     uint32_t serial_;
-    // request_frame 成功后持有该帧。
+    // request_frame/request_frames 成功后持有所获取的帧。
     // 禁止覆盖已经被读者持有的帧。
     bool holding_;
     // 可丢弃的。
     bool discard_;
+    // 可丢弃的读者落后时，一次跳到下一个关键帧（JGB_FRAME_KEYFRAME），而不是逐帧丢弃；
+    // 已提交的帧中没有关键帧时，丢弃全部已提交的帧，并丢弃此后的帧直到关键帧。
+    bool discard_keyframe_;
+
+    // 通知策略：读者等待期间，写者累计提交 notify_frames_ 帧，
+    // 或者累计提交 notify_bytes_ 字节（为 0 时不限），才通知读者。
+    // 默认每帧通知一次。
+    int notify_frames_;
+    int notify_bytes_;
+    // 读者等待时最迟每隔 notify_latency_ 毫秒检查一次是否有新帧，为 0 时不限。
+    int notify_latency_;
+    // 挂起等待之前自旋等待的最长时长，单位微秒；为 0 时不自旋。
+    int spin_;
 
 public:
     struct Impl;
@@ -85,6 +233,7 @@ public:
 
 private:
     int request_frame_internal(struct frame* frm, int timeout);
+    int request_frames_internal(struct frame* frms, int max, int* count, int timeout);
 };
 
 class writer
@@ -95,12 +244,27 @@ public:
 
     int request_buffer(uint8_t** buf, int len, int timeout = 100);
     // len 为有效的载荷数据的长度，不包括 start_offset，单位字节; 0 表示取消。
-    int commit(int len, int start_offset = 0);
+    // flags 为帧标志 JGB_FRAME_*。
+    int commit(int len, int start_offset = 0, int flags = 0);
     // 提交全部。
     int commit_all();
     // 取消提交。
     int cancel();
     int put(uint8_t* buf, int len, int timeout = 100);
+    // 将 cnt 段数据合并为一帧写入，各段数据直接复制到缓冲区。
+    int putv(const struct iovec* iov, int cnt, int timeout = 100);
+
+    // 批量写入：申请长度为 len 的连续缓冲区，len 包括各帧的帧头及填充，参考 frame_size()。
+    int request_batch(int len, int timeout = 100);
+    // 在已申请的批量缓冲区中追加一帧，载荷长度为 len；剩余空间不足时返回 JGB_ERR_LIMIT。
+    int request_batch_frame(uint8_t** buf, int len, int flags = 0);
+    // 一次提交全部已追加的帧；没有追加任何帧时相当于 cancel()。
+    int commit_batch();
+
+    // 等待空间时使用的 eventfd，由缓冲区的所有写者共用。
+    // request_buffer() 等因读者未释放而超时后，读者释放帧时 eventfd 可读，之后再次请求。
+    // 共享内存模式不支持。
+    int event_fd();
 
     buffer* get_buffer()
     {
@@ -112,6 +276,8 @@ public:
     int64_t stat_frames_written_;
     int64_t stat_cancelled_;
     int64_t stat_timeout_;
+    // 压缩的帧在缓冲区中的载荷字节数，stat_bytes_written_ 为压缩前的字节数。
+    int64_t stat_bytes_compressed_;
 
     buffer* buf_;
     std::string id_;
@@ -121,8 +287,23 @@ public:
     int reserved_len_;
 
     static int fixed_header_size();
+    // 载荷长度为 len 的帧在缓冲区中所占的长度。
+    static int frame_size(int len);
 
 private:
+    int reserve(int frame_len, int timeout);
+    void publish();
+    // 在线调整大小：在写指针处写入迁移帧，转到新的数据区。
+    void migrate();
+    // 多写者模式：申请、提交、发布缓冲区。
+    void add_reservation(uint8_t* start, int len, bool redirect);
+    void commit_reservation(int used, int frames, int bytes, uint8_t* last);
+    void publish_reservations();
+    // 在写指针处写入填充帧，跳到 to，用于跳过被句柄引用的帧。
+    int skip_pinned(uint8_t* to, int timeout);
+    // 分块写入载荷长度为 len 的帧，参考 buffer::chunk_size_。
+    int put_chunked(const struct iovec* iov, int cnt, int len, int timeout);
+
     int wait_readers_scenario_1(int timeout);
     int wait_reader_scenario_1(reader* rd, int timeout);
 
@@ -132,34 +313,84 @@ private:
     int wait_readers_scenario_3(int timeout);
     int wait_reader_scenario_3(reader* rd, int timeout);
 
-    void ack_readers();
-    void ack_reader(reader* rd);
+    // 依次用 wait 等待各个读者。增删、移动读者时暂时离开读者列表，之后按新的读者列表重新等待。
+    int wait_readers(int (writer::*wait)(reader*, int), int timeout);
+
+    void ack_readers(int len, int frames = 1);
+    void ack_reader(reader* rd, int len, int frames = 1);
 
     // 尝试成为缓冲区的 owner。
     int acquire_buffer_ownership(int timeout);
     void release_buffer_ownership();
     bool check_buffer_ownership();
 
+    // 开始/结束访问读者列表。
+    void enter_readers();
+    void leave_readers();
+    // 释放 request_buffer() 成功时获得的资源。
+    void end_request();
+
 public:
     struct Impl;
     std::unique_ptr<Impl> pimpl_;
 };
 
+// 读者的初始设置，参考 reader 的同名成员。
+// 在读者加入缓冲区之前生效：lock_free 模式下读者是否加锁取决于 discard_，读者加入后再设置，写者与读者的判断可能不一致。
+struct reader_options
+{
+    bool discard;
+    bool discard_keyframe;
+    int notify_frames;
+    int notify_bytes;
+    int notify_latency;
+    int spin;
+    bool stat_latency;
+
+    reader_options()
+        : discard(false),
+        discard_keyframe(false),
+        notify_frames(1),
+        notify_bytes(0),
+        notify_latency(0),
+        spin(0),
+        stat_latency(true)
+    {
+    }
+};
+
 class buffer
 {
 public:
     buffer(const std::string& id);
     ~buffer();
 
+    // 缓冲区已经分配时在线调整大小：写者在下一次写入时转到新分配的内存，
+    // 读者读完原来的内存中的帧后随之转到新的内存，原来的内存在所有读者离开后释放。
+    // 共享内存模式不支持在线调整大小。
     int resize(int len);
+    // 连接其他进程以 shm_ 模式创建的同名缓冲区。
+    int attach();
 
     reader* add_reader(bool discard = false);
-    reader* add_reader(reader* rd);
+    reader* add_reader(const reader_options& opt);
+    // 新读者从 rd 的读取位置开始读取。
+    reader* add_reader(reader* rd, const reader_options& opt = reader_options());
+    // 加入名为 group 的消费者组，组不存在时创建。组内每一帧只交给一个成员，整个组对写者而言只是一个读者。
+    // 成员可以在不同的线程中同时请求、不按先后释放帧；不支持 seek()、event_fd() 及帧句柄。
+    // 共享内存、leaky 模式不支持。
+    reader* add_group_reader(const std::string& group);
     writer* add_writer();
 
     int remove_reader(reader* r);
     int remove_writer(writer* w);
 
+    // readers_ 中第一个不是消费者组内部读者的读者，没有时返回 nullptr。
+    reader* first_reader();
+
+    // 各写者已写入的帧数及字节数之和，包括已移除的写者，可用于统计缓冲区的吞吐量。
+    void writer_stat(int64_t* frames, int64_t* bytes);
+
     std::string id() const
     {
         return id_;
@@ -177,6 +408,76 @@ public:
 
     int ref_;
 
+    // 无锁模式：只允许一个写者，写者与读者在不需要等待时不使用锁。
+    // 须在 resize() 之前设置。
+    bool lock_free_;
+
+    // 共享内存模式：缓冲区及读写状态保存在名为 "/jgb.<id>" 的共享内存中，可以跨进程读写。
+    // 须在 resize() 之前设置；共享内存已存在时，resize() 连接已存在的共享内存。
+    bool shm_;
+
+    // 文件模式：数据区映射到文件 file_，文件头保存写指针及最慢的读者的读取位置，每次提交后更新。
+    // 进程重新启动后，resize() 恢复写指针及帧序号，逐帧核对帧序号，此后加入的读者从上次最慢的读者的位置开始，
+    // 重新读取已提交、尚未读取的帧（可能重复读取少量已读取的帧）；写者覆盖这些帧之后，读者从写指针开始。
+    // 须在 resize() 之前设置；不支持共享内存、多写者模式及在线调整大小。
+    std::string file_;
+
+    // leaky 模式：写者从不等待读者，总是覆盖最早的帧。
+    // 被超越的读者根据帧序号发现读指针处的帧已被覆盖，转到最早的有效帧，参考 reader::stat_frames_lost_。
+    // 须在 resize() 之前设置，且须同时设置 lock_free_，否则 resize() 返回 JGB_ERR_NOT_SUPPORT；共享内存模式不支持。
+    bool leaky_;
+
+    // 多写者模式：写者只在申请缓冲区时持有写入权，申请到互不重叠的缓冲区后，可以同时写入；
+    // 提交的帧在之前申请的缓冲区都已提交后，按申请的先后对读者可见。
+    // 提交的长度小于申请的长度时，剩余的空间由读者跳过。
+    // 须在 resize() 之前设置；不能与 lock_free_、shm_、leaky_ 同时使用。
+    bool multi_writer_;
+
+    // 分块帧：put()/putv() 将载荷大于 chunk_size_ 的帧分成多块写入，参考 JGB_FRAME_CONTINUED。
+    // 缓冲区只需容纳一块，不必按最大的帧确定大小。写入各块期间保留写入权，其他写者的帧不会插入其间；
+    // 同一 writer 不能在多个线程中同时分块写入。为 0 时不分块。
+    // 须在 resize() 之前设置；不能与 shm_、multi_writer_ 同时使用。
+    int chunk_size_;
+
+    // 压缩模式：提交时以 LZ4 原地压缩载荷，同样大小的缓冲区可以保留更多的帧，参考 JGB_FRAME_LZ4。
+    // 只压缩载荷不短于 64 字节、压缩后更短的帧；批量写入的帧不压缩。编译时没有 LZ4 库则不支持。
+    // 须在 resize() 之前设置。
+    bool compress_;
+
+    // 完整性校验：提交时计算载荷（压缩后）的 CRC32C，保存在帧之后，每帧多占 4 字节；
+    // 读者获取帧时校验，不一致的帧设置 JGB_FRAME_CORRUPTED 并计入 reader::stat_crc_errors_。
+    // 须在 resize() 之前设置。
+    bool crc_;
+
+    // 内存选项，须在 resize() 之前设置。
+    enum huge_pages_mode
+    {
+        huge_pages_none,        // 不使用大页
+        huge_pages_transparent, // 透明大页
+        huge_pages_explicit     // 显式大页（hugetlbfs），失败时改用透明大页
+    };
+    huge_pages_mode huge_pages_;
+    // 锁定内存，避免被交换出去。
+    bool mlock_;
+    // 预先分配全部物理页。
+    bool prefault_;
+    // 绑定的 NUMA 节点：numa_any 表示不绑定；numa_local 表示写者第一次写入时，使用写者线程所在的节点。
+    static const int numa_any = -1;
+    static const int numa_local = -2;
+    int numa_node_;
+
+    // 帧索引的条目数（向上取整到 2 的幂），为 0 时不建立索引。须在 resize() 之前设置。
+    // 帧索引记录缓冲区中保留的帧的位置、提交时间及帧标志，reader::seek() 据此二分查找。
+    // 共享内存模式不支持。
+    int index_size_;
+
+    // 内存选项的实际结果。
+    bool stat_huge_pages_;
+    bool stat_locked_;
+    bool stat_prefaulted_;
+    // 缓冲区所在的 NUMA 节点，-1 表示未知。
+    int stat_numa_node_;
+
     // 考虑：如果写者关闭，又打开。
     uint32_t serial_;
 
@@ -195,10 +496,16 @@ class buffer_manager
 public:
     static buffer_manager* get_instance();
 
+    // 增加缓冲区的引用，不存在时创建。
     buffer* add_buffer(const std::string& id);
+    // 减少缓冲区的引用，没有引用时删除。
     int remove_buffer(buffer* buf);
+    // 查找缓冲区，不增加引用，不存在时返回 nullptr。
+    // 返回的缓冲区在其引用全部移除后删除，调用者须确保查找期间缓冲区仍被引用。
+    buffer* find_buffer(const std::string& id);
 
 public:
+    // 按创建的先后排列。增删缓冲区须通过 add_buffer()/remove_buffer()，以维护按 id 的索引。
     std::list<buffer*> buffers_;
 
 private:
@@ -208,6 +208,10 @@ private:
     const char* conf_dir_;
 };
 
+// 按写者配置中的缓冲区选项（lock_free、leaky、crc 等）设置缓冲区，并调整大小为 len，参考 buffer::resize()。
+// 缓冲区已经分配时不作修改，配置与之不一致时告警。
+int init_buffer(buffer* buf, config* conf, int len);
+
 } // namespace jgb
 
 #endif // APP_H
@@ -25,6 +25,7 @@
 #define HELPER_H_20250319
 
 #include <string>
+#include <inttypes.h>
 #include <unistd.h>
 
 namespace jgb
@@ -39,6 +40,9 @@ int stoll(const std::string& str, int64_t& v);
 int stod(const std::string& str, double& v);
 void sleep(int ms);
 int put_string(char* buf, int len, int& offset, const char* format, ...);
+// CRC32C（Castagnoli），crc 为之前的数据的结果，用于分段计算。
+// 支持时使用硬件指令（SSE4.2、ARMv8 CRC），否则查表计算。
+uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0);
 
 } // namespace jgb
 
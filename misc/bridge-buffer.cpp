@@ -0,0 +1,1060 @@
+#include <jgb/core.h>
+#include <jgb/helper.h>
+#include <jgb/buffer.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+// 缓冲区桥接：send_buffer 将读者获取的帧发送给其他进程，recv_buffer 接收后写入本地的缓冲区。
+// 配置 "path" 时使用 Unix 域套接字（SOCK_SEQPACKET，每帧一个消息），否则使用 "host"（默认 127.0.0.1）:"port" 的 TCP。
+// 每帧之前为 bridge_header。一次 sendmmsg()/recvmmsg()（TCP 为一次 sendmsg()/recv()）传输最多 "batch" 帧。
+
+// 可以由写者设置的帧标志，接收后原样提交。
+#define BRIDGE_FRAME_FLAGS (JGB_FRAME_KEYFRAME | JGB_FRAME_DISCARDABLE | JGB_FRAME_END_OF_UNIT \
+                            | JGB_FRAME_CONTINUED | JGB_FRAME_CHUNK | JGB_FRAME_LZ4)
+
+// 一次 sendmsg() 的 iovec 数不超过 IOV_MAX（1024），每帧 2 个。
+#define BRIDGE_MAX_BATCH 512
+
+// 不传送发送端的提交时间：接收端提交时重新记录，两端的 frame_clock() 也不一定可比。
+struct __attribute__((packed)) bridge_header
+{
+    uint32_t len; // 载荷长度
+    int32_t flags; // JGB_FRAME_*
+};
+
+struct bridge_addr
+{
+    std::string path;
+    std::string host;
+    int port;
+
+    bridge_addr()
+        : host("127.0.0.1"),
+        port(0)
+    {
+    }
+
+    bool is_unix() const
+    {
+        return !path.empty();
+    }
+};
+
+static int bridge_get_addr(jgb::config* conf, bridge_addr* addr)
+{
+    conf->get("path", addr->path);
+    conf->get("host", addr->host);
+    conf->get("port", addr->port);
+    if(!addr->is_unix() && (addr->port <= 0 || addr->port > 65535))
+    {
+        jgb_fail("invalid address. { path = %s, host = %s, port = %d }",
+                 addr->path.c_str(), addr->host.c_str(), addr->port);
+        return JGB_ERR_INVALID;
+    }
+    if(addr->is_unix() && addr->path.size() >= sizeof(((struct sockaddr_un*) nullptr)->sun_path))
+    {
+        jgb_fail("path too long. { path = %s }", addr->path.c_str());
+        return JGB_ERR_INVALID;
+    }
+    return 0;
+}
+
+// 创建套接字并填写地址，失败返回 -1。
+static int bridge_socket(const bridge_addr& addr, struct sockaddr_storage* sa, socklen_t* sa_len)
+{
+    memset(sa, 0, sizeof(*sa));
+    if(addr.is_unix())
+    {
+        struct sockaddr_un* un = reinterpret_cast<struct sockaddr_un*>(sa);
+        un->sun_family = AF_UNIX;
+        strncpy(un->sun_path, addr.path.c_str(), sizeof(un->sun_path) - 1);
+        *sa_len = sizeof(*un);
+        return socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    }
+
+    struct sockaddr_in* in = reinterpret_cast<struct sockaddr_in*>(sa);
+    in->sin_family = AF_INET;
+    in->sin_port = htons(addr.port);
+    if(inet_pton(AF_INET, addr.host.c_str(), &in->sin_addr) != 1)
+    {
+        jgb_warning("invalid host. { host = %s }", addr.host.c_str());
+        errno = EINVAL;
+        return -1;
+    }
+    *sa_len = sizeof(*in);
+    return socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+}
+
+static int clamp_batch(int batch)
+{
+    return batch < 1 ? 1 : (batch > BRIDGE_MAX_BATCH ? BRIDGE_MAX_BATCH : batch);
+}
+
+// send_buffer
+
+// MSG_ZEROCOPY：已发送、尚未收到完成通知的一批帧。
+// 内核在发送完成之前引用帧的载荷及帧头，帧以句柄保留在缓冲区中，帧头保存在批次中。
+struct zerocopy_batch
+{
+    // 本批最后一次 sendmsg() 之后的发送次数，完成通知的次数达到 end 后才释放本批的帧。
+    uint32_t end;
+    std::vector<jgb::frame_handle> handles;
+    std::vector<bridge_header> hdrs;
+};
+
+// 同时等待完成通知的批次数，达到后等待最早的一批完成，再获取新的帧。
+#define BRIDGE_ZEROCOPY_BATCHES 4
+
+struct context_5e0b7c93d1a4
+{
+    bridge_addr addr;
+    int fd;
+    int batch;
+    // 载荷的最大长度，与接收端的 max_frame 一致；更长的帧在发送之前丢弃。
+    int max_frame;
+    // TCP：以 MSG_ZEROCOPY 发送，内核通知发送完成后才释放帧。
+    // 对端为本机（回环地址）时内核总是复制数据，完成通知带 SO_EE_CODE_ZEROCOPY_COPIED，MSG_ZEROCOPY 只增加开销。
+    bool zerocopy;
+    // MSG_ZEROCOPY：已发送的次数、内核已通知完成的次数。
+    uint32_t zc_sent;
+    uint32_t zc_done;
+    // MSG_ZEROCOPY：按发送顺序排列的未完成的批次，及可以重用的批次。
+    std::deque<zerocopy_batch> zc_pending;
+    std::vector<zerocopy_batch> zc_free;
+    // 连接断开后，等待已发送的批次全部完成再关闭套接字。
+    bool zc_closing;
+
+    std::vector<jgb::frame> frms;
+    std::vector<bridge_header> hdrs;
+    std::vector<struct iovec> iov;
+    std::vector<struct mmsghdr> msgs;
+
+    int64_t stat_sent_frames;
+    int64_t stat_sent_bytes;
+    int64_t stat_send_calls;
+    int64_t stat_dropped_frames;
+    // MSG_ZEROCOPY：内核复制了数据的发送次数。
+    int64_t stat_zc_copied;
+
+    context_5e0b7c93d1a4()
+        : fd(-1),
+        batch(64),
+        max_frame(65536),
+        zerocopy(false),
+        zc_sent(0),
+        zc_done(0),
+        zc_closing(false),
+        stat_sent_frames(0L),
+        stat_sent_bytes(0L),
+        stat_send_calls(0L),
+        stat_dropped_frames(0L),
+        stat_zc_copied(0L)
+    {
+    }
+
+    ~context_5e0b7c93d1a4()
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+    }
+};
+
+static int send_connect(context_5e0b7c93d1a4* ctx)
+{
+    struct sockaddr_storage sa;
+    socklen_t sa_len;
+    int fd = bridge_socket(ctx->addr, &sa, &sa_len);
+    if(fd < 0)
+    {
+        return JGB_ERR_IO;
+    }
+    if(connect(fd, reinterpret_cast<struct sockaddr*>(&sa), sa_len))
+    {
+        close(fd);
+        return JGB_ERR_IO;
+    }
+    if(ctx->addr.is_unix())
+    {
+        // SOCK_SEQPACKET 的消息不能超过发送缓冲区，否则 sendmmsg() 返回 EMSGSIZE。
+        // 内核将设置的值加倍，其中一部分用于管理开销。
+        int need = ctx->max_frame + sizeof(bridge_header);
+        int sndbuf = 0;
+        socklen_t len = sizeof(sndbuf);
+        if(!getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) && sndbuf < 2 * need)
+        {
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &need, sizeof(need));
+            len = sizeof(sndbuf);
+            if(!getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) && sndbuf < 2 * need)
+            {
+                // 受 net.core.wmem_max 限制。
+                jgb_warning("SO_SNDBUF 小于 max_frame，较长的帧将被丢弃。{ sndbuf = %d, max_frame = %d }",
+                            sndbuf, ctx->max_frame);
+            }
+        }
+    }
+    if(ctx->zerocopy)
+    {
+        int one = 1;
+        if(setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+        {
+            jgb_warning("不支持 MSG_ZEROCOPY。{ error = %s }", strerror(errno));
+            ctx->zerocopy = false;
+        }
+    }
+    ctx->fd = fd;
+    ctx->zc_sent = 0;
+    ctx->zc_done = 0;
+    jgb_info("bridge connected. { path = %s, host = %s, port = %d }",
+             ctx->addr.path.c_str(), ctx->addr.host.c_str(), ctx->addr.port);
+    return 0;
+}
+
+static void send_close(context_5e0b7c93d1a4* ctx)
+{
+    close(ctx->fd);
+    ctx->fd = -1;
+    ctx->zc_closing = false;
+    jgb_info("bridge disconnected.");
+}
+
+// Unix 域套接字：每帧一个消息，一次 sendmmsg() 发送多帧。内核在返回前复制数据，返回后即可释放帧。
+// 超过发送缓冲区的消息（EMSGSIZE）只丢弃该帧，不断开连接。
+static int send_seqpacket(context_5e0b7c93d1a4* ctx, int count)
+{
+    for(int i=0; i<count; i++)
+    {
+        memset(&ctx->msgs[i], 0, sizeof(ctx->msgs[i]));
+        ctx->msgs[i].msg_hdr.msg_iov = &ctx->iov[2 * i];
+        ctx->msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+    for(int sent=0; sent<count; )
+    {
+        int n = sendmmsg(ctx->fd, &ctx->msgs[sent], count - sent, MSG_NOSIGNAL);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(errno == EMSGSIZE)
+            {
+                jgb_warning("帧超过发送缓冲区，丢弃。{ len = %u }", ctx->hdrs[sent].len);
+                ++ ctx->stat_dropped_frames;
+                ++ sent;
+                continue;
+            }
+            jgb_warning("sendmmsg. { error = %s }", strerror(errno));
+            ctx->stat_dropped_frames += count - sent;
+            return JGB_ERR_IO;
+        }
+        ++ ctx->stat_send_calls;
+        ctx->stat_sent_frames += n;
+        for(int i=sent; i<sent+n; i++)
+        {
+            ctx->stat_sent_bytes += ctx->hdrs[i].len;
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+// MSG_ZEROCOPY：读取错误队列中已有的完成通知，不等待；按发送的顺序释放已完成的批次。
+static int reap_zerocopy(context_5e0b7c93d1a4* ctx)
+{
+    for(;;)
+    {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if(recvmsg(ctx->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(errno == EAGAIN)
+            {
+                break;
+            }
+            jgb_warning("recvmsg(MSG_ERRQUEUE). { error = %s }", strerror(errno));
+            return JGB_ERR_IO;
+        }
+        for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+            {
+                struct sock_extended_err* err = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cm));
+                if(err->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+                {
+                    // [ee_info, ee_data] 范围内的发送已完成，按发送的顺序通知。
+                    ctx->zc_done = err->ee_data + 1;
+                    if(err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                    {
+                        ctx->stat_zc_copied += err->ee_data - err->ee_info + 1;
+                    }
+                }
+            }
+        }
+    }
+
+    while(!ctx->zc_pending.empty() && static_cast<int32_t>(ctx->zc_done - ctx->zc_pending.front().end) >= 0)
+    {
+        zerocopy_batch& b = ctx->zc_pending.front();
+        for(auto& h: b.handles)
+        {
+            h.reset();
+        }
+        b.handles.clear();
+        ctx->zc_free.push_back(std::move(b));
+        ctx->zc_pending.pop_front();
+    }
+    return 0;
+}
+
+// MSG_ZEROCOPY：等待最多 timeout 毫秒，直到有新的完成通知。
+static int wait_zerocopy(context_5e0b7c93d1a4* ctx, int timeout)
+{
+    // 错误队列可读时 poll() 返回 POLLERR。
+    struct pollfd pfd = { ctx->fd, 0, 0 };
+    if(poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+    {
+        return JGB_ERR_IO;
+    }
+    return reap_zerocopy(ctx);
+}
+
+// TCP：一次 sendmsg() 发送多帧，各帧的载荷直接引用缓冲区中的数据。*sent 为已完整发送的 iovec 数。
+// 每次以 MSG_ZEROCOPY 调用 sendmsg() 成功时增加一次 zc_sent，出错时此前的发送仍须等待完成通知。
+// ENOBUFS 表示尚未完成的 MSG_ZEROCOPY 发送超过了 optmem 限制：等待完成通知后继续发送，
+// 没有尚未完成的发送时复制发送。
+static int send_stream(context_5e0b7c93d1a4* ctx, struct iovec* iov, int iovlen, int* sent)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovlen;
+    *sent = 0;
+    int flags = MSG_NOSIGNAL | (ctx->zerocopy ? MSG_ZEROCOPY : 0);
+    while(msg.msg_iovlen > 0)
+    {
+        ssize_t n = sendmsg(ctx->fd, &msg, flags);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(errno == ENOBUFS && (flags & MSG_ZEROCOPY))
+            {
+                if(ctx->zc_done == ctx->zc_sent)
+                {
+                    flags &= ~MSG_ZEROCOPY;
+                }
+                else if(wait_zerocopy(ctx, 100))
+                {
+                    return JGB_ERR_IO;
+                }
+                continue;
+            }
+            jgb_warning("sendmsg. { error = %s }", strerror(errno));
+            return JGB_ERR_IO;
+        }
+        ++ ctx->stat_send_calls;
+        if(flags & MSG_ZEROCOPY)
+        {
+            ++ ctx->zc_sent;
+        }
+        // 跳过已发送的部分。
+        while(msg.msg_iovlen > 0 && static_cast<size_t>(n) >= msg.msg_iov->iov_len)
+        {
+            n -= msg.msg_iov->iov_len;
+            ++ msg.msg_iov;
+            -- msg.msg_iovlen;
+            ++ *sent;
+        }
+        if(msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = static_cast<uint8_t*>(msg.msg_iov->iov_base) + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// send_stream() 之后统计：帧头 hdrs 所对应的 count 帧中，前 sent / 2 帧已完整发送，其余的帧被丢弃。
+static void count_stream(context_5e0b7c93d1a4* ctx, const bridge_header* hdrs, int count, int sent)
+{
+    int frames = sent / 2;
+    for(int i=0; i<frames; i++)
+    {
+        ctx->stat_sent_bytes += hdrs[i].len;
+    }
+    ctx->stat_sent_frames += frames;
+    ctx->stat_dropped_frames += count - frames;
+}
+
+static int send_init(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    jgb_assert(w->get_reader(0));
+    context_5e0b7c93d1a4* ctx = new context_5e0b7c93d1a4;
+    jgb::config* conf = w->get_config();
+    int r = bridge_get_addr(conf, &ctx->addr);
+    if(r)
+    {
+        delete ctx;
+        return r;
+    }
+    conf->get("batch", ctx->batch);
+    conf->get("max_frame", ctx->max_frame);
+    conf->get("zerocopy", ctx->zerocopy);
+    ctx->batch = clamp_batch(ctx->batch);
+    if(ctx->max_frame <= 0)
+    {
+        ctx->max_frame = 65536;
+    }
+    if(ctx->zerocopy && ctx->addr.is_unix())
+    {
+        // Unix 域套接字不支持 MSG_ZEROCOPY，sendmmsg() 返回前已复制数据。
+        ctx->zerocopy = false;
+    }
+    ctx->frms.resize(ctx->batch);
+    ctx->hdrs.resize(ctx->batch);
+    ctx->iov.resize(2 * ctx->batch);
+    ctx->msgs.resize(ctx->batch);
+    w->task_->instance_->user_ = ctx;
+    jgb_info("{ path = %s, host = %s, port = %d, batch = %d, max_frame = %d, zerocopy = %d }",
+             ctx->addr.path.c_str(), ctx->addr.host.c_str(), ctx->addr.port, ctx->batch, ctx->max_frame,
+             ctx->zerocopy);
+    return 0;
+}
+
+// 填写第 n 帧的帧头及 iovec。
+static void send_fill(context_5e0b7c93d1a4* ctx, bridge_header* hdr, const jgb::frame& frm, int n)
+{
+    hdr->len = frm.len;
+    hdr->flags = frm.flags & BRIDGE_FRAME_FLAGS;
+    ctx->iov[2 * n].iov_base = hdr;
+    ctx->iov[2 * n].iov_len = sizeof(*hdr);
+    ctx->iov[2 * n + 1].iov_base = frm.buf;
+    ctx->iov[2 * n + 1].iov_len = frm.len;
+}
+
+// 超过 max_frame 的帧接收端无法接收，在发送之前丢弃。
+static bool send_oversized(context_5e0b7c93d1a4* ctx, const jgb::frame& frm)
+{
+    if(frm.len <= ctx->max_frame)
+    {
+        return false;
+    }
+    jgb_warning("帧超过 max_frame，丢弃。{ len = %d, max_frame = %d }", frm.len, ctx->max_frame);
+    ++ ctx->stat_dropped_frames;
+    return true;
+}
+
+// MSG_ZEROCOPY：以句柄获取各帧，发送后不等待完成通知，各批次按完成的顺序释放。
+// 从未释放尚未完成的帧：连接断开时，等待已发送的批次全部完成后才关闭套接字。
+static int send_zerocopy(context_5e0b7c93d1a4* ctx, jgb::reader* rd)
+{
+    if(reap_zerocopy(ctx))
+    {
+        ctx->zc_closing = true;
+    }
+    if(ctx->zc_closing)
+    {
+        if(ctx->zc_pending.empty())
+        {
+            send_close(ctx);
+        }
+        else
+        {
+            wait_zerocopy(ctx, 100);
+        }
+        return 0;
+    }
+    if(ctx->zc_pending.size() >= BRIDGE_ZEROCOPY_BATCHES)
+    {
+        wait_zerocopy(ctx, 100);
+        return 0;
+    }
+
+    zerocopy_batch b;
+    if(!ctx->zc_free.empty())
+    {
+        b = std::move(ctx->zc_free.back());
+        ctx->zc_free.pop_back();
+    }
+    b.handles.resize(ctx->batch);
+    b.hdrs.resize(ctx->batch);
+    int count = 0;
+    while(count < ctx->batch)
+    {
+        // 只等待第一帧。
+        int r = rd->request_frame(&b.handles[count], count ? 0 : 100);
+        if(r == JGB_ERR_NOT_SUPPORT)
+        {
+            jgb_warning("缓冲区不支持帧句柄，不使用 MSG_ZEROCOPY。{ buf = %s }", rd->buf_->id().c_str());
+            ctx->zerocopy = false;
+            break;
+        }
+        if(r)
+        {
+            break;
+        }
+        const jgb::frame& frm = b.handles[count].get();
+        if(send_oversized(ctx, frm))
+        {
+            b.handles[count].reset();
+            continue;
+        }
+        send_fill(ctx, &b.hdrs[count], frm, count);
+        ++ count;
+    }
+    b.handles.resize(count);
+    if(!count)
+    {
+        ctx->zc_free.push_back(std::move(b));
+        return 0;
+    }
+
+    int sent;
+    int r = send_stream(ctx, ctx->iov.data(), 2 * count, &sent);
+    count_stream(ctx, b.hdrs.data(), count, sent);
+    // 部分发送后出错时，已发送的部分仍可能被内核引用。
+    b.end = ctx->zc_sent;
+    ctx->zc_pending.push_back(std::move(b));
+    if(r)
+    {
+        // 连接断开，之后重新连接；未发送完的帧被丢弃。
+        ctx->zc_closing = true;
+    }
+    return 0;
+}
+
+static int send_loop(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    context_5e0b7c93d1a4* ctx = (context_5e0b7c93d1a4*) w->get_user();
+    jgb::reader* rd = w->get_reader(0);
+
+    if(ctx->fd < 0 && send_connect(ctx))
+    {
+        // 接收端尚未启动。
+        jgb::sleep(100);
+        return 0;
+    }
+
+    if(ctx->zerocopy || ctx->zc_closing || !ctx->zc_pending.empty())
+    {
+        return send_zerocopy(ctx, rd);
+    }
+
+    int count;
+    int r = rd->request_frames(ctx->frms.data(), ctx->batch, &count);
+    if(r)
+    {
+        return 0;
+    }
+    int n = 0;
+    for(int i=0; i<count; i++)
+    {
+        jgb::frame& frm = ctx->frms[i];
+        if(send_oversized(ctx, frm))
+        {
+            continue;
+        }
+        send_fill(ctx, &ctx->hdrs[n], frm, n);
+        ++ n;
+    }
+
+    // 已发送、丢弃的帧在 send_seqpacket()、count_stream() 中计数。
+    if(ctx->addr.is_unix())
+    {
+        r = send_seqpacket(ctx, n);
+    }
+    else
+    {
+        int sent;
+        r = send_stream(ctx, ctx->iov.data(), 2 * n, &sent);
+        count_stream(ctx, ctx->hdrs.data(), n, sent);
+    }
+    rd->release(count);
+    if(r)
+    {
+        // 连接断开，之后重新连接；未发送完的帧被丢弃。
+        send_close(ctx);
+    }
+    return 0;
+}
+
+static void send_exit(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    context_5e0b7c93d1a4* ctx = (context_5e0b7c93d1a4*) w->get_user();
+    // 帧句柄须在删除缓冲区之前释放：最多等待 1 秒，让已发送的批次完成。
+    for(int i=0; i<10 && !ctx->zc_pending.empty(); i++)
+    {
+        if(wait_zerocopy(ctx, 100))
+        {
+            break;
+        }
+    }
+    if(!ctx->zc_pending.empty())
+    {
+        jgb_warning("MSG_ZEROCOPY 发送未完成。{ batches = %lu }", ctx->zc_pending.size());
+    }
+    jgb_info("send buf: %s, frames = %ld, bytes = %ld, calls = %ld, dropped = %ld, zerocopy copied = %ld",
+             w->get_reader(0)->buf_->id().c_str(), ctx->stat_sent_frames, ctx->stat_sent_bytes,
+             ctx->stat_send_calls, ctx->stat_dropped_frames, ctx->stat_zc_copied);
+    delete ctx;
+}
+
+static loop_ptr_t send_loops[] = { send_loop, nullptr };
+
+static jgb_loop_t send_loop_
+{
+    .setup = send_init,
+    .loops = send_loops,
+    .exit = send_exit
+};
+
+jgb_api_t send_buffer
+{
+    .version = MAKE_API_VERSION(0, 1),
+    .desc = "send buffer frames over unix/tcp socket",
+    .init = nullptr,
+    .release = nullptr,
+    .create = nullptr,
+    .destroy = nullptr,
+    .commit = nullptr,
+    .loop = &send_loop_
+};
+
+// recv_buffer
+
+// 已接收、尚未写入缓冲区的帧。
+struct bridge_frame
+{
+    bridge_header hdr;
+    uint8_t* payload;
+};
+
+struct context_8a27f4c6e05d
+{
+    bridge_addr addr;
+    int listen_fd;
+    int fd;
+    int batch;
+    // 载荷的最大长度。
+    int max_frame;
+    int timeout;
+
+    // Unix 域套接字：第 i 个消息的载荷接收到 rx[i * max_frame]；
+    // TCP：接收缓冲区，rx_len 为已接收的字节数。
+    std::vector<uint8_t> rx;
+    size_t rx_len;
+    std::vector<bridge_header> hdrs;
+    std::vector<struct iovec> iov;
+    std::vector<struct mmsghdr> msgs;
+    std::vector<bridge_frame> pending;
+    // Unix 域套接字：对端已关闭连接，写完 pending 中的帧之后关闭。
+    bool eof;
+
+    int64_t stat_recv_frames;
+    int64_t stat_recv_bytes;
+    int64_t stat_recv_calls;
+    int64_t stat_dropped_frames;
+
+    context_8a27f4c6e05d()
+        : listen_fd(-1),
+        fd(-1),
+        batch(64),
+        max_frame(65536),
+        timeout(100),
+        rx_len(0),
+        eof(false),
+        stat_recv_frames(0L),
+        stat_recv_bytes(0L),
+        stat_recv_calls(0L),
+        stat_dropped_frames(0L)
+    {
+    }
+
+    ~context_8a27f4c6e05d()
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        if(listen_fd >= 0)
+        {
+            close(listen_fd);
+        }
+        if(addr.is_unix())
+        {
+            unlink(addr.path.c_str());
+        }
+    }
+};
+
+static int recv_listen(context_8a27f4c6e05d* ctx)
+{
+    struct sockaddr_storage sa;
+    socklen_t sa_len;
+    int fd = bridge_socket(ctx->addr, &sa, &sa_len);
+    if(fd < 0)
+    {
+        jgb_fail("socket. { error = %s }", strerror(errno));
+        return JGB_ERR_IO;
+    }
+    if(ctx->addr.is_unix())
+    {
+        unlink(ctx->addr.path.c_str());
+    }
+    else
+    {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if(bind(fd, reinterpret_cast<struct sockaddr*>(&sa), sa_len) || listen(fd, 1))
+    {
+        jgb_fail("bind/listen. { path = %s, host = %s, port = %d, error = %s }",
+                 ctx->addr.path.c_str(), ctx->addr.host.c_str(), ctx->addr.port, strerror(errno));
+        close(fd);
+        return JGB_ERR_IO;
+    }
+    ctx->listen_fd = fd;
+    return 0;
+}
+
+// 将 pending 中的帧写入缓冲区，返回已写入的帧数。
+// 能够放入同一批的帧一次提交；长度超过缓冲区一半的帧单独写入，超过缓冲区的帧被丢弃。
+static int write_frames(context_8a27f4c6e05d* ctx, jgb::writer* wr)
+{
+    int n = ctx->pending.size();
+    int limit = wr->buf_->len_ / 2;
+    // 完整性校验时每帧多占 4 字节。
+    int extra = wr->buf_->crc_ ? sizeof(uint32_t) : 0;
+    int written = 0;
+    while(written < n)
+    {
+        int first = written;
+        int total = 0;
+        int end = first;
+        while(end < n)
+        {
+            int frame_len = jgb::writer::frame_size(ctx->pending[end].hdr.len) + extra;
+            if(total + frame_len > limit)
+            {
+                break;
+            }
+            total += frame_len;
+            ++ end;
+        }
+
+        int r;
+        if(end == first)
+        {
+            // 单独写入一帧。
+            bridge_frame& f = ctx->pending[first];
+            uint8_t* p;
+            r = wr->request_buffer(&p, f.hdr.len, ctx->timeout);
+            if(r == JGB_ERR_LIMIT)
+            {
+                jgb_warning("帧超过缓冲区容量，丢弃。{ len = %u }", f.hdr.len);
+                ++ ctx->stat_dropped_frames;
+                ++ written;
+                continue;
+            }
+            if(r)
+            {
+                break;
+            }
+            memcpy(p, f.payload, f.hdr.len);
+            r = wr->commit(f.hdr.len, 0, f.hdr.flags & BRIDGE_FRAME_FLAGS);
+            jgb_assert(!r);
+            ++ written;
+            continue;
+        }
+
+        r = wr->request_batch(total, ctx->timeout);
+        if(r)
+        {
+            break;
+        }
+        for(int i=first; i<end; i++)
+        {
+            bridge_frame& f = ctx->pending[i];
+            uint8_t* p;
+            r = wr->request_batch_frame(&p, f.hdr.len, f.hdr.flags & BRIDGE_FRAME_FLAGS);
+            jgb_assert(!r);
+            memcpy(p, f.payload, f.hdr.len);
+        }
+        r = wr->commit_batch();
+        jgb_assert(!r);
+        written = end;
+    }
+    return written;
+}
+
+static void recv_close(context_8a27f4c6e05d* ctx)
+{
+    ctx->stat_dropped_frames += ctx->pending.size();
+    ctx->pending.clear();
+    ctx->rx_len = 0;
+    ctx->eof = false;
+    close(ctx->fd);
+    ctx->fd = -1;
+    jgb_info("bridge disconnected.");
+}
+
+// Unix 域套接字：一次 recvmmsg() 接收多帧，帧头、载荷分别接收到 hdrs、rx。
+static int recv_seqpacket(context_8a27f4c6e05d* ctx)
+{
+    for(int i=0; i<ctx->batch; i++)
+    {
+        ctx->iov[2 * i].iov_base = &ctx->hdrs[i];
+        ctx->iov[2 * i].iov_len = sizeof(bridge_header);
+        ctx->iov[2 * i + 1].iov_base = &ctx->rx[static_cast<size_t>(i) * ctx->max_frame];
+        ctx->iov[2 * i + 1].iov_len = ctx->max_frame;
+        memset(&ctx->msgs[i], 0, sizeof(ctx->msgs[i]));
+        ctx->msgs[i].msg_hdr.msg_iov = &ctx->iov[2 * i];
+        ctx->msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+    int n = recvmmsg(ctx->fd, ctx->msgs.data(), ctx->batch, MSG_DONTWAIT, nullptr);
+    if(n < 0)
+    {
+        return errno == EAGAIN || errno == EINTR ? 0 : JGB_ERR_IO;
+    }
+    ++ ctx->stat_recv_calls;
+    for(int i=0; i<n; i++)
+    {
+        struct msghdr& mh = ctx->msgs[i].msg_hdr;
+        unsigned int len = ctx->msgs[i].msg_len;
+        if(!len)
+        {
+            // 对端关闭连接：先写入已接收的帧，之后再关闭。
+            if(ctx->pending.empty())
+            {
+                return JGB_ERR_END;
+            }
+            ctx->eof = true;
+            break;
+        }
+        if((mh.msg_flags & MSG_TRUNC) || len < sizeof(bridge_header) || ctx->hdrs[i].len != len - sizeof(bridge_header))
+        {
+            jgb_warning("帧无效或者超过 max_frame，丢弃。{ len = %u, max_frame = %d }", len, ctx->max_frame);
+            ++ ctx->stat_dropped_frames;
+            continue;
+        }
+        ctx->pending.push_back({ ctx->hdrs[i], static_cast<uint8_t*>(ctx->iov[2 * i + 1].iov_base) });
+    }
+    return 0;
+}
+
+// TCP：按帧头拆分接收缓冲区中的完整帧。
+static int parse_stream(context_8a27f4c6e05d* ctx)
+{
+    size_t off = 0;
+    while(ctx->rx_len - off >= sizeof(bridge_header))
+    {
+        bridge_header hdr;
+        memcpy(&hdr, &ctx->rx[off], sizeof(hdr));
+        if(hdr.len > static_cast<uint32_t>(ctx->max_frame))
+        {
+            jgb_warning("帧超过 max_frame。{ len = %u, max_frame = %d }", hdr.len, ctx->max_frame);
+            return JGB_ERR_LIMIT;
+        }
+        if(ctx->rx_len - off - sizeof(hdr) < hdr.len)
+        {
+            break;
+        }
+        ctx->pending.push_back({ hdr, &ctx->rx[off + sizeof(hdr)] });
+        off += sizeof(hdr) + hdr.len;
+    }
+    return 0;
+}
+
+// TCP：一次 recv() 接收多帧。
+static int recv_stream(context_8a27f4c6e05d* ctx)
+{
+    ssize_t n = recv(ctx->fd, &ctx->rx[ctx->rx_len], ctx->rx.size() - ctx->rx_len, MSG_DONTWAIT);
+    if(n < 0)
+    {
+        return errno == EAGAIN || errno == EINTR ? 0 : JGB_ERR_IO;
+    }
+    if(!n)
+    {
+        return JGB_ERR_END;
+    }
+    ++ ctx->stat_recv_calls;
+    ctx->rx_len += n;
+    return parse_stream(ctx);
+}
+
+static int recv_init(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    jgb_assert(w->get_writer(0));
+    context_8a27f4c6e05d* ctx = new context_8a27f4c6e05d;
+    jgb::config* conf = w->get_config();
+    int r = bridge_get_addr(conf, &ctx->addr);
+    if(!r)
+    {
+        conf->get("batch", ctx->batch);
+        conf->get("max_frame", ctx->max_frame);
+        conf->get("timeout", ctx->timeout);
+        ctx->batch = clamp_batch(ctx->batch);
+        if(ctx->max_frame <= 0)
+        {
+            ctx->max_frame = 65536;
+        }
+        r = recv_listen(ctx);
+    }
+    if(r)
+    {
+        delete ctx;
+        return r;
+    }
+    if(ctx->addr.is_unix())
+    {
+        ctx->rx.resize(static_cast<size_t>(ctx->batch) * ctx->max_frame);
+        ctx->hdrs.resize(ctx->batch);
+        ctx->iov.resize(2 * ctx->batch);
+        ctx->msgs.resize(ctx->batch);
+    }
+    else
+    {
+        // 至少能容纳一帧。
+        ctx->rx.resize(std::max(static_cast<size_t>(ctx->batch) * 1500,
+                                sizeof(bridge_header) + ctx->max_frame));
+    }
+    ctx->pending.reserve(ctx->addr.is_unix() ? ctx->batch : ctx->rx.size() / sizeof(bridge_header));
+    w->task_->instance_->user_ = ctx;
+    jgb_info("{ path = %s, host = %s, port = %d, batch = %d, max_frame = %d }",
+             ctx->addr.path.c_str(), ctx->addr.host.c_str(), ctx->addr.port, ctx->batch, ctx->max_frame);
+    return 0;
+}
+
+static int recv_loop(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    context_8a27f4c6e05d* ctx = (context_8a27f4c6e05d*) w->get_user();
+    jgb::writer* wr = w->get_writer(0);
+
+    if(ctx->fd < 0)
+    {
+        struct pollfd pfd = { ctx->listen_fd, POLLIN, 0 };
+        if(poll(&pfd, 1, 100) > 0)
+        {
+            ctx->fd = accept4(ctx->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if(ctx->fd >= 0)
+            {
+                jgb_info("bridge accepted. { buf = %s }", wr->buf_->id().c_str());
+            }
+        }
+        return 0;
+    }
+
+    // 先写入上次因缓冲区已满而未能写入的帧。
+    if(ctx->pending.empty())
+    {
+        if(ctx->eof)
+        {
+            recv_close(ctx);
+            return 0;
+        }
+        struct pollfd pfd = { ctx->fd, POLLIN, 0 };
+        if(poll(&pfd, 1, 100) <= 0)
+        {
+            return 0;
+        }
+        int r = ctx->addr.is_unix() ? recv_seqpacket(ctx) : recv_stream(ctx);
+        if(r)
+        {
+            recv_close(ctx);
+            return 0;
+        }
+    }
+
+    int n = write_frames(ctx, wr);
+    for(int i=0; i<n; i++)
+    {
+        ctx->stat_recv_bytes += ctx->pending[i].hdr.len;
+    }
+    ctx->stat_recv_frames += n;
+    if(!ctx->addr.is_unix() && n > 0)
+    {
+        // 移走已写入的帧，重新拆分剩余的帧。
+        bridge_frame& last = ctx->pending[n - 1];
+        size_t used = last.payload + last.hdr.len - ctx->rx.data();
+        memmove(ctx->rx.data(), ctx->rx.data() + used, ctx->rx_len - used);
+        ctx->rx_len -= used;
+        ctx->pending.clear();
+        if(parse_stream(ctx))
+        {
+            recv_close(ctx);
+        }
+        return 0;
+    }
+    ctx->pending.erase(ctx->pending.begin(), ctx->pending.begin() + n);
+    return 0;
+}
+
+static void recv_exit(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    context_8a27f4c6e05d* ctx = (context_8a27f4c6e05d*) w->get_user();
+    jgb_info("recv buf: %s, frames = %ld, bytes = %ld, calls = %ld, dropped = %ld",
+             w->get_writer(0)->buf_->id().c_str(), ctx->stat_recv_frames, ctx->stat_recv_bytes,
+             ctx->stat_recv_calls, ctx->stat_dropped_frames);
+    delete ctx;
+}
+
+static loop_ptr_t recv_loops[] = { recv_loop, nullptr };
+
+static jgb_loop_t recv_loop_
+{
+    .setup = recv_init,
+    .loops = recv_loops,
+    .exit = recv_exit
+};
+
+jgb_api_t recv_buffer
+{
+    .version = MAKE_API_VERSION(0, 1),
+    .desc = "receive frames from unix/tcp socket into buffer",
+    .init = nullptr,
+    .release = nullptr,
+    .create = nullptr,
+    .destroy = nullptr,
+    .commit = nullptr,
+    .loop = &recv_loop_
+};
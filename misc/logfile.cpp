@@ -181,14 +181,18 @@ static int tsk_loop(void* worker)
     jgb::worker* w = (jgb::worker*) worker;
     context_a01064074357* ctx = (context_a01064074357*) w->get_user();
     jgb::reader* rd = w->get_reader(0);
-    jgb::frame frm;
+    jgb::frame frms[32];
+    int count;
     int r;
-    r = rd->request_frame(&frm);
+    r = rd->request_frames(frms, sizeof(frms) / sizeof(frms[0]), &count);
     if(!r)
     {
-        log_frame_header* h = (log_frame_header*) frm.buf;
-        r = ctx->write(h->level, h->log, frm.len - sizeof(log_frame_header));
-        rd->release();
+        for(int i=0; i<count; i++)
+        {
+            log_frame_header* h = (log_frame_header*) frms[i].buf;
+            ctx->write(h->level, h->log, frms[i].len - sizeof(log_frame_header));
+        }
+        rd->release(count);
     }
     return 0;
 }
@@ -0,0 +1,510 @@
+#include "core.h"
+#include "helper.h"
+#include <boost/thread.hpp>
+#include <map>
+
+// 流水线：由阶段（应用实例）及边（缓冲区）组成的有向图。
+// "stages" 为阶段的实例配置的路径；边由各阶段的 task/readers、task/writers 的 buf_id 确定，
+// "edges" 中声明的边（buf_id、buf_size 及写者配置中的缓冲区选项）在启动阶段之前创建。
+// 启动时按拓扑顺序先启动消费者、后启动生产者，同一层的阶段同时启动；停止时顺序相反。
+// 图及各边的吞吐量保存在实例配置的 "graph" 中。
+
+struct pipeline_stage
+{
+    jgb::instance* inst;
+    std::string path;
+    // 读取、写入的边在 edges 中的序号。
+    std::vector<int> inputs;
+    std::vector<int> outputs;
+    // 到终点的最长路径，没有下游的阶段为 0。
+    int level;
+    // 拓扑排序时的状态：0 未访问，1 访问中，2 已完成。
+    int mark;
+};
+
+struct pipeline_edge
+{
+    std::string buf_id;
+    // "edges" 中声明的边的配置，没有声明时为 nullptr。
+    jgb::config* conf;
+    int buf_size;
+    // 写入、读取该边的阶段在 stages 中的序号。
+    std::vector<int> from;
+    std::vector<int> to;
+    // 读写其他进程的共享内存缓冲区，生产者可能不在本流水线中。
+    bool shm;
+    jgb::buffer* buf;
+
+    // 绑定到 graph/edges[i]。
+    int64_t frames;
+    int64_t bytes;
+    int64_t frames_per_sec;
+    int64_t bytes_per_sec;
+
+    pipeline_edge()
+        : conf(nullptr),
+        buf_size(0),
+        shm(false),
+        buf(nullptr),
+        frames(0L),
+        bytes(0L),
+        frames_per_sec(0L),
+        bytes_per_sec(0L)
+    {
+    }
+};
+
+struct context_b41d6e0a93c7
+{
+    std::vector<pipeline_stage> stages;
+    std::vector<pipeline_edge> edges;
+    // levels[i] 为第 i 层的阶段，按启动的先后排列。
+    std::vector<std::vector<int>> levels;
+    // 统计吞吐量的间隔，单位秒。
+    int interval;
+    int64_t last_stat_time;
+};
+
+static int find_edge(context_b41d6e0a93c7* ctx, std::map<std::string, int>& index, const std::string& id)
+{
+    auto it = index.find(id);
+    if(it != index.end())
+    {
+        return it->second;
+    }
+    ctx->edges.emplace_back();
+    ctx->edges.back().buf_id = id;
+    int e = ctx->edges.size() - 1;
+    index.emplace(id, e);
+    return e;
+}
+
+// 读取阶段 s 的读者、写者所在的缓冲区。已声明的边由流水线创建，写者配置 buf_size 时返回 JGB_ERR_INVALID。
+static int add_stage_io(context_b41d6e0a93c7* ctx, std::map<std::string, int>& index, int s)
+{
+    pipeline_stage& stage = ctx->stages[s];
+    const char* io[] = { "task/readers", "task/writers" };
+    for(int k=0; k<2; k++)
+    {
+        jgb::value* val;
+        if(stage.inst->conf_->get(io[k], &val))
+        {
+            continue;
+        }
+        for(int i=0; i<val->len_; i++)
+        {
+            std::string id;
+            if(val->conf_[i]->get("buf_id", id) || id.empty())
+            {
+                continue;
+            }
+            int e = find_edge(ctx, index, id);
+            pipeline_edge& edge = ctx->edges[e];
+            bool shm = false;
+            val->conf_[i]->get("shm", shm);
+            edge.shm |= shm;
+            if(k)
+            {
+                stage.outputs.push_back(e);
+                edge.from.push_back(s);
+                int sz;
+                if(edge.conf && !val->conf_[i]->get("buf_size", sz))
+                {
+                    // 消费者先启动，生产者启动时缓冲区已在使用中，不能再按写者的配置修改。
+                    jgb_fail("边已声明，缓冲区的大小及选项由 edges 配置，写者不能配置 buf_size。{ stage = %s, buf_id = %s }",
+                             stage.path.c_str(), id.c_str());
+                    return JGB_ERR_INVALID;
+                }
+            }
+            else
+            {
+                stage.inputs.push_back(e);
+                edge.to.push_back(s);
+            }
+        }
+    }
+    return 0;
+}
+
+// 计算阶段 s 的层次，发现环时返回 JGB_ERR_INVALID。
+static int visit_stage(context_b41d6e0a93c7* ctx, int s)
+{
+    pipeline_stage& stage = ctx->stages[s];
+    if(stage.mark == 2)
+    {
+        return 0;
+    }
+    if(stage.mark == 1)
+    {
+        jgb_fail("pipeline has a cycle. { stage = %s }", stage.path.c_str());
+        return JGB_ERR_INVALID;
+    }
+    stage.mark = 1;
+    stage.level = 0;
+    for(int e: stage.outputs)
+    {
+        for(int t: ctx->edges[e].to)
+        {
+            int r = visit_stage(ctx, t);
+            if(r)
+            {
+                return r;
+            }
+            stage.level = std::max(stage.level, ctx->stages[t].level + 1);
+        }
+    }
+    stage.mark = 2;
+    return 0;
+}
+
+static int check_edges(context_b41d6e0a93c7* ctx)
+{
+    int r = 0;
+    for(auto& edge: ctx->edges)
+    {
+        if(edge.from.empty() && !edge.to.empty() && !edge.shm)
+        {
+            jgb_fail("edge has readers but no writer. { buf_id = %s }", edge.buf_id.c_str());
+            r = JGB_ERR_INVALID;
+        }
+        else if(edge.from.empty() && edge.to.empty())
+        {
+            jgb_warning("edge is not used by any stage. { buf_id = %s }", edge.buf_id.c_str());
+        }
+        else if(edge.to.empty() && !edge.shm)
+        {
+            jgb_warning("edge has no reader. { buf_id = %s }", edge.buf_id.c_str());
+        }
+    }
+    return r;
+}
+
+static void create_string_array(jgb::config* c, const char* name, const std::vector<std::string>& strs)
+{
+    if(strs.empty())
+    {
+        return;
+    }
+    jgb::value* v = new jgb::value(jgb::value::data_type::string, strs.size(), true);
+    for(size_t i=0; i<strs.size(); i++)
+    {
+        v->set(strs[i], i);
+    }
+    c->create(name, v);
+}
+
+// 在实例配置中创建 "graph"：各层的阶段，及各边的生产者、消费者及吞吐量。
+static void create_graph(jgb::config* conf, context_b41d6e0a93c7* ctx)
+{
+    conf->remove("graph");
+    jgb::config* graph = new jgb::config();
+
+    if(!ctx->levels.empty())
+    {
+        jgb::value* levels = new jgb::value(jgb::value::data_type::object, ctx->levels.size(), true);
+        for(size_t i=0; i<ctx->levels.size(); i++)
+        {
+            std::vector<std::string> paths;
+            for(int s: ctx->levels[i])
+            {
+                paths.push_back(ctx->stages[s].path);
+            }
+            create_string_array(levels->conf_[i], "stages", paths);
+        }
+        graph->create("levels", levels);
+    }
+
+    if(!ctx->edges.empty())
+    {
+        jgb::value* edges = new jgb::value(jgb::value::data_type::object, ctx->edges.size(), true);
+        for(size_t i=0; i<ctx->edges.size(); i++)
+        {
+            pipeline_edge& edge = ctx->edges[i];
+            jgb::config* c = edges->conf_[i];
+            c->create("buf_id", edge.buf_id);
+            std::vector<std::string> paths;
+            for(int s: edge.from)
+            {
+                paths.push_back(ctx->stages[s].path);
+            }
+            create_string_array(c, "from", paths);
+            paths.clear();
+            for(int s: edge.to)
+            {
+                paths.push_back(ctx->stages[s].path);
+            }
+            create_string_array(c, "to", paths);
+            c->create("frames", static_cast<int64_t>(0));
+            c->bind("frames", &edge.frames);
+            c->create("bytes", static_cast<int64_t>(0));
+            c->bind("bytes", &edge.bytes);
+            c->create("frames_per_sec", static_cast<int64_t>(0));
+            c->bind("frames_per_sec", &edge.frames_per_sec);
+            c->create("bytes_per_sec", static_cast<int64_t>(0));
+            c->bind("bytes_per_sec", &edge.bytes_per_sec);
+        }
+        graph->create("edges", edges);
+    }
+
+    conf->create("graph", graph);
+}
+
+// 读取边、阶段的配置，校验并按层次排列阶段。
+static int create_pipeline(jgb::config* c, context_b41d6e0a93c7* ctx)
+{
+    int r;
+    jgb::value* val;
+    std::map<std::string, int> index;
+    // 声明的边
+    r = c->get("edges", &val);
+    if(!r)
+    {
+        for(int i=0; i<val->len_; i++)
+        {
+            std::string id;
+            int sz;
+            if(val->conf_[i]->get("buf_id", id) || id.empty()
+                || val->conf_[i]->get("buf_size", sz) || sz <= 0)
+            {
+                jgb_fail("invalid edge, buf_id and buf_size are required. { edges[%d] }", i);
+                return JGB_ERR_INVALID;
+            }
+            if(index.count(id))
+            {
+                jgb_fail("duplicated edge. { buf_id = %s }", id.c_str());
+                return JGB_ERR_INVALID;
+            }
+            int e = find_edge(ctx, index, id);
+            ctx->edges[e].conf = val->conf_[i];
+            ctx->edges[e].buf_size = sz;
+        }
+    }
+
+    r = c->get("stages", &val);
+    if(r)
+    {
+        jgb_fail("stages not found.");
+        return JGB_ERR_INVALID;
+    }
+    jgb::config* root_conf = jgb::core::get_instance()->root_conf();
+    for(int i=0; i<val->len_; i++)
+    {
+        jgb::config* stage_conf;
+        jgb::instance* stage_inst = nullptr;
+        if(val->str_[i] && !root_conf->get(val->str_[i], &stage_conf))
+        {
+            stage_inst = jgb::instance::get_instance(stage_conf);
+        }
+        if(!stage_inst)
+        {
+            jgb_fail("invalid. { stages[%d] = %s }", i, val->str_[i] ? val->str_[i] : "");
+            return JGB_ERR_INVALID;
+        }
+        ctx->stages.push_back({ stage_inst, val->str_[i], {}, {}, 0, 0 });
+    }
+    for(size_t s=0; s<ctx->stages.size(); s++)
+    {
+        r = add_stage_io(ctx, index, s);
+        if(r)
+        {
+            return r;
+        }
+    }
+
+    r = check_edges(ctx);
+    for(size_t s=0; s<ctx->stages.size() && !r; s++)
+    {
+        r = visit_stage(ctx, s);
+    }
+    if(r)
+    {
+        return r;
+    }
+    for(size_t s=0; s<ctx->stages.size(); s++)
+    {
+        int level = ctx->stages[s].level;
+        if(static_cast<int>(ctx->levels.size()) <= level)
+        {
+            ctx->levels.resize(level + 1);
+        }
+        ctx->levels[level].push_back(s);
+    }
+    return 0;
+}
+
+static int create(void* conf)
+{
+    jgb::config* c = (jgb::config*) conf;
+    jgb_assert(c);
+    jgb::instance* inst = jgb::instance::get_instance(c);
+    jgb_assert(inst);
+    context_b41d6e0a93c7* ctx = new context_b41d6e0a93c7;
+    ctx->interval = 1;
+    ctx->last_stat_time = 0L;
+    c->get("interval", ctx->interval);
+    if(ctx->interval < 1)
+    {
+        ctx->interval = 1;
+    }
+
+    int r = create_pipeline(c, ctx);
+    if(r)
+    {
+        delete ctx;
+        return r;
+    }
+    inst->set_user(ctx);
+    create_graph(c, ctx);
+    jgb_info("pipeline created. { stages = %lu, edges = %lu, levels = %lu }",
+             ctx->stages.size(), ctx->edges.size(), ctx->levels.size());
+
+    bool run;
+    r = c->get("auto", run);
+    if(!r && run)
+    {
+        inst->start();
+    }
+    return 0;
+}
+
+static void destroy(void* conf)
+{
+    jgb::config* c = (jgb::config*) conf;
+    jgb_assert(c);
+    jgb::instance* inst = jgb::instance::get_instance(c);
+    jgb_assert(inst);
+    inst->stop();
+    c->remove("graph");
+    context_b41d6e0a93c7* ctx = static_cast<context_b41d6e0a93c7*>(inst->get_user());
+    delete ctx;
+}
+
+static void start_stage(context_b41d6e0a93c7* ctx, int s)
+{
+    int r = ctx->stages[s].inst->start();
+    if(r)
+    {
+        jgb_fail("start instance failed. { instance = %s, r = %d }", ctx->stages[s].path.c_str(), r);
+    }
+}
+
+static void stop_stage(context_b41d6e0a93c7* ctx, int s)
+{
+    ctx->stages[s].inst->stop();
+}
+
+// 同时对同一层的各阶段执行 fn。
+static void for_level(context_b41d6e0a93c7* ctx, const std::vector<int>& level,
+                      void (*fn)(context_b41d6e0a93c7*, int))
+{
+    if(level.size() == 1)
+    {
+        fn(ctx, level[0]);
+        return;
+    }
+    boost::thread_group threads;
+    for(int s: level)
+    {
+        threads.create_thread([ctx, s, fn]() { fn(ctx, s); });
+    }
+    threads.join_all();
+}
+
+static int tsk_init(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    jgb_assert(w);
+    context_b41d6e0a93c7* ctx = (context_b41d6e0a93c7*) w->get_user();
+
+    // 在启动阶段之前创建缓冲区，并持有引用，阶段重新启动时缓冲区保持不变。
+    for(auto& edge: ctx->edges)
+    {
+        edge.frames = 0L;
+        edge.bytes = 0L;
+        edge.buf = jgb::buffer_manager::get_instance()->add_buffer(edge.buf_id);
+        jgb_assert(edge.buf);
+        if(edge.conf && !edge.buf->len_)
+        {
+            edge.conf->get("shm", edge.buf->shm_);
+            int r = jgb::init_buffer(edge.buf, edge.conf, edge.buf_size);
+            if(r)
+            {
+                jgb_warning("create edge failed. { buf_id = %s, r = %d }", edge.buf_id.c_str(), r);
+            }
+        }
+    }
+
+    // 消费者先于生产者启动，生产者写入的帧不会因为消费者尚未加入而被覆盖或者丢失。
+    for(auto& level: ctx->levels)
+    {
+        for_level(ctx, level, start_stage);
+    }
+    ctx->last_stat_time = jgb::frame_clock();
+    return 0;
+}
+
+static int tsk_loop(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    context_b41d6e0a93c7* ctx = (context_b41d6e0a93c7*) w->get_user();
+    jgb::sleep(100);
+
+    int64_t now = jgb::frame_clock();
+    int64_t elapsed = now - ctx->last_stat_time;
+    if(elapsed < static_cast<int64_t>(ctx->interval) * 1000000000L)
+    {
+        return 0;
+    }
+    ctx->last_stat_time = now;
+    for(auto& edge: ctx->edges)
+    {
+        int64_t frames;
+        int64_t bytes;
+        edge.buf->writer_stat(&frames, &bytes);
+        edge.frames_per_sec = (frames - edge.frames) * 1000000000L / elapsed;
+        edge.bytes_per_sec = (bytes - edge.bytes) * 1000000000L / elapsed;
+        edge.frames = frames;
+        edge.bytes = bytes;
+    }
+    return 0;
+}
+
+static void tsk_exit(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    jgb_assert(w);
+    context_b41d6e0a93c7* ctx = (context_b41d6e0a93c7*) w->get_user();
+    // 生产者先于消费者停止，消费者可以读完已写入的帧。
+    for(auto it = ctx->levels.rbegin(); it != ctx->levels.rend(); ++it)
+    {
+        for_level(ctx, *it, stop_stage);
+    }
+    for(auto& edge: ctx->edges)
+    {
+        jgb::buffer_manager::get_instance()->remove_buffer(edge.buf);
+        edge.buf = nullptr;
+        edge.frames_per_sec = 0L;
+        edge.bytes_per_sec = 0L;
+    }
+}
+
+static loop_ptr_t loops[] = { tsk_loop, nullptr };
+
+static jgb_loop_t loop
+{
+    .setup = tsk_init,
+    .loops = loops,
+    .exit = tsk_exit
+};
+
+jgb_api_t pipeline
+{
+    .version = MAKE_API_VERSION(0, 1),
+    .desc = "pipeline",
+    .init = nullptr,
+    .release = nullptr,
+    .create = create,
+    .destroy = destroy,
+    .commit = nullptr,
+    .loop = &loop
+};
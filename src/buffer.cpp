@@ -26,21 +26,221 @@
 #include "error.h"
 #include "helper.h"
 #include <boost/thread.hpp>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <climits>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#ifdef JGB_HAVE_LZ4
+#include <lz4.h>
+#endif
 
 namespace jgb
 {
 
+// 迁移帧：len 为 0 的重定向帧，指示读者转到新的数据区的开始位置，参考 buffer::resize()。
+#define JGB_FRAME_MIGRATE 0x1
+// 填充帧：len 为 0 的重定向帧，指示读者跳过其后 start_offset 字节，参考 buffer::multi_writer_。
+#define JGB_FRAME_PAD 0x2
+// 帧之后不足以容纳填充帧的填充长度，单位 4 字节，计入帧的总长度。
+#define JGB_FRAME_PAD_SHIFT 4
+#define JGB_FRAME_PAD_MASK 0x70
+// 载荷之后（对齐到 4 字节）附加载荷的 CRC32C，计入帧的总长度，参考 buffer::crc_。
+#define JGB_FRAME_CRC 0x8
 struct __attribute__((packed)) frame_header
 {
     uint32_t serial; // 帧序列号，递增
     int len; // payload 长度，如果 len 为 0，指示读者返回到缓冲区的开始位置。
     int start_offset; // payload 开始位置相对帧开始位置的偏移量。
-    int unused;
+    int flags; // JGB_FRAME_*
+    int64_t timestamp; // 提交时间，参考 frame_clock()。
 
-    int total_len()
+    int total_len() const
     {
-        return sizeof(struct frame_header) + JGB_ALIGN(start_offset + len, 4);
+        return sizeof(struct frame_header) + JGB_ALIGN(start_offset + len, 4)
+            + ((flags & JGB_FRAME_CRC) ? sizeof(uint32_t) : 0)
+            + ((flags & JGB_FRAME_PAD_MASK) >> JGB_FRAME_PAD_SHIFT) * 4;
     }
+
+    // JGB_FRAME_CRC：CRC32C 的位置。
+    uint8_t* crc_pos()
+    {
+        return reinterpret_cast<uint8_t*>(this) + sizeof(struct frame_header) + JGB_ALIGN(start_offset + len, 4);
+    }
+};
+
+// 写者可以设置的帧标志，参考 buffer.h。低 8 位留作内部使用。
+#define JGB_FRAME_USER_FLAGS (JGB_FRAME_KEYFRAME | JGB_FRAME_DISCARDABLE | JGB_FRAME_END_OF_UNIT \
+                              | JGB_FRAME_CONTINUED | JGB_FRAME_CHUNK | JGB_FRAME_LZ4)
+
+// 压缩模式：载荷短于此长度的帧不压缩。
+#define JGB_LZ4_MIN_LEN 64
+
+// 共享内存缓冲区的最大读者数（所有进程合计）。
+#define JGB_SHM_MAX_READERS 32
+#define JGB_SHM_MAGIC 0x53424a47 // "GJBS"
+#define JGB_SHM_VERSION 2
+// 读者尚未确定读取位置，由写者在下一次提交时设置。
+#define JGB_SHM_POS_NONE UINT64_MAX
+
+enum shm_slot_state
+{
+    shm_slot_free = 0,
+    shm_slot_claiming = 1,
+    shm_slot_used = 2
+};
+
+// 共享内存中的读者状态。只有读者会移动读取位置；
+// 写者只设置尚未确定的读取位置，或者在读者为空时重置读取位置。
+struct shm_slot
+{
+    std::atomic<uint32_t> state;
+    std::atomic<int32_t> pid;
+    // 高 32 位为期待读取的帧序号，低 32 位为读指针相对数据区开始位置的偏移量。
+    std::atomic<uint64_t> pos;
+};
+
+// 共享内存的开始位置，其后为数据区。
+struct shm_header
+{
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    int32_t len; // 数据区长度
+    int32_t data_offset; // 数据区相对共享内存开始位置的偏移量
+
+    // 写者锁：0 表示空闲，否则为持有者的进程号。跨进程串行化写入。
+    std::atomic<uint32_t> wr_lock;
+    std::atomic<uint32_t> wr_lock_waiters;
+
+    // 下一帧的序号，及写指针相对数据区开始位置的偏移量。
+    std::atomic<uint32_t> serial;
+    std::atomic<uint32_t> wr_off;
+    // 正在等待新帧的读者数量。
+    std::atomic<uint32_t> rd_waiters;
+
+    // 读者每次移动读取位置后递增，写者在此等待读者释放。
+    std::atomic<uint32_t> rd_seq;
+    std::atomic<uint32_t> wr_waiters;
+
+    struct shm_slot slots[JGB_SHM_MAX_READERS];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free
+              && std::atomic<uint64_t>::is_always_lock_free,
+              "shm_header requires lock free atomics");
+
+#define JGB_FILE_MAGIC 0x46424a47 // "GJBF"
+#define JGB_FILE_VERSION 1
+
+// 文件模式：文件的开始位置，其后为数据区。
+// 读写位置的高 32 位为帧序号，低 32 位为相对数据区开始位置的偏移量，参考 shm_pos()。
+struct file_header
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t len; // 数据区长度
+    int32_t data_offset; // 数据区相对文件开始位置的偏移量
+
+    // 写指针及下一帧的序号。
+    std::atomic<uint64_t> wr_pos;
+    // 最慢的读者的读取位置，没有读者时与写指针相同。
+    std::atomic<uint64_t> rd_pos;
+};
+
+// 缓冲区的数据区。在线调整大小后，新旧数据区同时存在，直到所有读者都离开旧的数据区。
+struct mem_region
+{
+    uint8_t* start;
+    uint8_t* end;
+    int len;
+    // 使用 mmap 分配的匿名内存的开始位置及长度，长度为 0 表示使用 new 分配。
+    uint8_t* map_start;
+    size_t map_size;
+    bool locked;
+    // 不由 mem_region 释放的内存，例如共享内存。
+    bool borrowed;
+    // 在本数据区写入的第一帧的序号。
+    uint32_t serial;
+    // 迁移后的数据区，在写入迁移帧之前设置。
+    struct mem_region* next;
+};
+
+// 帧索引的条目，按帧序号递增排列。offset 为帧相对当前数据区开始位置的偏移量，len 为帧的总长度。
+struct index_entry
+{
+    uint32_t serial;
+    uint32_t offset;
+    int len;
+    int flags;
+    int64_t timestamp;
+};
+
+// multi_writer_ 模式：写者所申请的缓冲区。
+struct reservation
+{
+    uint8_t* start;
+    // 所申请的长度，包括帧头、载荷、填充。
+    int len;
+    // 提交的帧数（包括填充帧）、载荷字节数。
+    int frames;
+    int bytes;
+    // 已提交，等待之前申请的缓冲区提交后发布。
+    bool done;
+    // 绕回时写入的重定向帧。
+    bool redirect;
+};
+
+// frame_handle 所引用的帧，在 [start, end) 中。
+struct frame_pin
+{
+    buffer* buf;
+    struct mem_region* rgn;
+    uint8_t* start;
+    uint8_t* end;
+    struct frame frm;
+    std::atomic<int> refs;
+    std::list<struct frame_pin*>::iterator it;
+};
+
+// 消费者组中已分发给成员、尚未由组的读者释放的帧。
+struct group_entry
+{
+    uint8_t* hdr;
+    // 从上一个已分发的帧到本帧的步数，包括其间跳过的重定向帧、填充帧。
+    int steps;
+    // 成员已释放。
+    bool done;
+};
+
+// 消费者组：成员共用读者 rd，组内每一帧只分发给一个成员，对写者而言只是一个读者。
+// 从 rd 的读指针开始，已分发的帧依次排列在 entries 中；最早的帧被成员释放后，rd 才释放该帧。
+// 成员可以不按分发的先后释放帧。
+struct reader_group
+{
+    std::string name;
+    reader* rd;
+    int members;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<struct group_entry> entries;
+    // 下一个分发的位置及所在的数据区，steps 为其相对 rd 读指针的步数（rd 的可读帧数不小于 steps）。
+    // steps 由成员在持有 mutex 时修改，等待新帧的成员不持有 mutex 读取。
+    uint8_t* next;
+    struct mem_region* rgn;
+    std::atomic<int> steps;
+    // 最后一个已分发的帧之后跳过的步数。
+    int skipped;
+    // 有成员正在等待 rd 的新帧，其他成员等待 cond。
+    bool waiting;
 };
 
 struct buffer::Impl
@@ -49,12 +249,147 @@ struct buffer::Impl
     boost::shared_mutex rw_mutex;
     boost::mutex owner_mutex;
     boost::condition_variable owner_cond;
+
+    // 读者列表的版本，每次增删读者后递增。写者据此刷新读者列表的快照。
+    std::atomic<uint32_t> readers_gen;
+
+    // lock_free 模式下写者不持有 rw_mutex，增删读者前须暂停写者。
+    std::atomic<bool> pause;
+    boost::mutex pause_mutex;
+    boost::condition_variable pause_cond;
+
+    // 共享内存模式：映射的共享内存，及其长度。
+    std::atomic<struct shm_header*> shm;
+    size_t shm_size;
+    // 由本进程创建的共享内存，在缓冲区销毁时删除。
+    bool shm_owner;
+
+    // 当前的数据区，及仍有读者尚未离开的旧数据区（按迁移的先后排列）。由持有写入权的写者访问。
+    struct mem_region* region;
+    std::list<struct mem_region*> old_regions;
+    // 在线调整大小：写者下一次写入时迁移到的新数据区。
+    std::atomic<struct mem_region*> pending_region;
+    // 缓冲区的内容是新分配的，预先分配物理页时可以改写。
+    bool mem_fresh;
+    // numa_node_ 为 numa_local 时，是否已经由写者线程完成内存的放置。
+    std::atomic<bool> mem_placed;
+
+    // 帧索引：长度为 2 的幂的环形队列，[index_head, index_tail) 为仍保留在缓冲区中的帧。
+    // 由持有写入权的写者在 enter_readers() 与 leave_readers() 之间修改。
+    std::vector<struct index_entry> index;
+    uint32_t index_head;
+    uint32_t index_tail;
+
+    // leaky 模式：当前数据区中最早的有效帧及其帧序号，oldest_serial 等于 buffer::serial_ 时没有有效帧，
+    // oldest 为写指针。由持有写入权的写者在 enter_readers() 与 leave_readers() 之间修改。
+    uint8_t* oldest;
+    uint32_t oldest_serial;
+
+    // writer::event_fd() 创建的 eventfd，-1 表示尚未创建。
+    // wr_efd_armed 为 true 时，读者释放帧后写入 eventfd。
+    std::atomic<int> wr_efd;
+    std::atomic<bool> wr_efd_armed;
+
+    // multi_writer_ 模式：已申请、尚未发布的缓冲区（按申请的先后排列），及读者可见的写指针。
+    // 写者持有写入权时申请，此后写指针 buffer::cur_ 指向下一次申请的位置；按申请的先后发布。
+    boost::mutex mp_mutex;
+    boost::condition_variable mp_cond;
+    std::list<struct reservation> reservations;
+    uint8_t* pub_cur;
+
+    // 被 frame_handle 引用的帧。读者在释放帧之前加入，写者据此跳过这些帧。
+    // pin_count 用于写者在没有被引用的帧时不加锁。
+    boost::mutex pin_mutex;
+    std::list<struct frame_pin*> pins;
+    std::atomic<int> pin_count;
+
+    // 文件模式：映射的文件头。恢复的读取位置及其帧序号，读者加入时从此开始；写者覆盖后为 nullptr。
+    struct file_header* file;
+    uint8_t* recover_cur;
+    uint32_t recover_serial;
+
+    // 消费者组，按名称索引。由 rw_mutex 保护。
+    std::unordered_map<std::string, struct reader_group*> groups;
+
+    // 已移除的写者的统计之和，参考 buffer::writer_stat()。由 rw_mutex 保护。
+    int64_t removed_frames;
+    int64_t removed_bytes;
+
+    Impl()
+        : readers_gen(1),
+        pause(false),
+        shm(nullptr),
+        shm_size(0),
+        shm_owner(false),
+        region(nullptr),
+        pending_region(nullptr),
+        mem_fresh(false),
+        mem_placed(false),
+        index_head(0),
+        index_tail(0),
+        oldest(nullptr),
+        oldest_serial(0),
+        wr_efd(-1),
+        wr_efd_armed(false),
+        pub_cur(nullptr),
+        pin_count(0),
+        file(nullptr),
+        recover_cur(nullptr),
+        recover_serial(0),
+        removed_frames(0L),
+        removed_bytes(0L)
+    {
+    }
+
+    ~Impl()
+    {
+        if(wr_efd >= 0)
+        {
+            close(wr_efd);
+        }
+    }
 };
 
 struct writer::Impl
 {
     // 支持多线程共用一个 writer。
+    // lock_free 模式下不使用，只允许单个线程使用 writer。
     boost::mutex mutex;
+
+    // 读者列表的快照，及其对应的版本。
+    std::vector<reader*> readers;
+    uint32_t readers_gen;
+
+    // lock_free 模式：写者正在访问读者列表的快照。
+    std::atomic<bool> in_op;
+
+    // 批量写入：request_batch() 成功后为 true。
+    bool batch;
+    // 批量写入：已追加的帧数、载荷字节数，及已使用的缓冲区长度（包括帧头、填充）。
+    int batch_frames;
+    int batch_bytes;
+    int batch_used;
+
+    // multi_writer_ 模式：request_buffer() 成功时申请的缓冲区。
+    struct reservation* res;
+
+    // 分块写入：尚未写入最后一块，提交后保留写入权。
+    bool chunk_hold;
+
+    // 压缩模式：压缩前复制载荷。
+    std::vector<uint8_t> lz4_src;
+
+    Impl()
+        : readers_gen(0),
+        in_op(false),
+        batch(false),
+        batch_frames(0),
+        batch_bytes(0),
+        batch_used(0),
+        res(nullptr),
+        chunk_hold(false)
+    {
+    }
 };
 
 struct reader::Impl
@@ -62,598 +397,3433 @@ struct reader::Impl
     boost::mutex mutex;
     boost::condition_variable wr_commit_cond;
     boost::condition_variable rd_release_cond;
-};
 
-buffer::buffer(const std::string& id)
-    : id_(id),
-    len_(0),
-    start_(nullptr),
-    end_(nullptr),
-    ref_(0),
-    serial_(0),
-    owner_(nullptr),
-    pimpl_(new Impl())
-{
-}
+    // 读者正在等待写者提交。写者据此判断是否需要通知读者。
+    std::atomic<bool> rd_waiting;
+    // 写者正在等待读者释放。读者据此判断是否需要通知写者。
+    std::atomic<bool> wr_waiting;
 
-buffer::~buffer()
-{
-    jgb_assert(ref_ == 0);
-    if(start_)
-    {
-        delete[] start_;
-    }
-}
+    // 读者等待期间写者已提交、尚未通知读者的帧数及字节数。由写者访问。
+    int pending_frames;
+    int64_t pending_bytes;
 
-// 如果读者或者写者已经 get() 成功，怎么可以重新分配内存呢？
-int buffer::resize(int len)
-{
-    if(len_ > 0)
-    {
-        jgb_warning("不支持重新调整缓冲区大小");
-        return JGB_ERR_DENIED;
-    }
+    // 当前的自旋等待时长，单位微秒。根据自旋的效果在 [0, reader::spin_] 之间调整，小于 0 表示尚未开始。
+    int spin_budget;
 
-    if(len <= writer::fixed_header_size())
-    {
-        return JGB_ERR_INVALID;
-    }
+    // 已请求、尚未释放的帧数。由读者访问。
+    int held;
 
-    jgb_assert(!start_);
+    // 共享内存模式：读者所占用的槽位，-1 表示尚未分配。
+    int shm_slot;
 
-    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+    // 最近一次请求帧的时间，用于统计读者持有帧的时长。
+    int64_t request_time;
 
-    if(len_ == len)
+    // 读指针所在的数据区。由读者访问；读者尚未初始化时由写者设置。
+    struct mem_region* rgn;
+
+    // discard_keyframe_：已丢弃到最后一个已提交的帧，此后的帧在关键帧之前都要丢弃。
+    // 由写者、读者在持有 mutex 时访问。
+    bool want_keyframe;
+
+    // reader::event_fd() 创建的 eventfd，-1 表示尚未创建。
+    // efd_armed 为 true 时，写者提交帧后写入 eventfd。
+    std::atomic<int> efd;
+    std::atomic<bool> efd_armed;
+
+    // 消费者组的成员：所属的组，及已分发给本成员、尚未释放的帧（按分发的先后排列）。
+    struct reader_group* group;
+    std::deque<struct group_entry*> group_held;
+
+    // read_chunked()：已拼接的块数（0 表示没有未完成的帧）、载荷、帧标志，
+    // 及开始拼接时已丢弃、覆盖的帧数，用于发现其间缺少的块。
+    int chunk_frames;
+    std::vector<uint8_t> chunk_data;
+    int chunk_flags;
+    int64_t chunk_lost;
+
+    // 解压缓冲区，与 request_frames() 获取的帧一一对应。
+    std::vector<std::vector<uint8_t>> lz4_bufs;
+
+    Impl()
+        : rd_waiting(false),
+        wr_waiting(false),
+        pending_frames(0),
+        pending_bytes(0L),
+        spin_budget(-1),
+        held(0),
+        shm_slot(-1),
+        request_time(0L),
+        rgn(nullptr),
+        want_keyframe(false),
+        efd(-1),
+        efd_armed(false),
+        group(nullptr),
+        chunk_frames(0),
+        chunk_flags(0),
+        chunk_lost(0L)
     {
-        return 0; // No change needed
     }
 
-    start_ = new uint8_t[len];
-    end_ = start_ + len;
-    len_ = len;
-
-    cur_ = start_;
+    ~Impl()
+    {
+        if(efd >= 0)
+        {
+            close(efd);
+        }
+    }
+};
 
-    jgb_ok("buf resized. { id = %s, size = %d }", id_.c_str(), len_);
+int64_t frame_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
 
-    return 0; // Success
+latency_histogram::latency_histogram()
+{
+    reset();
 }
 
-reader* buffer::add_reader(bool discard)
+void latency_histogram::reset()
 {
-    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
-    reader* rd = new reader(this, discard);
-    readers_.push_back(rd);
-    return rd;
+    count_ = 0L;
+    sum_ = 0L;
+    max_ = 0L;
+    memset(counts_, 0, sizeof(counts_));
 }
 
-reader* buffer::add_reader(reader* rd)
+int latency_histogram::bucket_index(int64_t ns)
 {
-    if(rd && rd->buf_ == this)
+    if(ns < 16)
     {
-        boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
-        boost::unique_lock<boost::mutex> rd_lock(rd->pimpl_->mutex);
-        reader* new_rd = new reader(this);
-        jgb_assert(new_rd->buf_ == this);
-        new_rd->cur_ = rd->cur_;
-        new_rd->stored_ = rd->stored_;
-        new_rd->serial_ = rd->serial_;
-        readers_.push_back(new_rd);
-        return new_rd;
+        return ns < 0 ? 0 : static_cast<int>(ns);
     }
-    return nullptr;
+    int msb = 63 - __builtin_clzll(ns);
+    int i = 16 + (msb - 4) * 8 + static_cast<int>((ns >> (msb - 3)) & 7);
+    return i < buckets ? i : buckets - 1;
 }
 
-writer* buffer::add_writer()
+int64_t latency_histogram::bucket_low(int i)
 {
-    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
-    writer* wr = new writer(this);
-    writers_.push_back(wr);
-    return wr;
+    if(i < 16)
+    {
+        return i;
+    }
+    int msb = (i - 16) / 8 + 4;
+    return static_cast<int64_t>(8 + (i - 16) % 8) << (msb - 3);
 }
 
-int buffer::remove_reader(reader* r)
+void latency_histogram::record(int64_t ns)
 {
-    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
-    for(auto it = readers_.begin(); it != readers_.end(); ++it)
+    ++ counts_[bucket_index(ns)];
+    ++ count_;
+    sum_ += ns;
+    if(ns > max_)
     {
-        if(*it == r)
-        {
-            jgb_assert((*it)->buf_ == this);
-            delete *it;
-            readers_.erase(it);
-            return 0; // 成功
-        }
+        max_ = ns;
     }
-    return -1; // 读者未找到
 }
 
-int buffer::remove_writer(writer* w)
+int64_t latency_histogram::percentile(double p) const
 {
-    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
-    for(auto it = writers_.begin(); it != writers_.end(); ++it)
+    if(!count_)
     {
-        if(*it == w)
+        return 0L;
+    }
+    int64_t rank = static_cast<int64_t>(p / 100.0 * count_ + 0.5);
+    if(rank < 1)
+    {
+        rank = 1;
+    }
+    int64_t n = 0L;
+    for(int i=0; i<buckets - 1; i++)
+    {
+        n += counts_[i];
+        if(n >= rank)
         {
-            jgb_assert((*it)->buf_ == this);
-            delete *it;
-            writers_.erase(it);
-            return 0;
+            return std::min(bucket_low(i + 1) - 1, max_);
         }
     }
-    return -1; // 写者未找到
+    return max_;
 }
 
-struct buffer_manager::Impl
+static inline void cpu_relax()
 {
-    boost::shared_mutex rw_mutex;
-};
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
 
-buffer_manager* buffer_manager::get_instance()
+// 读者是否需要使用 reader::Impl::mutex。
+// lock_free 模式下，可丢弃的读者仍然使用锁，因为写者可能代替读者释放帧；
+// leaky 模式下写者从不等待、也不代替读者释放帧，可丢弃的读者同样不使用锁。
+// 共享内存模式下，读者的状态保存在共享内存中，不使用锁。
+static inline bool reader_use_lock(reader* rd)
 {
-    static buffer_manager instance;
-    return &instance;
+    return (!rd->buf_->lock_free_ && !rd->buf_->shm_) || (rd->discard_ && !rd->buf_->leaky_);
 }
 
-buffer_manager::buffer_manager()
-    : pimpl_(new Impl())
+static inline struct shm_header* get_shm(buffer* buf)
 {
+    return buf->pimpl_->shm.load(std::memory_order_acquire);
 }
 
-buffer* buffer_manager::add_buffer(const std::string& id)
+// 读者的读指针所在的数据区。
+// 共享内存模式下数据区不会改变，读者可能没有设置 rgn。
+static inline struct mem_region* reader_region(reader* rd)
 {
-    if(id.empty())
+    return rd->pimpl_->rgn ? rd->pimpl_->rgn : rd->buf_->pimpl_->region;
+}
+
+// 重定向帧 hdr 所指示的读者的下一个位置：迁移帧转到新的数据区，填充帧跳过填充，
+// 否则返回到所在数据区的开始位置。
+// hdr 可以是位于 p 的帧头的副本；迁移帧所在的数据区没有新的数据区时（leaky 模式下被覆盖中的帧头）返回 nullptr。
+static inline uint8_t* follow_redirect(const struct frame_header& hdr, uint8_t* p, struct mem_region** rg)
+{
+    if(hdr.flags & JGB_FRAME_PAD)
     {
-        return nullptr;
+        uint8_t* next = p + hdr.total_len();
+        return next + sizeof(struct frame_header) > (*rg)->end ? (*rg)->start : next;
     }
-
-    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
-
-    for(auto& i: buffers_)
+    if(hdr.flags & JGB_FRAME_MIGRATE)
     {
-        if(i->id_ == id)
+        if(!(*rg)->next)
         {
-            ++ i->ref_;
-            return i;
+            return nullptr;
         }
+        *rg = (*rg)->next;
     }
+    return (*rg)->start;
+}
 
-    buffer* buf = new buffer(id);
-    buf->ref_ = 1;
-    buffers_.push_back(buf);
-    return buf;
+static inline uint8_t* follow_redirect(struct frame_header* hdr, struct mem_region** rg)
+{
+    return follow_redirect(*hdr, reinterpret_cast<uint8_t*>(hdr), rg);
 }
 
-int buffer_manager::remove_buffer(buffer* buf)
+// 读者可见的写指针，即下一个提交的帧的位置。
+static inline uint8_t* publish_cur(buffer* buf)
 {
-    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
-    for(auto it = buffers_.begin(); it != buffers_.end(); ++it)
-    {
-        if(*it == buf)
-        {
-            jgb_assert((*it)->id_ == buf->id_);
-            jgb_assert(buf->ref_ > 0);
-            -- buf->ref_;
-            if(buf->ref_ <= 0)
-            {
-                delete buf;
-                buffers_.erase(it);
-            }
-            return 0;
-        }
-    }
-    return -1; // Buffer not found
+    return buf->multi_writer_ ? buf->pimpl_->pub_cur : buf->cur_;
 }
 
-reader::reader(buffer *buf, bool discard)
-    : stat_bytes_read_(0L),
-    stat_frames_read_(0L),
-    stat_bytes_discarded_(0L),
-    stat_frames_discarded_(0L),
-    buf_(buf),
-    cur_(nullptr),
-    stored_(0),
-    serial_(0),
-    holding_(false),
-    discard_(discard),
-    pimpl_(new Impl())
+// 写者所申请的缓冲区的开始位置。
+static inline uint8_t* writer_cur(writer* wr)
 {
+    return wr->pimpl_->res ? wr->pimpl_->res->start : wr->buf_->cur_;
 }
 
-int reader::request_frame_internal(struct frame* frm, int timeout)
+// 多写者模式下是否没有尚未发布的缓冲区。
+static bool reservations_idle(buffer* buf)
 {
-    if(!frm)
+    if(!buf->multi_writer_)
     {
-        return JGB_ERR_INVALID;
+        return true;
     }
+    boost::unique_lock<boost::mutex> mp_lock(buf->pimpl_->mp_mutex);
+    return buf->pimpl_->reservations.empty();
+}
 
-    if(timeout < 0)
+// 当前数据区的 [from, to) 中是否有被句柄引用的帧，有时 end 为其中最早的帧的结束位置。
+static bool find_pin(buffer* buf, uint8_t* from, uint8_t* to, uint8_t** end)
+{
+    buffer::Impl* impl = buf->pimpl_.get();
+    if(!impl->pin_count.load(std::memory_order_acquire))
     {
-        timeout = 0;
+        return false;
     }
 
-    boost::unique_lock<boost::mutex> rd_lock(pimpl_->mutex);
-    if(!stored_)
+    boost::unique_lock<boost::mutex> pin_lock(impl->pin_mutex);
+    struct frame_pin* found = nullptr;
+    for(auto& pin : impl->pins)
     {
-        if(pimpl_->wr_commit_cond.wait_for(rd_lock, boost::chrono::milliseconds(timeout),
-                                            [this](){ return stored_ > 0; }))
+        if(pin->rgn == impl->region && pin->start < to && pin->end > from
+            && (!found || pin->start < found->start))
         {
+            found = pin;
         }
-        else
+    }
+    if(found && end)
+    {
+        *end = found->end;
+    }
+    return found != nullptr;
+}
+
+// 当前数据区中被句柄引用的帧的总长度。
+static int pinned_len(buffer* buf)
+{
+    buffer::Impl* impl = buf->pimpl_.get();
+    boost::unique_lock<boost::mutex> pin_lock(impl->pin_mutex);
+    int len = 0;
+    for(auto& pin : impl->pins)
+    {
+        if(pin->rgn == impl->region)
         {
-            ++ stat_timeout_;
-            jgb_assert(!stored_);
-            return JGB_ERR_TIMEOUT; // 超时
+            len += pin->end - pin->start;
         }
     }
+    return len;
+}
 
-    jgb_assert(cur_);
-    jgb_assert(stored_ > 0);
-
-    struct frame_header* hdr = reinterpret_cast<struct frame_header*>(cur_);
-    //jgb_debug("{ buf %p reader %p cur %p hdr.serial = %d, hdr.len = %d, serial_ = %d, stored_ = %d, read_ %ld }",
-    //          buf_, this, cur_,
-    //          hdr->serial, hdr->len, serial_, stored_, stat_frames_read_);
-    jgb_assert(hdr->serial == serial_);
-    if(!hdr->len)
+// 数据区 rg 中是否有被句柄引用的帧。
+static bool region_pinned(buffer* buf, struct mem_region* rg)
+{
+    buffer::Impl* impl = buf->pimpl_.get();
+    if(!impl->pin_count.load(std::memory_order_acquire))
     {
-        jgb_assert(!hdr->start_offset);
-
-        // 读者需要返回到缓冲区的开始位置。
-        cur_ = buf_->start_;
-
-        -- stored_;
-        ++ serial_;
-
-        // 通知写者，读者已经移动读指针。
-        rd_lock.unlock();
-        pimpl_->rd_release_cond.notify_one();
-
-        ++ stat_frames_read_;
+        return false;
+    }
 
-        return JGB_ERR_RETRY;
+    boost::unique_lock<boost::mutex> pin_lock(impl->pin_mutex);
+    for(auto& pin : impl->pins)
+    {
+        if(pin->rgn == rg)
+        {
+            return true;
+        }
     }
+    return false;
+}
 
-    frm->buf = cur_ + sizeof(struct frame_header) + hdr->start_offset;
-    frm->start_offset = hdr->start_offset;
-    frm->len = hdr->len;
+// 读指针 cur 是否位于写者当前的数据区之外，即读者尚未读完旧的数据区。
+static inline bool in_old_region(buffer* buf, uint8_t* cur)
+{
+    return cur < buf->start_ || cur >= buf->end_;
+}
 
-    holding_ = true;
+static int futex_wait(std::atomic<uint32_t>* addr, uint32_t val, int timeout)
+{
+    struct timespec ts;
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000L;
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT, val, &ts, nullptr, 0);
+}
 
-    return 0; // 成功
+static void futex_wake(std::atomic<uint32_t>* addr, int n)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, n, nullptr, nullptr, 0);
 }
 
-int reader::request_frame(struct frame* frm, int timeout)
+static inline bool pid_alive(int32_t pid)
 {
-    int r;
-    r = request_frame_internal(frm, timeout);
-    if(r == JGB_ERR_RETRY)
-    {
-        r = request_frame_internal(frm, timeout);
-    }
-    return r;
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
 }
 
-void reader::release()
+static inline uint64_t shm_pos(uint32_t serial, uint32_t off)
 {
-    boost::unique_lock<boost::mutex> rd_lock(pimpl_->mutex);
+    return (static_cast<uint64_t>(serial) << 32) | off;
+}
 
-    //jgb_debug("{ stored = %d, serial = %d }", stored_, serial_);
-    if(stored_ > 0)
-    {
-        -- stored_;
-        ++ serial_;
-
-        jgb_assert(cur_);
-        jgb_assert(cur_ + sizeof(struct frame_header) <= buf_->end_);
+// 距离 deadline 的剩余毫秒数。
+static inline int remaining_ms(const boost::chrono::steady_clock::time_point& deadline)
+{
+    boost::chrono::milliseconds ms = boost::chrono::duration_cast<boost::chrono::milliseconds>(
+        deadline - boost::chrono::steady_clock::now());
+    return ms.count() > 0 ? static_cast<int>(ms.count()) : 0;
+}
 
-        struct frame_header* hdr = reinterpret_cast<struct frame_header*>(cur_);
-        if(hdr->len)
+// 共享内存的名称，由缓冲区的标识决定。
+static std::string shm_name(const std::string& id)
+{
+    std::string name = "/jgb." + id;
+    for(size_t i=1; i<name.size(); i++)
+    {
+        if(name[i] == '/')
         {
-            cur_ += hdr->total_len();
-            if(cur_ + sizeof(struct frame_header) > buf_->end_)
-            {
-                //jgb_debug("reader return");
-                cur_ = buf_->start_;
-            }
+            name[i] = '_';
         }
-        else
+    }
+    return name;
+}
+
+// 为读者分配共享内存中的槽位，读取位置为 pos。
+static int shm_claim_slot(struct shm_header* hdr, reader* rd, uint64_t pos = JGB_SHM_POS_NONE)
+{
+    for(int i=0; i<JGB_SHM_MAX_READERS; i++)
+    {
+        struct shm_slot& slot = hdr->slots[i];
+        uint32_t state = shm_slot_free;
+        if(slot.state.compare_exchange_strong(state, shm_slot_claiming))
         {
-            //jgb_debug("reader return");
-            jgb_assert(!hdr->start_offset);
-            cur_ = buf_->start_;
+            slot.pid.store(getpid());
+            slot.pos.store(pos);
+            // 写者只访问 shm_slot_used 状态的槽位。
+            slot.state.store(shm_slot_used);
+            rd->pimpl_->shm_slot = i;
+            return 0;
         }
+    }
+    jgb_warning("共享内存缓冲区的读者数量已达上限。{ buf id = %s, max = %d }",
+                rd->buf_->id().c_str(), JGB_SHM_MAX_READERS);
+    return JGB_ERR_LIMIT;
+}
+
+// 通知写者：读者已经移动读取位置。
+static void shm_notify_writer(struct shm_header* hdr)
+{
+    hdr->rd_seq.fetch_add(1);
+    if(hdr->wr_waiters.load())
+    {
+        futex_wake(&hdr->rd_seq, INT_MAX);
+    }
+}
+
+static void shm_free_slot(struct shm_header* hdr, struct shm_slot& slot)
+{
+    slot.pos.store(JGB_SHM_POS_NONE);
+    slot.pid.store(0);
+    slot.state.store(shm_slot_free);
+    shm_notify_writer(hdr);
+}
 
-        if(holding_)
+// 跨进程的写者锁。持有者异常退出时，其他写者接管。
+static int shm_lock_writer(struct shm_header* hdr, int timeout)
+{
+    uint32_t pid = getpid();
+    boost::chrono::steady_clock::time_point deadline =
+        boost::chrono::steady_clock::now() + boost::chrono::milliseconds(timeout);
+    while(true)
+    {
+        uint32_t owner = 0;
+        if(hdr->wr_lock.compare_exchange_strong(owner, pid))
         {
-            stat_bytes_read_ += hdr->len;
-            ++ stat_frames_read_;
+            return 0;
         }
-        else
+        if(!pid_alive(owner))
         {
-            stat_bytes_discarded_ += hdr->len;
-            ++ stat_frames_discarded_;
+            if(hdr->wr_lock.compare_exchange_strong(owner, pid))
+            {
+                jgb_warning("写者进程已退出，接管共享内存缓冲区。{ pid = %u }", owner);
+                return 0;
+            }
+            continue;
         }
-        holding_ = false;
 
-        // 通知写者，读指针已经移动。
-        rd_lock.unlock();
-        pimpl_->rd_release_cond.notify_one();
+        int ms = remaining_ms(deadline);
+        if(!ms)
+        {
+            return JGB_ERR_TIMEOUT;
+        }
+        hdr->wr_lock_waiters.fetch_add(1);
+        // 定期检查持有者是否仍然存在。
+        futex_wait(&hdr->wr_lock, owner, std::min(ms, 100));
+        hdr->wr_lock_waiters.fetch_sub(1);
     }
 }
 
-writer::writer(buffer* buf)
-    : stat_bytes_written_(0L),
-    stat_frames_written_(0L),
-    stat_cancelled_(0L),
-    stat_timeout_(0L),
-    buf_(buf),
-    requested_len_(0),
-    reserved_len_(0),
-    pimpl_(new Impl())
+static void shm_unlock_writer(struct shm_header* hdr)
 {
-    jgb_assert(buf_);
+    hdr->wr_lock.store(0);
+    if(hdr->wr_lock_waiters.load())
+    {
+        futex_wake(&hdr->wr_lock, 1);
+    }
 }
 
-static int wait_reader_release(writer* wr, boost::unique_lock<boost::mutex>& lock, reader* rd, int timeout)
+// 根据槽位中的读取位置，更新读者的读指针、帧序号及可读帧数。
+static void shm_sync_reader(reader* rd, struct shm_header* hdr)
 {
-    if(rd->discard_ && !rd->holding_)
+    // 先读取帧序号，再读取读取位置：写者先设置读取位置，再发布帧序号。
+    uint32_t serial = hdr->serial.load();
+    uint64_t pos = hdr->slots[rd->pimpl_->shm_slot].pos.load();
+    if(pos == JGB_SHM_POS_NONE)
     {
-        lock.unlock();
-        rd->release();
-        lock.lock();
-        return 0;
+        rd->cur_.store(nullptr, std::memory_order_relaxed);
+        rd->stored_.store(0, std::memory_order_relaxed);
+        return;
     }
+    rd->serial_ = static_cast<uint32_t>(pos >> 32);
+    rd->cur_.store(rd->buf_->start_ + static_cast<uint32_t>(pos), std::memory_order_relaxed);
+    rd->stored_.store(static_cast<int>(serial - rd->serial_), std::memory_order_relaxed);
+}
 
-    if(rd->pimpl_->rd_release_cond.wait_for(lock, boost::chrono::milliseconds(timeout)) == boost::cv_status::no_timeout)
+// 系统的大页长度，读取失败时返回 2MiB。
+static size_t huge_page_size()
+{
+    size_t size = 2 * 1024 * 1024;
+    FILE* fp = fopen("/proc/meminfo", "r");
+    if(fp)
     {
-        return 0; // 成功
+        char line[128];
+        while(fgets(line, sizeof(line), fp))
+        {
+            unsigned long kb;
+            if(sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+            {
+                size = kb * 1024;
+                break;
+            }
+        }
+        fclose(fp);
     }
-    else
+    return size;
+}
+
+// 当前线程所在的 NUMA 节点。
+static int current_numa_node()
+{
+    unsigned cpu;
+    unsigned node;
+    if(syscall(SYS_getcpu, &cpu, &node, nullptr))
     {
-        jgb_debug("wait reader time out. { buf = %s, reader id = %s }",
-                  wr->buf_->id().c_str(),
-                  rd->id_.c_str());
-        ++ wr->stat_timeout_;
-        return JGB_ERR_TIMEOUT; // 超时
+        return -1;
     }
+    return node;
 }
 
-// 等待单个读者移动到适当的位置。
-// 场景1：从写指针到缓冲区末尾的空间足以容纳新帧。
-int writer::wait_reader_scenario_1(reader* rd, int timeout)
+// 按照缓冲区的内存选项放置 [addr, addr + len)：绑定 NUMA 节点、预先分配物理页、锁定内存。
+// 返回是否已锁定内存。
+static bool place_memory(buffer* buf, uint8_t* addr, size_t len, int node)
 {
-    boost::unique_lock<boost::mutex> rd_lock(rd->pimpl_->mutex);
-    uint8_t* next;
-    int r;
-    next = buf_->cur_ + reserved_len_;
-    while(true)
+    bool locked = false;
+    if(node >= 0)
     {
-        if(rd->cur_)
+        unsigned long mask[16] = { 0 };
+        const int bits = sizeof(mask[0]) * 8;
+        int r = -1;
+        if(node < static_cast<int>(sizeof(mask) * 8))
         {
-            if(buf_->cur_ < rd->cur_)
-            {
-                if(next <= rd->cur_)
-                {
-                    return 0;
-                }
-                else
-                {
-                    r = wait_reader_release(this, rd_lock, rd, timeout);
-                    if(r)
-                    {
-                        return r;
-                    }
-                }
-            }
-            else if(buf_->cur_ > rd->cur_)
-            {
-                return 0;
-            }
-            else
+            mask[node / bits] |= 1UL << (node % bits);
+            r = syscall(SYS_mbind, addr, len, MPOL_BIND, mask, sizeof(mask) * 8, MPOL_MF_MOVE);
+        }
+        if(!r)
+        {
+            buf->stat_numa_node_ = node;
+        }
+        else
+        {
+            jgb_warning("绑定 NUMA 节点失败。{ id = %s, node = %d, errno = %d }", buf->id_.c_str(), node, errno);
+        }
+    }
+
+    if(buf->prefault_)
+    {
+        if(madvise(addr, len, MADV_POPULATE_WRITE))
+        {
+            // 内核不支持 MADV_POPULATE_WRITE 时，逐页访问。
+            // 其他进程可能正在写入已连接的共享内存，只能读取。
+            long page = sysconf(_SC_PAGESIZE);
+            volatile uint8_t* p = addr;
+            for(size_t off=0; off<len; off+=page)
             {
-                // 满
-                if(rd->stored_)
+                if(buf->pimpl_->mem_fresh)
                 {
-                    r = wait_reader_release(this, rd_lock, rd, timeout);
-                    if(r)
-                    {
-                        return r;
-                    }
+                    p[off] = 0;
                 }
-                // 空
                 else
                 {
-                    return 0;
+                    (void) p[off];
                 }
             }
         }
+        buf->stat_prefaulted_ = true;
+    }
+
+    if(buf->mlock_)
+    {
+        if(mlock(addr, len))
+        {
+            jgb_warning("锁定内存失败，请检查 RLIMIT_MEMLOCK。{ id = %s, size = %lu, errno = %d }",
+                        buf->id_.c_str(), len, errno);
+        }
         else
         {
-            // 读者尚未完成初始化。
-            return 0;
+            buf->stat_locked_ = true;
+            locked = true;
+        }
+    }
+
+    if(buf->prefault_ || locked)
+    {
+        int actual = -1;
+        if(!syscall(SYS_get_mempolicy, &actual, nullptr, 0, addr, MPOL_F_NODE | MPOL_F_ADDR))
+        {
+            buf->stat_numa_node_ = actual;
         }
     }
+
+    jgb_info("buf memory placed. { id = %s, huge_pages = %d, locked = %d, prefaulted = %d, numa node = %d }",
+             buf->id_.c_str(), buf->stat_huge_pages_, buf->stat_locked_, buf->stat_prefaulted_, buf->stat_numa_node_);
+    return locked;
 }
 
-int writer::wait_readers_scenario_1(int timeout)
+// 缓冲区是否设置了内存选项。
+static inline bool has_memory_options(buffer* buf)
 {
-    int r;
-    for(auto& reader : buf_->readers_)
+    return buf->huge_pages_ != buffer::huge_pages_none
+            || buf->mlock_
+            || buf->prefault_
+            || buf->numa_node_ != buffer::numa_any;
+}
+
+// 放置缓冲区的数据区。numa_node_ 为 numa_local 时，推迟到写者第一次写入时在写者线程中放置。
+static void place_buffer(buffer* buf)
+{
+    if(buf->numa_node_ != buffer::numa_local)
     {
-        r = wait_reader_scenario_1(reader, timeout);
-        if(r)
+        place_memory(buf, buf->start_, buf->len_, buf->numa_node_);
+    }
+}
+
+// 使用 mmap 为数据区 rg 分配长度为 len 的匿名内存，按照 huge_pages_ 使用大页。
+static uint8_t* alloc_memory(buffer* buf, int len, struct mem_region* rg)
+{
+    size_t hsize = huge_page_size();
+    if(buf->huge_pages_ == buffer::huge_pages_explicit)
+    {
+        size_t size = JGB_ALIGN(static_cast<size_t>(len), hsize);
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(p != MAP_FAILED)
         {
-            return r;
+            rg->map_start = static_cast<uint8_t*>(p);
+            rg->map_size = size;
+            buf->stat_huge_pages_ = true;
+            return rg->map_start;
         }
+        jgb_warning("分配显式大页失败，改用透明大页。{ id = %s, size = %lu, errno = %d }",
+                    buf->id_.c_str(), size, errno);
     }
-    return 0;
+
+    if(buf->huge_pages_ == buffer::huge_pages_none)
+    {
+        void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        rg->map_start = static_cast<uint8_t*>(p);
+        rg->map_size = len;
+        return rg->map_start;
+    }
+
+    // 透明大页要求地址按大页对齐，多分配一个大页后裁剪两端。
+    size_t size = JGB_ALIGN(static_cast<size_t>(len), hsize);
+    size_t map_size = size + hsize;
+    void* p = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    uint8_t* start = static_cast<uint8_t*>(p);
+    uint8_t* aligned = reinterpret_cast<uint8_t*>(JGB_ALIGN(reinterpret_cast<uintptr_t>(start), hsize));
+    if(aligned > start)
+    {
+        munmap(start, aligned - start);
+    }
+    if(start + map_size > aligned + size)
+    {
+        munmap(aligned + size, start + map_size - (aligned + size));
+    }
+    rg->map_start = aligned;
+    rg->map_size = size;
+    if(!madvise(aligned, size, MADV_HUGEPAGE))
+    {
+        buf->stat_huge_pages_ = true;
+    }
+    else
+    {
+        jgb_warning("启用透明大页失败。{ id = %s, errno = %d }", buf->id_.c_str(), errno);
+    }
+    return aligned;
 }
 
-int writer::wait_reader_scenario_2(reader* rd, int timeout)
+// 为缓冲区分配长度为 len 的数据区，按照内存选项放置。
+static struct mem_region* alloc_region(buffer* buf, int len)
 {
-    boost::unique_lock<boost::mutex> rd_lock(rd->pimpl_->mutex);
-    uint8_t* next;
-    int r;
-    next = buf_->start_ + reserved_len_;
-    while(true)
+    struct mem_region* rg = new mem_region();
+    if(has_memory_options(buf))
     {
-        if(rd->cur_)
+        buf->stat_huge_pages_ = false;
+        buf->stat_locked_ = false;
+        buf->stat_prefaulted_ = false;
+        rg->start = alloc_memory(buf, len, rg);
+        if(!rg->start)
         {
-            if(buf_->cur_ < rd->cur_)
-            {
-                r = wait_reader_release(this, rd_lock, rd, timeout);
-                if(r)
-                {
-                    return r;
-                }
-            }
-            else if(buf_->cur_ > rd->cur_)
-            {
-                if(next <= rd->cur_)
-                {
-                    return 0;
-                }
-                else
-                {
-                    r = wait_reader_release(this, rd_lock, rd, timeout);
-                    if(r)
-                    {
-                        return r;
-                    }
-                }
-            }
-            else
-            {
-                // 满
-                if(rd->stored_)
-                {
-                    r = wait_reader_release(this, rd_lock, rd, timeout);
-                    if(r)
-                    {
-                        return r;
-                    }
-                }
-                // 空
-                else
-                {
-                    return 0;
-                }
-            }
+            delete rg;
+            return nullptr;
         }
-        else
+        buf->pimpl_->mem_fresh = true;
+        // numa_node_ 为 numa_local 时，推迟到写者第一次写入时在写者线程中放置。
+        if(buf->numa_node_ != buffer::numa_local)
         {
-            // 读者尚未完成初始化。
-            return 0;
+            rg->locked = place_memory(buf, rg->start, len, buf->numa_node_);
         }
     }
+    else
+    {
+        rg->start = new uint8_t[len];
+    }
+    rg->end = rg->start + len;
+    rg->len = len;
+    return rg;
 }
 
-int writer::wait_readers_scenario_2(int timeout)
+// 查找 p 所在的数据区。调用者须排除写者迁移、释放数据区。
+static struct mem_region* find_region(buffer* buf, uint8_t* p)
 {
-    int r;
-    for(auto& reader : buf_->readers_)
+    for(auto& rg : buf->pimpl_->old_regions)
     {
-        r = wait_reader_scenario_2(reader, timeout);
-        if(r)
+        if(p >= rg->start && p < rg->end)
         {
-            return r;
+            return rg;
         }
     }
-    return 0;
+    return buf->pimpl_->region;
 }
 
-int writer::wait_reader_scenario_3(reader* rd, int timeout)
+static void free_region(struct mem_region* rg)
 {
-    boost::unique_lock<boost::mutex> rd_lock(rd->pimpl_->mutex);
-    int r;
-    while(true)
+    if(!rg->borrowed)
     {
-        if(rd->cur_)
+        if(rg->map_size)
         {
-            if(buf_->cur_ < rd->cur_)
-            {
-                r = wait_reader_release(this, rd_lock, rd, timeout);
-                if(r)
-                {
-                    return r;
-                }
-            }
-            else if(buf_->cur_ > rd->cur_)
-            {
-                r = wait_reader_release(this, rd_lock, rd, timeout);
-                if(r)
-                {
-                    return r;
-                }
-            }
-            else
+            if(rg->locked)
             {
-                // 满
-                if(rd->stored_)
-                {
-                    r = wait_reader_release(this, rd_lock, rd, timeout);
-                    if(r)
-                    {
-                        return r;
-                    }
-                }
-                // 空
-                else
-                {
-                    return 0;
-                }
+                munlock(rg->map_start, rg->map_size);
             }
+            munmap(rg->map_start, rg->map_size);
         }
         else
         {
-            // 读者尚未完成初始化。
-            return 0;
+            delete[] rg->start;
         }
     }
+    delete rg;
 }
 
-int writer::wait_readers_scenario_3(int timeout)
+// 映射名称为 shm_name(buf->id_) 的共享内存，调用者须持有 rw_mutex。
+// len 大于 0 时，若共享内存不存在则创建，数据区长度为 len；len 为 0 时只连接已存在的共享内存。
+static int shm_map(buffer* buf, int len)
 {
-    int r;
-    for(auto& reader : buf_->readers_)
+    std::string name = shm_name(buf->id_);
+    size_t hdr_size = JGB_ALIGN(sizeof(struct shm_header), 64);
+    bool created = false;
+    int fd = -1;
+
+    if(len > 0)
     {
-        r = wait_reader_scenario_3(reader, timeout);
-        if(r)
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660);
+        if(fd >= 0)
         {
-            return r;
+            created = true;
+        }
+        else if(errno != EEXIST)
+        {
+            jgb_error("创建共享内存失败。{ name = %s, errno = %d }", name.c_str(), errno);
+            return JGB_ERR_IO;
+        }
+    }
+    if(fd < 0)
+    {
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+        if(fd < 0)
+        {
+            return errno == ENOENT ? JGB_ERR_NOT_FOUND : JGB_ERR_IO;
         }
     }
-    return 0;
-}
 
-int writer::acquire_buffer_ownership(int timeout)
-{
-    boost::unique_lock<boost::mutex> owner_lock(buf_->pimpl_->owner_mutex);
-    if(!buf_->owner_)
+    size_t size;
+    if(created)
     {
-        buf_->owner_ = this;
+        size = hdr_size + len;
+        if(ftruncate(fd, size))
+        {
+            jgb_error("设置共享内存长度失败。{ name = %s, size = %lu, errno = %d }", name.c_str(), size, errno);
+            close(fd);
+            shm_unlink(name.c_str());
+            return JGB_ERR_IO;
+        }
     }
-    else if(buf_->owner_ != this)
+    else
     {
-        if(buf_->pimpl_->owner_cond.wait_for(owner_lock, boost::chrono::milliseconds(timeout),
-                                              [this](){ return buf_->owner_ == nullptr; }))
+        struct stat st;
+        if(fstat(fd, &st) || static_cast<size_t>(st.st_size) <= hdr_size)
         {
-            buf_->owner_ = this;
+            // 创建者尚未完成初始化。
+            close(fd);
+            return JGB_ERR_NOT_FOUND;
         }
-        else
+        size = st.st_size;
+    }
+
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+    {
+        jgb_error("映射共享内存失败。{ name = %s, size = %lu, errno = %d }", name.c_str(), size, errno);
+        if(created)
         {
-            ++ stat_timeout_;
-            return JGB_ERR_TIMEOUT; // 超时
+            shm_unlink(name.c_str());
         }
+        return JGB_ERR_IO;
     }
-    jgb_assert(buf_->owner_ == this);
-    return 0;
-}
 
-bool writer::check_buffer_ownership()
-{
-    boost::unique_lock<boost::mutex> owner_lock(buf_->pimpl_->owner_mutex);
+    struct shm_header* hdr = reinterpret_cast<struct shm_header*>(p);
+    if(created)
+    {
+        // 新建的共享内存内容为 0。
+        hdr->version = JGB_SHM_VERSION;
+        hdr->len = len;
+        hdr->data_offset = hdr_size;
+        for(int i=0; i<JGB_SHM_MAX_READERS; i++)
+        {
+            hdr->slots[i].pos.store(JGB_SHM_POS_NONE);
+        }
+        hdr->magic.store(JGB_SHM_MAGIC);
+    }
+    else if(hdr->magic.load() != JGB_SHM_MAGIC
+             || hdr->version != JGB_SHM_VERSION
+             || hdr->data_offset + static_cast<size_t>(hdr->len) > size)
+    {
+        munmap(p, size);
+        return JGB_ERR_NOT_FOUND;
+    }
+    else if(len > 0 && hdr->len != len)
+    {
+        jgb_warning("共享内存缓冲区的长度与配置不一致。{ id = %s, size = %d, expected = %d }",
+                    buf->id_.c_str(), hdr->len, len);
+    }
+
+    buf->start_ = reinterpret_cast<uint8_t*>(p) + hdr->data_offset;
+    buf->len_ = hdr->len;
+    buf->end_ = buf->start_ + buf->len_;
+    buf->cur_ = buf->start_ + hdr->wr_off.load();
+    buf->serial_ = hdr->serial.load();
+    struct mem_region* rg = new mem_region();
+    rg->start = buf->start_;
+    rg->end = buf->end_;
+    rg->len = buf->len_;
+    rg->borrowed = true;
+    buf->pimpl_->region = rg;
+    buf->pimpl_->shm_size = size;
+    buf->pimpl_->shm_owner = created;
+    buf->pimpl_->mem_fresh = created;
+    buf->pimpl_->shm.store(hdr);
+
+    if(has_memory_options(buf))
+    {
+        if(buf->huge_pages_ != buffer::huge_pages_none && madvise(p, size, MADV_HUGEPAGE))
+        {
+            jgb_warning("共享内存不支持大页。{ id = %s, errno = %d }", buf->id_.c_str(), errno);
+        }
+        else if(buf->huge_pages_ != buffer::huge_pages_none)
+        {
+            buf->stat_huge_pages_ = true;
+        }
+        place_buffer(buf);
+    }
+
+    // 为已添加的读者分配槽位。
+    for(auto& rd : buf->readers_)
+    {
+        shm_claim_slot(hdr, rd);
+    }
+
+    return 0;
+}
+
+// 文件模式：映射文件 buf->file_，数据区长度为 len，调用者须持有 rw_mutex。
+// 文件已存在且长度一致时保留其内容，existing 为 true；否则清空文件。
+static struct mem_region* file_map(buffer* buf, int len, bool* existing)
+{
+    const char* path = buf->file_.c_str();
+    size_t hdr_size = JGB_ALIGN(sizeof(struct file_header), 64);
+    size_t size = hdr_size + len;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+    {
+        jgb_error("打开缓冲区文件失败。{ file = %s, errno = %d }", path, errno);
+        return nullptr;
+    }
+
+    struct stat st;
+    *existing = !fstat(fd, &st) && static_cast<size_t>(st.st_size) == size;
+    if(!*existing && (ftruncate(fd, 0) || ftruncate(fd, size)))
+    {
+        jgb_error("设置缓冲区文件长度失败。{ file = %s, size = %lu, errno = %d }", path, size, errno);
+        close(fd);
+        return nullptr;
+    }
+
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+    {
+        jgb_error("映射缓冲区文件失败。{ file = %s, size = %lu, errno = %d }", path, size, errno);
+        return nullptr;
+    }
+
+    struct file_header* hdr = reinterpret_cast<struct file_header*>(p);
+    if(*existing
+        && (hdr->magic != JGB_FILE_MAGIC
+            || hdr->version != JGB_FILE_VERSION
+            || hdr->len != len
+            || hdr->data_offset != static_cast<int32_t>(hdr_size)))
+    {
+        jgb_warning("缓冲区文件的格式不一致，清空。{ file = %s }", path);
+        *existing = false;
+        memset(p, 0, hdr_size);
+    }
+    if(!*existing)
+    {
+        hdr->version = JGB_FILE_VERSION;
+        hdr->len = len;
+        hdr->data_offset = hdr_size;
+        hdr->wr_pos.store(0);
+        hdr->rd_pos.store(0);
+        hdr->magic = JGB_FILE_MAGIC;
+    }
+
+    struct mem_region* rg = new mem_region();
+    rg->start = reinterpret_cast<uint8_t*>(p) + hdr_size;
+    rg->end = rg->start + len;
+    rg->len = len;
+    rg->map_start = reinterpret_cast<uint8_t*>(p);
+    rg->map_size = size;
+    buf->pimpl_->file = hdr;
+    return rg;
+}
+
+// 文件模式：根据文件头恢复写指针及帧序号；从最慢的读者的读取位置开始逐帧核对帧序号，
+// 直到写指针，全部一致时记录恢复的读取位置。调用者须持有 rw_mutex。
+static void file_recover(buffer* buf)
+{
+    buffer::Impl* impl = buf->pimpl_.get();
+    struct file_header* fh = impl->file;
+    uint64_t wr = fh->wr_pos.load();
+    uint64_t rd = fh->rd_pos.load();
+    uint32_t wr_off = static_cast<uint32_t>(wr);
+    uint32_t rd_off = static_cast<uint32_t>(rd);
+    if(wr_off + sizeof(struct frame_header) > static_cast<uint32_t>(buf->len_)
+        || rd_off + sizeof(struct frame_header) > static_cast<uint32_t>(buf->len_))
+    {
+        jgb_warning("缓冲区文件中的读写位置无效。{ id = %s, file = %s }", buf->id().c_str(), buf->file_.c_str());
+        return;
+    }
+    buf->cur_ = buf->start_ + wr_off;
+    buf->serial_ = static_cast<uint32_t>(wr >> 32);
+
+    uint8_t* p = buf->start_ + rd_off;
+    uint32_t serial = static_cast<uint32_t>(rd >> 32);
+    int frames = 0;
+    while(serial != buf->serial_)
+    {
+        struct frame_header* hdr = reinterpret_cast<struct frame_header*>(p);
+        if(hdr->serial != serial
+            || hdr->len < 0 || hdr->len > buf->len_
+            || hdr->start_offset < 0 || hdr->start_offset > buf->len_
+            || hdr->total_len() > buf->end_ - p
+            || frames > buf->len_ / static_cast<int>(sizeof(struct frame_header)))
+        {
+            jgb_warning("缓冲区文件中未读取的帧校验失败，丢弃。{ id = %s, serial = %u, offset = %ld }",
+                        buf->id().c_str(), serial, p - buf->start_);
+            return;
+        }
+        ++ serial;
+        ++ frames;
+        if(hdr->len || (hdr->flags & JGB_FRAME_PAD))
+        {
+            p += hdr->total_len();
+            if(p + sizeof(struct frame_header) > buf->end_)
+            {
+                p = buf->start_;
+            }
+        }
+        else
+        {
+            p = buf->start_;
+        }
+    }
+    if(p != buf->cur_)
+    {
+        jgb_warning("缓冲区文件中未读取的帧与写指针不一致，丢弃。{ id = %s }", buf->id().c_str());
+        return;
+    }
+
+    if(frames)
+    {
+        impl->recover_cur = buf->start_ + rd_off;
+        impl->recover_serial = static_cast<uint32_t>(rd >> 32);
+    }
+    jgb_notice("buf recovered. { id = %s, file = %s, serial = %u, frames = %d }",
+               buf->id().c_str(), buf->file_.c_str(), buf->serial_, frames);
+}
+
+// 文件模式：尚未初始化的读者从恢复的读取位置开始。调用者须持有 rw_mutex，并且写者已暂停或者没有写者。
+static void recover_reader(buffer* buf, reader* rd)
+{
+    buffer::Impl* impl = buf->pimpl_.get();
+    if(impl->recover_cur && !rd->cur_.load())
+    {
+        rd->serial_ = impl->recover_serial;
+        rd->pimpl_->rgn = impl->region;
+        rd->stored_.store(buf->serial_ - impl->recover_serial);
+        rd->cur_.store(impl->recover_cur);
+    }
+}
+
+// 创建 eventfd，已经创建时返回已有的。
+static int create_event(std::atomic<int>& efd)
+{
+    int fd = efd.load();
+    if(fd >= 0)
+    {
+        return fd;
+    }
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(fd < 0)
+    {
+        jgb_fail("create eventfd. { errno = %d }", errno);
+        return JGB_ERR_FAIL;
+    }
+    int none = -1;
+    if(!efd.compare_exchange_strong(none, fd))
+    {
+        close(fd);
+        return none;
+    }
+    return fd;
+}
+
+// 等待的一方已清空 eventfd 时，写入 eventfd 使其可读；之后不再写入，直到再次清空。
+static inline void signal_event(std::atomic<int>& efd, std::atomic<bool>& armed)
+{
+    if(armed.load() && armed.exchange(false))
+    {
+        uint64_t one = 1;
+        if(write(efd.load(), &one, sizeof(one)) < 0)
+        {
+            jgb_warning("write eventfd. { errno = %d }", errno);
+        }
+    }
+}
+
+// 清空 eventfd，之后对方需要时再写入。
+static inline void rearm_event(std::atomic<int>& efd, std::atomic<bool>& armed)
+{
+    uint64_t val;
+    if(read(efd.load(), &val, sizeof(val)) < 0 && errno != EAGAIN)
+    {
+        jgb_warning("read eventfd. { errno = %d }", errno);
+    }
+    armed.store(true);
+}
+
+// 读者没有可读帧时清空其 eventfd。先清空，再检查可读帧数，避免错过写者的提交。
+static void rearm_reader_event(reader* rd)
+{
+    if(rd->pimpl_->efd.load(std::memory_order_relaxed) < 0)
+    {
+        return;
+    }
+    rearm_event(rd->pimpl_->efd, rd->pimpl_->efd_armed);
+    if(rd->stored_.load() > 0)
+    {
+        signal_event(rd->pimpl_->efd, rd->pimpl_->efd_armed);
+    }
+}
+
+// 通知写者：读者已经移动读指针。
+// 只在写者正在等待该读者时通知。
+static void notify_writer(reader* rd, boost::unique_lock<boost::mutex>& rd_lock)
+{
+    struct shm_header* hdr = get_shm(rd->buf_);
+    if(hdr)
+    {
+        // 读者已在本地更新了读指针、帧序号，将其保存到共享内存。
+        uint32_t off = rd->cur_.load(std::memory_order_relaxed) - rd->buf_->start_;
+        hdr->slots[rd->pimpl_->shm_slot].pos.store(shm_pos(rd->serial_, off));
+        shm_notify_writer(hdr);
+    }
+    else if(rd_lock.owns_lock())
+    {
+        bool waiting = rd->pimpl_->wr_waiting.load(std::memory_order_relaxed);
+        rd_lock.unlock();
+        if(waiting)
+        {
+            rd->pimpl_->rd_release_cond.notify_one();
+        }
+    }
+    else if(rd->pimpl_->wr_waiting.load())
+    {
+        // 加锁以确保写者已经进入等待，或者尚未检查读者的状态。
+        rd_lock.lock();
+        rd_lock.unlock();
+        rd->pimpl_->rd_release_cond.notify_one();
+    }
+
+    // 等待空间的写者在 eventfd 上等待。
+    signal_event(rd->buf_->pimpl_->wr_efd, rd->buf_->pimpl_->wr_efd_armed);
+}
+
+// lock_free 模式：暂停写者访问读者列表，调用者须持有 rw_mutex。
+// 唤醒正在等待读者的写者，写者随即离开读者列表，参考 wait_reader()。
+static void pause_writers(buffer* buf)
+{
+    if(buf->lock_free_)
+    {
+        buf->pimpl_->pause.store(true);
+        for(auto& rd : buf->readers_)
+        {
+            if(rd->pimpl_->wr_waiting.load())
+            {
+                // 加锁以确保写者已经进入等待，或者尚未检查 pause。
+                {
+                    boost::unique_lock<boost::mutex> rd_lock(rd->pimpl_->mutex);
+                }
+                rd->pimpl_->rd_release_cond.notify_all();
+            }
+        }
+        for(auto& wr : buf->writers_)
+        {
+            while(wr->pimpl_->in_op.load())
+            {
+                boost::this_thread::yield();
+            }
+        }
+    }
+}
+
+static void resume_writers(buffer* buf)
+{
+    buf->pimpl_->readers_gen.fetch_add(1);
+    if(buf->lock_free_)
+    {
+        buf->pimpl_->pause.store(false);
+        {
+            boost::unique_lock<boost::mutex> lock(buf->pimpl_->pause_mutex);
+        }
+        buf->pimpl_->pause_cond.notify_all();
+    }
+}
+
+buffer::buffer(const std::string& id)
+    : id_(id),
+    len_(0),
+    start_(nullptr),
+    end_(nullptr),
+    ref_(0),
+    lock_free_(false),
+    shm_(false),
+    leaky_(false),
+    multi_writer_(false),
+    chunk_size_(0),
+    compress_(false),
+    crc_(false),
+    huge_pages_(huge_pages_none),
+    mlock_(false),
+    prefault_(false),
+    numa_node_(numa_any),
+    index_size_(0),
+    stat_huge_pages_(false),
+    stat_locked_(false),
+    stat_prefaulted_(false),
+    stat_numa_node_(-1),
+    serial_(0),
+    owner_(nullptr),
+    cur_(nullptr),
+    pimpl_(new Impl())
+{
+}
+
+buffer::~buffer()
+{
+    jgb_assert(ref_ == 0);
+    if(!pimpl_->pins.empty())
+    {
+        jgb_warning("删除缓冲区时仍有帧被句柄引用。{ id = %s, pins = %lu }", id_.c_str(), pimpl_->pins.size());
+        for(auto& pin : pimpl_->pins)
+        {
+            pin->buf = nullptr;
+        }
+    }
+    struct shm_header* hdr = get_shm(this);
+    if(hdr)
+    {
+        munmap(hdr, pimpl_->shm_size);
+        if(pimpl_->shm_owner)
+        {
+            shm_unlink(shm_name(id_).c_str());
+        }
+    }
+    for(auto& rg : pimpl_->old_regions)
+    {
+        free_region(rg);
+    }
+    if(pimpl_->region)
+    {
+        free_region(pimpl_->region);
+    }
+    struct mem_region* pending = pimpl_->pending_region.load();
+    if(pending)
+    {
+        free_region(pending);
+    }
+}
+
+// 缓冲区已经分配时，在线调整大小：分配新的数据区，写者在下一次写入时于帧边界写入迁移帧，
+// 然后在新的数据区继续写入；读者读完旧数据区中的帧后，随迁移帧转到新的数据区。
+// 所有读者都离开旧的数据区后，由写者释放旧的数据区。写者和读者都不需要停止。
+int buffer::resize(int len)
+{
+    if(shm_ && get_shm(this))
+    {
+        // 读者已经连接了其他进程创建的共享内存。
+        return 0;
+    }
+
+    if(len <= writer::fixed_header_size())
+    {
+        return JGB_ERR_INVALID;
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+
+    if(len_ > 0)
+    {
+        if(shm_ || pimpl_->file)
+        {
+            // 其他进程仍然映射着原来的共享内存；文件的长度由配置决定。
+            jgb_warning("共享内存、文件模式不支持重新调整缓冲区大小。{ id = %s }", id_.c_str());
+            return JGB_ERR_NOT_SUPPORT;
+        }
+
+        // 与当前长度相同时，取消尚未完成的调整。
+        struct mem_region* rg = nullptr;
+        if(len != len_)
+        {
+            rg = alloc_region(this, len);
+            if(!rg)
+            {
+                jgb_fail("allocate buffer. { id = %s, size = %d, errno = %d }", id_.c_str(), len, errno);
+                return JGB_ERR_FAIL;
+            }
+        }
+        // 写者尚未迁移到的新数据区不会被访问，可以直接替换。
+        struct mem_region* prev = pimpl_->pending_region.exchange(rg);
+        if(prev)
+        {
+            free_region(prev);
+        }
+        if(rg)
+        {
+            jgb_ok("buf resize pending. { id = %s, size = %d, new size = %d }", id_.c_str(), len_, len);
+        }
+        return 0;
+    }
+
+    jgb_assert(!start_);
+
+    if(multi_writer_)
+    {
+        if(lock_free_ || shm_ || leaky_)
+        {
+            jgb_warning("多写者模式不能与 lock_free、shm、leaky 模式同时使用。{ id = %s }", id_.c_str());
+        }
+        lock_free_ = false;
+        shm_ = false;
+        leaky_ = false;
+    }
+
+#ifndef JGB_HAVE_LZ4
+    if(compress_)
+    {
+        jgb_warning("编译时没有 LZ4 库，不支持压缩模式。{ id = %s }", id_.c_str());
+        compress_ = false;
+    }
+#endif
+
+    if(chunk_size_ > 0 && (shm_ || multi_writer_))
+    {
+        jgb_warning("分块帧不能与 shm、多写者模式同时使用。{ id = %s }", id_.c_str());
+        chunk_size_ = 0;
+    }
+    if(chunk_size_ > 0 && writer::frame_size(chunk_size_) > len)
+    {
+        jgb_warning("分块大小超过缓冲区容量。{ id = %s, size = %d, chunk size = %d }", id_.c_str(), len, chunk_size_);
+        chunk_size_ = 0;
+    }
+
+    if(!file_.empty() && (shm_ || multi_writer_))
+    {
+        jgb_warning("文件模式不能与 shm、多写者模式同时使用。{ id = %s }", id_.c_str());
+        file_.clear();
+    }
+
+    if(lock_free_ && writers_.size() > 1)
+    {
+        jgb_warning("lock_free 模式只允许一个写者。{ id = %s, writers = %lu }", id_.c_str(), writers_.size());
+        lock_free_ = false;
+    }
+
+    // 加锁模式下写者提交时须获取各读者的锁，持有锁的读者仍会阻塞写者。
+    if(leaky_ && !lock_free_ && !shm_)
+    {
+        jgb_warning("leaky 模式须与 lock_free 模式同时使用。{ id = %s }", id_.c_str());
+        return JGB_ERR_NOT_SUPPORT;
+    }
+
+    if(shm_)
+    {
+        if(lock_free_)
+        {
+            // 共享内存模式本身不在读写路径上使用锁。
+            lock_free_ = false;
+        }
+        if(leaky_)
+        {
+            jgb_warning("共享内存模式不支持 leaky 模式。{ id = %s }", id_.c_str());
+            leaky_ = false;
+        }
+        int r = shm_map(this, len);
+        if(r)
+        {
+            jgb_fail("map shared memory buffer. { id = %s, size = %d, r = %d }", id_.c_str(), len, r);
+            return r;
+        }
+        jgb_ok("buf resized. { id = %s, size = %d, shm = %s }", id_.c_str(), len_, shm_name(id_).c_str());
+        return 0;
+    }
+
+    bool existing = false;
+    struct mem_region* rg = file_.empty() ? alloc_region(this, len) : file_map(this, len, &existing);
+    if(!rg)
+    {
+        jgb_fail("allocate buffer. { id = %s, size = %d, errno = %d }", id_.c_str(), len, errno);
+        return JGB_ERR_FAIL;
+    }
+    pimpl_->region = rg;
+    start_ = rg->start;
+    end_ = rg->end;
+    len_ = len;
+
+    if(index_size_ > 0)
+    {
+        size_t n = 1;
+        while(n < static_cast<size_t>(index_size_))
+        {
+            n <<= 1;
+        }
+        pimpl_->index.resize(n);
+    }
+
+    cur_ = start_;
+    pimpl_->pub_cur = start_;
+    pimpl_->oldest = start_;
+    pimpl_->oldest_serial = serial_;
+
+    if(existing)
+    {
+        file_recover(this);
+        pimpl_->oldest = pimpl_->recover_cur ? pimpl_->recover_cur : cur_;
+        pimpl_->oldest_serial = pimpl_->recover_cur ? pimpl_->recover_serial : serial_;
+        for(auto& rd : readers_)
+        {
+            recover_reader(this, rd);
+        }
+    }
+
+    jgb_ok("buf resized. { id = %s, size = %d, lock_free = %d, leaky = %d, multi_writer = %d }",
+           id_.c_str(), len_, lock_free_, leaky_, multi_writer_);
+
+    return 0; // Success
+}
+
+int buffer::attach()
+{
+    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+    if(get_shm(this))
+    {
+        return 0;
+    }
+    if(len_ > 0)
+    {
+        jgb_warning("缓冲区已经分配。{ id = %s }", id_.c_str());
+        return JGB_ERR_DENIED;
+    }
+
+    shm_ = true;
+    lock_free_ = false;
+    int r = shm_map(this, 0);
+    if(!r)
+    {
+        jgb_ok("buf attached. { id = %s, size = %d, shm = %s }", id_.c_str(), len_, shm_name(id_).c_str());
+    }
+    return r;
+}
+
+// 在读者加入 readers_ 之前设置读者的初始设置。
+static void apply_reader_options(buffer* buf, reader* rd, const reader_options& opt)
+{
+    rd->discard_ = opt.discard;
+    if(opt.discard && buf->shm_)
+    {
+        jgb_warning("共享内存模式不支持可丢弃的读者。{ id = %s }", buf->id_.c_str());
+        rd->discard_ = false;
+    }
+    rd->discard_keyframe_ = opt.discard_keyframe;
+    rd->notify_frames_ = opt.notify_frames < 1 ? 1 : opt.notify_frames;
+    rd->notify_bytes_ = opt.notify_bytes;
+    rd->notify_latency_ = opt.notify_latency;
+    rd->spin_ = opt.spin;
+    rd->stat_latency_ = opt.stat_latency;
+}
+
+reader* buffer::add_reader(bool discard)
+{
+    reader_options opt;
+    opt.discard = discard;
+    return add_reader(opt);
+}
+
+reader* buffer::add_reader(const reader_options& opt)
+{
+    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+    reader* rd = new reader(this);
+    apply_reader_options(this, rd, opt);
+    struct shm_header* hdr = get_shm(this);
+    if(hdr)
+    {
+        shm_claim_slot(hdr, rd);
+    }
+    pause_writers(this);
+    recover_reader(this, rd);
+    readers_.push_back(rd);
+    resume_writers(this);
+    return rd;
+}
+
+reader* buffer::add_reader(reader* rd, const reader_options& opt)
+{
+    if(rd && rd->buf_ == this)
+    {
+        struct shm_header* hdr = get_shm(this);
+        if(hdr)
+        {
+            // 持有写者锁期间，没有写者会覆盖 rd 尚未读取的帧，新读者可以从 rd 的读取位置开始。
+            // 在获取 rw_mutex 之前获取写者锁，与写者的加锁顺序一致。
+            if(shm_lock_writer(hdr, 1000))
+            {
+                jgb_warning("获取共享内存缓冲区的写者锁超时。{ id = %s }", id_.c_str());
+                return nullptr;
+            }
+            reader* new_rd = new reader(this);
+            apply_reader_options(this, new_rd, opt);
+            uint64_t pos = JGB_SHM_POS_NONE;
+            if(rd->pimpl_->shm_slot >= 0)
+            {
+                pos = hdr->slots[rd->pimpl_->shm_slot].pos.load();
+            }
+            shm_claim_slot(hdr, new_rd, pos);
+            shm_unlock_writer(hdr);
+
+            boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+            readers_.push_back(new_rd);
+            return new_rd;
+        }
+
+        boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+        reader* new_rd = new reader(this);
+        apply_reader_options(this, new_rd, opt);
+        jgb_assert(new_rd->buf_ == this);
+        if(!lock_free_)
+        {
+            boost::unique_lock<boost::mutex> rd_lock(rd->pimpl_->mutex);
+            new_rd->cur_.store(rd->cur_.load());
+            new_rd->stored_.store(rd->stored_.load());
+            new_rd->serial_ = rd->serial_;
+            new_rd->pimpl_->rgn = rd->pimpl_->rgn;
+            readers_.push_back(new_rd);
+            resume_writers(this);
+        }
+        else
+        {
+            // rd 可能正在无锁地移动读指针，无法一次读取一致的状态。
+            // 暂停写者后，从 rd 的读指针到写指针之间的帧保持不变，可根据帧序列号计算可读帧数。
+            pause_writers(this);
+            uint8_t* cur;
+            int stored;
+            do
+            {
+                cur = rd->cur_.load();
+                stored = rd->stored_.load();
+            } while(cur != rd->cur_.load());
+            if(cur)
+            {
+                if(cur == cur_ && !stored)
+                {
+                    new_rd->serial_ = serial_;
+                }
+                else
+                {
+                    struct frame_header* hdr = reinterpret_cast<struct frame_header*>(cur);
+                    new_rd->serial_ = hdr->serial;
+                    new_rd->stored_.store(serial_ - hdr->serial);
+                }
+                new_rd->pimpl_->rgn = find_region(this, cur);
+                new_rd->cur_.store(cur);
+            }
+            readers_.push_back(new_rd);
+            resume_writers(this);
+        }
+        return new_rd;
+    }
+    return nullptr;
+}
+
+// 消费者组的成员 rd 释放所持有的最早的 n 帧，组的读者依次释放已被成员释放的最早的帧。
+static void group_release(reader* rd, int n)
+{
+    struct reader_group* grp = rd->pimpl_->group;
+    std::deque<struct group_entry*>& held = rd->pimpl_->group_held;
+    boost::unique_lock<boost::mutex> grp_lock(grp->mutex);
+    int64_t hold = (rd->stat_latency_ && !held.empty()) ? frame_clock() - rd->pimpl_->request_time : 0L;
+    while(n > 0 && !held.empty())
+    {
+        struct group_entry* e = held.front();
+        e->done = true;
+        rd->stat_bytes_read_ += reinterpret_cast<struct frame_header*>(e->hdr)->len;
+        ++ rd->stat_frames_read_;
+        if(rd->stat_latency_)
+        {
+            rd->stat_hold_latency_.record(hold);
+        }
+        held.pop_front();
+        -- n;
+    }
+    rd->pimpl_->held = held.size();
+    rd->holding_ = !held.empty();
+
+    int frames = 0;
+    int steps = 0;
+    while(!grp->entries.empty() && grp->entries.front().done)
+    {
+        steps += grp->entries.front().steps;
+        ++ frames;
+        grp->entries.pop_front();
+    }
+    if(frames)
+    {
+        // 跳过其间的重定向帧、填充帧，共 steps 步。
+        reader* grd = grp->rd;
+        grd->pimpl_->held = frames;
+        grd->holding_ = true;
+        grd->release(frames);
+        grp->steps.fetch_sub(steps);
+    }
+}
+
+reader* buffer::add_group_reader(const std::string& group)
+{
+    if(group.empty())
+    {
+        return nullptr;
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+    if(shm_ || leaky_)
+    {
+        jgb_warning("共享内存、leaky 模式不支持消费者组。{ id = %s, group = %s }", id_.c_str(), group.c_str());
+        return nullptr;
+    }
+
+    struct reader_group*& grp = pimpl_->groups[group];
+    if(!grp)
+    {
+        grp = new reader_group;
+        grp->name = group;
+        grp->rd = new reader(this);
+        grp->rd->id_ = id_ + "@" + group;
+        grp->rd->stat_latency_ = false;
+        grp->members = 0;
+        grp->next = nullptr;
+        grp->rgn = nullptr;
+        grp->steps.store(0);
+        grp->skipped = 0;
+        grp->waiting = false;
+        pause_writers(this);
+        recover_reader(this, grp->rd);
+        readers_.push_back(grp->rd);
+        resume_writers(this);
+        jgb_info("reader group created. { buf = %s, group = %s }", id_.c_str(), group.c_str());
+    }
+
+    reader* rd = new reader(this);
+    rd->pimpl_->group = grp;
+    ++ grp->members;
+    return rd;
+}
+
+writer* buffer::add_writer()
+{
+    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+    if(lock_free_ && !writers_.empty())
+    {
+        jgb_warning("lock_free 模式只允许一个写者。{ id = %s }", id_.c_str());
+        return nullptr;
+    }
+    writer* wr = new writer(this);
+    writers_.push_back(wr);
+    return wr;
+}
+
+int buffer::remove_reader(reader* r)
+{
+    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+    struct reader_group* grp = r ? r->pimpl_->group : nullptr;
+    if(grp)
+    {
+        jgb_assert(r->buf_ == this);
+        // 成员尚未释放的帧视为已释放。
+        group_release(r, INT_MAX);
+        delete r;
+        if(-- grp->members)
+        {
+            return 0;
+        }
+
+        pause_writers(this);
+        readers_.remove(grp->rd);
+        resume_writers(this);
+        pimpl_->groups.erase(grp->name);
+        delete grp->rd;
+        delete grp;
+        return 0;
+    }
+
+    for(auto it = readers_.begin(); it != readers_.end(); ++it)
+    {
+        if(*it == r)
+        {
+            jgb_assert((*it)->buf_ == this);
+            pause_writers(this);
+            readers_.erase(it);
+            resume_writers(this);
+            struct shm_header* hdr = get_shm(this);
+            if(hdr && r->pimpl_->shm_slot >= 0)
+            {
+                shm_free_slot(hdr, hdr->slots[r->pimpl_->shm_slot]);
+            }
+            delete r;
+            return 0; // 成功
+        }
+    }
+    return -1; // 读者未找到
+}
+
+int buffer::remove_writer(writer* w)
+{
+    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+    for(auto it = writers_.begin(); it != writers_.end(); ++it)
+    {
+        if(*it == w)
+        {
+            jgb_assert((*it)->buf_ == this);
+            pimpl_->removed_frames += (*it)->stat_frames_written_;
+            pimpl_->removed_bytes += (*it)->stat_bytes_written_;
+            delete *it;
+            writers_.erase(it);
+            return 0;
+        }
+    }
+    return -1; // 写者未找到
+}
+
+reader* buffer::first_reader()
+{
+    boost::shared_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+    for(auto rd: readers_)
+    {
+        bool internal = false;
+        for(auto& it: pimpl_->groups)
+        {
+            if(it.second->rd == rd)
+            {
+                internal = true;
+                break;
+            }
+        }
+        if(!internal)
+        {
+            return rd;
+        }
+    }
+    return nullptr;
+}
+
+void buffer::writer_stat(int64_t* frames, int64_t* bytes)
+{
+    boost::shared_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+    int64_t f = pimpl_->removed_frames;
+    int64_t b = pimpl_->removed_bytes;
+    for(auto wr: writers_)
+    {
+        f += wr->stat_frames_written_;
+        b += wr->stat_bytes_written_;
+    }
+    if(frames)
+    {
+        *frames = f;
+    }
+    if(bytes)
+    {
+        *bytes = b;
+    }
+}
+
+struct buffer_manager::Impl
+{
+    boost::shared_mutex rw_mutex;
+    // 按 id 索引 buffers_，list 的迭代器在增删其他元素时保持有效。
+    std::unordered_map<std::string, std::list<buffer*>::iterator> index;
+};
+
+buffer_manager* buffer_manager::get_instance()
+{
+    static buffer_manager instance;
+    return &instance;
+}
+
+buffer_manager::buffer_manager()
+    : pimpl_(new Impl())
+{
+}
+
+buffer* buffer_manager::add_buffer(const std::string& id)
+{
+    if(id.empty())
+    {
+        return nullptr;
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+
+    auto it = pimpl_->index.find(id);
+    if(it != pimpl_->index.end())
+    {
+        buffer* buf = *it->second;
+        ++ buf->ref_;
+        return buf;
+    }
+
+    buffer* buf = new buffer(id);
+    buf->ref_ = 1;
+    buffers_.push_back(buf);
+    pimpl_->index.emplace(id, std::prev(buffers_.end()));
+    return buf;
+}
+
+buffer* buffer_manager::find_buffer(const std::string& id)
+{
+    boost::shared_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+    auto it = pimpl_->index.find(id);
+    return it != pimpl_->index.end() ? *it->second : nullptr;
+}
+
+int buffer_manager::remove_buffer(buffer* buf)
+{
+    if(!buf)
+    {
+        return -1;
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(pimpl_->rw_mutex);
+    auto it = pimpl_->index.find(buf->id_);
+    if(it == pimpl_->index.end() || *it->second != buf)
+    {
+        return -1; // Buffer not found
+    }
+
+    jgb_assert(buf->ref_ > 0);
+    -- buf->ref_;
+    if(buf->ref_ <= 0)
+    {
+        buffers_.erase(it->second);
+        pimpl_->index.erase(it);
+        delete buf;
+    }
+    return 0;
+}
+
+reader::reader(buffer *buf, bool discard)
+    : keep_compressed_(false),
+    stat_bytes_read_(0L),
+    stat_frames_read_(0L),
+    stat_timeout_(0L),
+    stat_bytes_discarded_(0L),
+    stat_frames_discarded_(0L),
+    stat_frames_lost_(0L),
+    stat_chunks_dropped_(0L),
+    stat_crc_errors_(0L),
+    stat_latency_(true),
+    buf_(buf),
+    cur_(nullptr),
+    stored_(0),
+    serial_(0),
+    holding_(false),
+    discard_(discard),
+    discard_keyframe_(false),
+    notify_frames_(1),
+    notify_bytes_(0),
+    notify_latency_(0),
+    spin_(0),
+    pimpl_(new Impl())
+{
+}
+
+// 自旋等待写者提交，成功返回 true。
+// 自旋成功则恢复到最长的自旋时长；自旋失败则缩短下一次的自旋时长，由 wait_commit() 根据实际等待时长再延长。
+static bool spin_commit(reader* rd)
+{
+    int budget = rd->pimpl_->spin_budget;
+    if(budget < 0)
+    {
+        budget = rd->spin_;
+    }
+    if(budget <= 0)
+    {
+        return false;
+    }
+
+    boost::chrono::steady_clock::time_point deadline =
+        boost::chrono::steady_clock::now() + boost::chrono::microseconds(budget);
+    while(true)
+    {
+        for(int i=0; i<64; i++)
+        {
+            if(rd->stored_.load(std::memory_order_acquire))
+            {
+                rd->pimpl_->spin_budget = rd->spin_;
+                return true;
+            }
+            cpu_relax();
+        }
+        if(boost::chrono::steady_clock::now() >= deadline)
+        {
+            break;
+        }
+    }
+
+    rd->pimpl_->spin_budget = budget / 2;
+    return false;
+}
+
+// 挂起等待写者提交，直到 ready() 返回 true，调用者须持有 reader::Impl::mutex。
+// 写者按照通知策略合并通知，设置了 notify_latency_ 时，读者最迟每隔 notify_latency_ 毫秒自行检查一次。
+template<typename F>
+static bool wait_commit(reader* rd, boost::unique_lock<boost::mutex>& rd_lock, int timeout, F ready)
+{
+    boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+    boost::chrono::steady_clock::time_point deadline = start + boost::chrono::milliseconds(timeout);
+
+    rd->pimpl_->rd_waiting.store(true);
+    while(!ready())
+    {
+        boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+        if(now >= deadline)
+        {
+            break;
+        }
+        boost::chrono::steady_clock::time_point until = deadline;
+        if(rd->notify_latency_ > 0 && now + boost::chrono::milliseconds(rd->notify_latency_) < deadline)
+        {
+            until = now + boost::chrono::milliseconds(rd->notify_latency_);
+        }
+        rd->pimpl_->wr_commit_cond.wait_until(rd_lock, until);
+    }
+    rd->pimpl_->rd_waiting.store(false, std::memory_order_relaxed);
+
+    if(rd->spin_ > 0)
+    {
+        // 挂起后很快就等到了新帧，说明自旋有可能成功。
+        boost::chrono::microseconds waited =
+            boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - start);
+        if(waited.count() < rd->spin_)
+        {
+            rd->pimpl_->spin_budget = std::min(rd->spin_, std::max(rd->pimpl_->spin_budget * 2, 1));
+        }
+    }
+
+    return ready();
+}
+
+// 共享内存模式：等待至少有一帧可读。
+static int shm_wait_frames(reader* rd, int timeout)
+{
+    buffer* buf = rd->buf_;
+    struct shm_header* hdr = get_shm(buf);
+    if(!hdr)
+    {
+        // 创建共享内存的进程可能尚未启动。
+        if(buf->attach())
+        {
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(std::min(timeout, 100)));
+            ++ rd->stat_timeout_;
+            return JGB_ERR_TIMEOUT;
+        }
+        hdr = get_shm(buf);
+    }
+    if(rd->pimpl_->shm_slot < 0)
+    {
+        int r = shm_claim_slot(hdr, rd);
+        if(r)
+        {
+            return r;
+        }
+    }
+
+    boost::chrono::steady_clock::time_point deadline =
+        boost::chrono::steady_clock::now() + boost::chrono::milliseconds(timeout);
+    while(true)
+    {
+        uint32_t serial = hdr->serial.load();
+        shm_sync_reader(rd, hdr);
+        if(rd->stored_.load(std::memory_order_relaxed) > 0)
+        {
+            return 0;
+        }
+
+        int ms = remaining_ms(deadline);
+        if(!ms)
+        {
+            ++ rd->stat_timeout_;
+            return JGB_ERR_TIMEOUT; // 超时
+        }
+        // 先登记等待，再检查帧序号：写者先发布帧序号，再检查是否有读者在等待。
+        hdr->rd_waiters.fetch_add(1);
+        if(hdr->serial.load() == serial)
+        {
+            futex_wait(&hdr->serial, serial, ms);
+        }
+        hdr->rd_waiters.fetch_sub(1);
+    }
+}
+
+// 等待至少有一帧可读。
+// 读者需要加锁时，返回时仍持有锁；否则返回时不持有锁。
+static int wait_frames(reader* rd, boost::unique_lock<boost::mutex>& rd_lock, int timeout)
+{
+    if(timeout < 0)
+    {
+        timeout = 0;
+    }
+
+    if(rd->buf_->shm_)
+    {
+        return shm_wait_frames(rd, timeout);
+    }
+
+    // 在加锁之前自旋，避免自旋期间阻塞写者。
+    if(rd->spin_ > 0 && !rd->stored_.load(std::memory_order_acquire))
+    {
+        spin_commit(rd);
+    }
+
+    if(reader_use_lock(rd))
+    {
+        rd_lock.lock();
+    }
+    if(!rd->stored_.load(std::memory_order_acquire))
+    {
+        if(!rd_lock.owns_lock())
+        {
+            rd_lock.lock();
+        }
+        if(!wait_commit(rd, rd_lock, timeout, [rd](){ return rd->stored_.load() > 0; }))
+        {
+            ++ rd->stat_timeout_;
+            rearm_reader_event(rd);
+            jgb_assert(!rd->stored_);
+            return JGB_ERR_TIMEOUT; // 超时
+        }
+        if(!reader_use_lock(rd))
+        {
+            rd_lock.unlock();
+        }
+    }
+
+    jgb_assert(rd->cur_);
+    jgb_assert(rd->stored_ > 0);
+    return 0;
+}
+
+// leaky 模式：帧 p 的帧序号。写者可能同时修改，在读取帧的其他内容之后读取时，先使用 acquire 栅栏。
+static inline uint32_t frame_serial(uint8_t* p)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return __atomic_load_n(reinterpret_cast<uint32_t*>(p), __ATOMIC_RELAXED);
+}
+
+// leaky 模式：读指针处的帧是否已被写者覆盖。旧数据区中的帧在迁移之后不会再被覆盖，
+// 但可能在迁移之前已被覆盖，所以同样检查帧序号。
+static inline bool frame_lapped(reader* rd)
+{
+    uint8_t* cur = rd->cur_.load(std::memory_order_relaxed);
+    return cur && frame_serial(cur) != rd->serial_;
+}
+
+// leaky 模式：读指针处的帧已被覆盖时，转到最早的有效帧，返回 true。
+static bool resync_lapped(reader* rd, boost::unique_lock<boost::mutex>& rd_lock)
+{
+    buffer* buf = rd->buf_;
+    if(!buf->leaky_ || !frame_lapped(rd))
+    {
+        return false;
+    }
+    if(rd_lock.owns_lock())
+    {
+        rd_lock.unlock();
+    }
+
+    // 与 reader::seek() 相同，排除写者修改 oldest。
+    boost::unique_lock<boost::shared_mutex> lock(buf->pimpl_->rw_mutex);
+    pause_writers(buf);
+    rd_lock.lock();
+    if(frame_lapped(rd))
+    {
+        buffer::Impl* impl = buf->pimpl_.get();
+        rd->stat_frames_lost_ += static_cast<uint32_t>(impl->oldest_serial - rd->serial_);
+        rd->pimpl_->rgn = impl->region;
+        rd->pimpl_->held = 0;
+        rd->holding_ = false;
+        rd->serial_ = impl->oldest_serial;
+        rd->stored_.store(static_cast<int>(buf->serial_ - impl->oldest_serial));
+        rd->cur_.store(impl->oldest);
+    }
+    rd_lock.unlock();
+    resume_writers(buf);
+    return true;
+}
+
+// leaky 模式：复制 p 处帧序号为 serial 的帧头。复制之后帧序号未变时副本完好，之后只访问副本。
+// 帧已被覆盖，或者副本超出所在的数据区 rg 时返回 false。
+static inline bool copy_header(uint8_t* p, uint32_t serial, struct mem_region* rg, struct frame_header* copy)
+{
+    memcpy(copy, p, sizeof(*copy));
+    return frame_serial(p) == serial
+        && copy->len >= 0
+        && copy->start_offset >= 0
+        && copy->total_len() <= rg->end - p;
+}
+
+// 读指针处是重定向帧时，读者返回到缓冲区的开始位置，返回 true。
+static bool skip_redirect(reader* rd, boost::unique_lock<boost::mutex>& rd_lock)
+{
+    uint8_t* p = rd->cur_.load(std::memory_order_relaxed);
+    struct mem_region* rg = reader_region(rd);
+    struct frame_header hdr;
+    uint8_t* cur;
+    if(rd->buf_->leaky_)
+    {
+        // 帧头可能同时被覆盖：只使用完好的副本，否则转到最早的有效帧。
+        if(!copy_header(p, rd->serial_, rg, &hdr))
+        {
+            resync_lapped(rd, rd_lock);
+            return true;
+        }
+        if(hdr.len)
+        {
+            return false;
+        }
+        cur = follow_redirect(hdr, p, &rg);
+        if(!cur || frame_lapped(rd))
+        {
+            resync_lapped(rd, rd_lock);
+            return true;
+        }
+    }
+    else
+    {
+        memcpy(&hdr, p, sizeof(hdr));
+        jgb_assert(hdr.serial == rd->serial_);
+        if(hdr.len)
+        {
+            return false;
+        }
+        jgb_assert((hdr.flags & JGB_FRAME_PAD) || !hdr.start_offset);
+        // 读者需要返回到缓冲区的开始位置，或者转到新的数据区。
+        cur = follow_redirect(hdr, p, &rg);
+    }
+
+    rd->pimpl_->rgn = rg;
+    rd->cur_.store(cur, std::memory_order_release);
+
+    ++ rd->serial_;
+    ++ rd->stat_frames_read_;
+    -- rd->stored_;
+
+    // 通知写者，读者已经移动读指针。
+    notify_writer(rd, rd_lock);
+
+    return true;
+}
+
+// hdr 可以是位于 p 的帧头的副本。
+static void fill_frame(struct frame* frm, const struct frame_header& hdr, uint8_t* p)
+{
+    frm->buf = p + sizeof(struct frame_header) + hdr.start_offset;
+    frm->start_offset = hdr.start_offset;
+    frm->len = hdr.len;
+    frm->timestamp = hdr.timestamp;
+    frm->flags = hdr.flags & JGB_FRAME_USER_FLAGS;
+}
+
+static void fill_frame(struct frame* frm, struct frame_header* hdr)
+{
+    fill_frame(frm, *hdr, reinterpret_cast<uint8_t*>(hdr));
+}
+
+// 从读指针开始，读者在下一个关键帧之前的帧数（包括重定向帧），skip_first 时不考虑第一帧。
+// 已提交的帧中没有关键帧时返回全部已提交的帧数，found 为 false。
+static int frames_before_keyframe(reader* rd, bool skip_first, bool* found)
+{
+    int stored = rd->stored_.load(std::memory_order_acquire);
+    uint8_t* cur = rd->cur_.load(std::memory_order_relaxed);
+    struct mem_region* rg = reader_region(rd);
+    *found = false;
+    for(int i=0; i<stored; i++)
+    {
+        struct frame_header copy;
+        struct frame_header* hdr = reinterpret_cast<struct frame_header*>(cur);
+        if(rd->buf_->leaky_)
+        {
+            // 之后的帧已被覆盖，由 release() 发现。
+            if(!copy_header(cur, rd->serial_ + i, rg, &copy))
+            {
+                return i;
+            }
+            hdr = &copy;
+        }
+        if(!hdr->len)
+        {
+            cur = follow_redirect(*hdr, cur, &rg);
+            if(!cur)
+            {
+                return i;
+            }
+            continue;
+        }
+        if(!skip_first && (hdr->flags & JGB_FRAME_KEYFRAME))
+        {
+            *found = true;
+            return i;
+        }
+        skip_first = false;
+        cur += hdr->total_len();
+        if(cur + sizeof(struct frame_header) > rg->end)
+        {
+            cur = rg->start;
+        }
+    }
+    return stored;
+}
+
+// 读者等待关键帧时，一次丢弃读指针处关键帧之前的帧，返回 true。
+static bool skip_to_keyframe(reader* rd, boost::unique_lock<boost::mutex>& rd_lock)
+{
+    if(!rd->pimpl_->want_keyframe)
+    {
+        return false;
+    }
+
+    bool found;
+    int n = frames_before_keyframe(rd, false, &found);
+    if(found)
+    {
+        rd->pimpl_->want_keyframe = false;
+    }
+    if(!n)
+    {
+        return false;
+    }
+
+    // 可丢弃的读者总是持有 mutex，release() 重新加锁。
+    rd_lock.unlock();
+    rd->release(n);
+    return true;
+}
+
+// 消费者组：从分发位置开始，将最多 max 帧分发给成员 rd，返回分发的帧数。调用者须持有组的锁。
+static int group_dispatch(reader* rd, struct frame* frms, int max)
+{
+    struct reader_group* grp = rd->pimpl_->group;
+    reader* grd = grp->rd;
+    int stored = grd->stored_.load(std::memory_order_acquire);
+    int steps = grp->steps.load(std::memory_order_relaxed);
+    int n = 0;
+    while(n < max && steps < stored)
+    {
+        if(!steps)
+        {
+            // 没有已分发的帧，从组的读者的读指针开始。
+            grp->next = grd->cur_.load(std::memory_order_relaxed);
+            grp->rgn = reader_region(grd);
+        }
+        struct frame_header* hdr = reinterpret_cast<struct frame_header*>(grp->next);
+        ++ steps;
+        ++ grp->skipped;
+        if(!hdr->len)
+        {
+            jgb_assert((hdr->flags & JGB_FRAME_PAD) || !hdr->start_offset);
+            grp->next = follow_redirect(hdr, &grp->rgn);
+            continue;
+        }
+
+        fill_frame(&frms[n++], hdr);
+        grp->entries.push_back({grp->next, grp->skipped, false});
+        grp->skipped = 0;
+        rd->pimpl_->group_held.push_back(&grp->entries.back());
+
+        grp->next += hdr->total_len();
+        if(grp->next + sizeof(struct frame_header) > grp->rgn->end)
+        {
+            grp->next = grp->rgn->start;
+        }
+    }
+    grp->steps.store(steps);
+    return n;
+}
+
+// 消费者组的成员 rd 请求获取最多 max 帧。
+// 同一时刻只有一个成员在组的读者上等待新帧，其他成员等待该成员。
+static int group_request(reader* rd, struct frame* frms, int max, int* count, int timeout)
+{
+    struct reader_group* grp = rd->pimpl_->group;
+    reader* grd = grp->rd;
+    std::deque<struct group_entry*>& held = rd->pimpl_->group_held;
+    if(rd->buf_->leaky_)
+    {
+        return JGB_ERR_NOT_SUPPORT;
+    }
+    if(timeout < 0)
+    {
+        timeout = 0;
+    }
+    boost::chrono::steady_clock::time_point deadline =
+        boost::chrono::steady_clock::now() + boost::chrono::milliseconds(timeout);
+
+    boost::unique_lock<boost::mutex> grp_lock(grp->mutex);
+    // 持有帧时返回所持有的帧，与其他读者一致。
+    if(!held.empty())
+    {
+        int n = std::min(max, static_cast<int>(held.size()));
+        for(int i=0; i<n; i++)
+        {
+            fill_frame(&frms[i], reinterpret_cast<struct frame_header*>(held[i]->hdr));
+        }
+        *count = n;
+        return 0;
+    }
+
+    while(true)
+    {
+        int n = group_dispatch(rd, frms, max);
+        if(n)
+        {
+            if(rd->stat_latency_)
+            {
+                rd->pimpl_->request_time = frame_clock();
+                for(int i=0; i<n; i++)
+                {
+                    rd->stat_commit_latency_.record(rd->pimpl_->request_time - frms[i].timestamp);
+                }
+            }
+            rd->pimpl_->held = n;
+            rd->holding_ = true;
+            *count = n;
+            return 0; // 成功
+        }
+
+        int ms = remaining_ms(deadline);
+        if(!ms)
+        {
+            ++ rd->stat_timeout_;
+            return JGB_ERR_TIMEOUT; // 超时
+        }
+        if(grp->waiting)
+        {
+            grp->cond.wait_for(grp_lock, boost::chrono::milliseconds(ms));
+            continue;
+        }
+
+        // 等待期间不持有组的锁，其他成员可以释放帧。
+        grp->waiting = true;
+        grp_lock.unlock();
+        {
+            boost::unique_lock<boost::mutex> rd_lock(grd->pimpl_->mutex);
+            wait_commit(grd, rd_lock, ms, [grd, grp]()
+            {
+                return grd->stored_.load() > grp->steps.load();
+            });
+        }
+        grp_lock.lock();
+        grp->waiting = false;
+        grp->cond.notify_all();
+    }
+}
+
+int reader::request_frame_internal(struct frame* frm, int timeout)
+{
+    if(!frm)
+    {
+        return JGB_ERR_INVALID;
+    }
+
+    boost::unique_lock<boost::mutex> rd_lock(pimpl_->mutex, boost::defer_lock);
+    int r = wait_frames(this, rd_lock, timeout);
+    if(r)
+    {
+        return r;
+    }
+
+    if(resync_lapped(this, rd_lock) || skip_redirect(this, rd_lock) || skip_to_keyframe(this, rd_lock))
+    {
+        return JGB_ERR_RETRY;
+    }
+
+    fill_frame(frm, reinterpret_cast<struct frame_header*>(cur_.load(std::memory_order_relaxed)));
+    // leaky 模式：读取帧头期间帧被覆盖。
+    if(resync_lapped(this, rd_lock))
+    {
+        return JGB_ERR_RETRY;
+    }
+
+    if(stat_latency_)
+    {
+        pimpl_->request_time = frame_clock();
+        stat_commit_latency_.record(pimpl_->request_time - frm->timestamp);
+    }
+
+    pimpl_->held = 1;
+    holding_ = true;
+
+    return 0; // 成功
+}
+
+// 完整性校验：校验所获取的帧的 CRC32C，不一致时设置 JGB_FRAME_CORRUPTED。
+static void verify_frames(reader* rd, struct frame* frms, int n)
+{
+    for(int i=0; i<n; i++)
+    {
+        struct frame& frm = frms[i];
+        struct frame_header* hdr = reinterpret_cast<struct frame_header*>(frm.buf - frm.start_offset
+                                                                          - sizeof(struct frame_header));
+        if(!(hdr->flags & JGB_FRAME_CRC))
+        {
+            continue;
+        }
+        uint32_t crc;
+        memcpy(&crc, hdr->crc_pos(), sizeof(crc));
+        if(crc32c(frm.buf, frm.len) != crc)
+        {
+            frm.flags |= JGB_FRAME_CORRUPTED;
+            ++ rd->stat_crc_errors_;
+            jgb_warning("帧的完整性校验失败。{ buf id = %s, reader = %s, len = %d, crc errors = %ld }",
+                        rd->buf_->id().c_str(), rd->id_.c_str(), frm.len, rd->stat_crc_errors_);
+        }
+    }
+}
+
+// 解压 LZ4 压缩的帧，frms[i] 改为引用读者的第 i 个解压缓冲区；解压失败的帧保持原样。
+static void decompress_frames(reader* rd, struct frame* frms, int n)
+{
+    if(rd->keep_compressed_)
+    {
+        return;
+    }
+#ifdef JGB_HAVE_LZ4
+    std::vector<std::vector<uint8_t>>& bufs = rd->pimpl_->lz4_bufs;
+    for(int i=0; i<n; i++)
+    {
+        struct frame& frm = frms[i];
+        if(!(frm.flags & JGB_FRAME_LZ4) || (frm.flags & JGB_FRAME_CORRUPTED))
+        {
+            continue;
+        }
+        uint32_t raw_len = 0;
+        if(frm.len > static_cast<int>(sizeof(raw_len)))
+        {
+            memcpy(&raw_len, frm.buf, sizeof(raw_len));
+        }
+        // LZ4 的压缩比不超过 255。
+        if(!raw_len || raw_len > static_cast<uint64_t>(frm.len) * 255U || raw_len > INT_MAX)
+        {
+            jgb_warning("压缩的帧无效。{ id = %s, len = %d, raw len = %u }", rd->id_.c_str(), frm.len, raw_len);
+            continue;
+        }
+        if(bufs.size() <= static_cast<size_t>(i))
+        {
+            bufs.resize(i + 1);
+        }
+        std::vector<uint8_t>& out = bufs[i];
+        out.resize(raw_len);
+        int r = LZ4_decompress_safe(reinterpret_cast<const char*>(frm.buf) + sizeof(raw_len),
+                                    reinterpret_cast<char*>(out.data()),
+                                    frm.len - sizeof(raw_len), raw_len);
+        if(r != static_cast<int>(raw_len))
+        {
+            jgb_warning("解压帧失败。{ id = %s, len = %d, raw len = %u, r = %d }", rd->id_.c_str(), frm.len, raw_len, r);
+            continue;
+        }
+        frm.buf = out.data();
+        frm.len = raw_len;
+        frm.flags &= ~JGB_FRAME_LZ4;
+    }
+#else
+    (void) rd;
+    (void) frms;
+    (void) n;
+#endif
+}
+
+int reader::request_frame(struct frame* frm, int timeout)
+{
+    int r;
+    if(pimpl_->group)
+    {
+        int count;
+        r = frm ? group_request(this, frm, 1, &count, timeout) : JGB_ERR_INVALID;
+    }
+    else
+    {
+        // 可丢弃的读者落后时，写者可能在两次调用之间丢弃整圈的帧，使读者再次遇到重定向帧。
+        do
+        {
+            r = request_frame_internal(frm, timeout);
+        } while(r == JGB_ERR_RETRY);
+    }
+    if(!r)
+    {
+        verify_frames(this, frm, 1);
+        decompress_frames(this, frm, 1);
+    }
+    return r;
+}
+
+int reader::request_frames_internal(struct frame* frms, int max, int* count, int timeout)
+{
+    boost::unique_lock<boost::mutex> rd_lock(pimpl_->mutex, boost::defer_lock);
+    int r = wait_frames(this, rd_lock, timeout);
+    if(r)
+    {
+        return r;
+    }
+
+    if(resync_lapped(this, rd_lock) || skip_redirect(this, rd_lock) || skip_to_keyframe(this, rd_lock))
+    {
+        return JGB_ERR_RETRY;
+    }
+
+    // 从读指针开始依次取出已提交的帧，跳过中间的重定向帧。
+    // 写者不会覆盖 stored_ 所包含的帧，故无需在访问帧的过程中持有锁。
+    uint8_t* cur = cur_.load(std::memory_order_relaxed);
+    struct mem_region* rg = reader_region(this);
+    uint32_t serial = serial_;
+    int stored = stored_.load(std::memory_order_acquire);
+    int n = 0;
+    for(int i=0; i<stored && n<max; i++)
+    {
+        struct frame_header copy;
+        struct frame_header* hdr = reinterpret_cast<struct frame_header*>(cur);
+        if(buf_->leaky_)
+        {
+            // 之后的帧已被覆盖，或者正在被覆盖。
+            if(!copy_header(cur, serial, rg, &copy))
+            {
+                break;
+            }
+            hdr = &copy;
+        }
+        else
+        {
+            jgb_assert(hdr->serial == serial);
+        }
+        if(!hdr->len)
+        {
+            jgb_assert(buf_->leaky_ || (hdr->flags & JGB_FRAME_PAD) || !hdr->start_offset);
+            uint8_t* next = follow_redirect(*hdr, cur, &rg);
+            if(!next)
+            {
+                break;
+            }
+            ++ serial;
+            cur = next;
+            continue;
+        }
+        ++ serial;
+
+        fill_frame(&frms[n++], *hdr, cur);
+
+        cur += hdr->total_len();
+        if(cur + sizeof(struct frame_header) > rg->end)
+        {
+            cur = rg->start;
+        }
+    }
+    // leaky 模式：读者读取期间，写者按顺序覆盖，第一帧完好时其后的帧也完好。
+    if(resync_lapped(this, rd_lock))
+    {
+        return JGB_ERR_RETRY;
+    }
+    jgb_assert(n > 0);
+
+    if(stat_latency_)
+    {
+        pimpl_->request_time = frame_clock();
+        for(int i=0; i<n; i++)
+        {
+            stat_commit_latency_.record(pimpl_->request_time - frms[i].timestamp);
+        }
+    }
+
+    *count = n;
+    pimpl_->held = n;
+    holding_ = true;
+
+    return 0; // 成功
+}
+
+int reader::request_frames(struct frame* frms, int max, int* count, int timeout)
+{
+    if(!frms || max <= 0 || !count)
+    {
+        return JGB_ERR_INVALID;
+    }
+
+    *count = 0;
+
+    int r;
+    if(pimpl_->group)
+    {
+        r = group_request(this, frms, max, count, timeout);
+    }
+    else
+    {
+        do
+        {
+            r = request_frames_internal(frms, max, count, timeout);
+        } while(r == JGB_ERR_RETRY);
+    }
+    if(!r)
+    {
+        verify_frames(this, frms, *count);
+        decompress_frames(this, frms, *count);
+    }
+    return r;
+}
+
+frame_handle::frame_handle()
+    : pin_(nullptr)
+{
+}
+
+frame_handle::frame_handle(const frame_handle& other)
+    : pin_(other.pin_)
+{
+    if(pin_)
+    {
+        pin_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+frame_handle::frame_handle(frame_handle&& other)
+    : pin_(other.pin_)
+{
+    other.pin_ = nullptr;
+}
+
+frame_handle& frame_handle::operator=(const frame_handle& other)
+{
+    if(other.pin_ != pin_)
+    {
+        reset();
+        pin_ = other.pin_;
+        if(pin_)
+        {
+            pin_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return *this;
+}
+
+frame_handle& frame_handle::operator=(frame_handle&& other)
+{
+    if(&other != this)
+    {
+        reset();
+        pin_ = other.pin_;
+        other.pin_ = nullptr;
+    }
+    return *this;
+}
+
+frame_handle::~frame_handle()
+{
+    reset();
+}
+
+// 释放最后一个引用时，从缓冲区中删除，此后写者可以覆盖该帧。
+void frame_handle::reset()
+{
+    struct frame_pin* pin = pin_;
+    pin_ = nullptr;
+    if(!pin || pin->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+
+    if(pin->buf)
+    {
+        buffer::Impl* impl = pin->buf->pimpl_.get();
+        boost::unique_lock<boost::mutex> pin_lock(impl->pin_mutex);
+        impl->pins.erase(pin->it);
+        impl->pin_count.fetch_sub(1, std::memory_order_release);
+    }
+    delete pin;
+}
+
+const struct frame& frame_handle::get() const
+{
+    jgb_assert(pin_);
+    return pin_->frm;
+}
+
+int reader::request_frame(frame_handle* handle, int timeout)
+{
+    if(!handle)
+    {
+        return JGB_ERR_INVALID;
+    }
+
+    // 共享内存模式下其他进程的写者无法看到被引用的帧；leaky 模式下写者不等待读者，帧可能在引用之前被覆盖；
+    // 多写者模式下写者不能在已申请的缓冲区之间插入填充帧。
+    if(buf_->shm_ || buf_->leaky_ || buf_->multi_writer_ || pimpl_->group)
+    {
+        return JGB_ERR_NOT_SUPPORT;
+    }
+
+    if(holding_)
+    {
+        jgb_warning("持有帧时不能以句柄引用帧。{ buf id = %s }", buf_->id().c_str());
+        return JGB_ERR_DENIED;
+    }
+
+    handle->reset();
+
+    // 帧句柄引用缓冲区中原样的帧，不解压。
+    struct frame frm;
+    int r;
+    do
+    {
+        r = request_frame_internal(&frm, timeout);
+    } while(r == JGB_ERR_RETRY);
+    if(r)
+    {
+        return r;
+    }
+    verify_frames(this, &frm, 1);
+
+    // 在释放帧之前加入：写者在读者释放该帧之后才可能到达该帧，此时已经可以看到。
+    struct frame_header* hdr = reinterpret_cast<struct frame_header*>(frm.buf - frm.start_offset
+                                                                      - sizeof(struct frame_header));
+    struct frame_pin* pin = new frame_pin;
+    pin->buf = buf_;
+    pin->rgn = reader_region(this);
+    pin->start = reinterpret_cast<uint8_t*>(hdr);
+    pin->end = pin->start + hdr->total_len();
+    pin->frm = frm;
+    pin->refs.store(1, std::memory_order_relaxed);
+    {
+        buffer::Impl* impl = buf_->pimpl_.get();
+        boost::unique_lock<boost::mutex> pin_lock(impl->pin_mutex);
+        pin->it = impl->pins.insert(impl->pins.end(), pin);
+        impl->pin_count.fetch_add(1, std::memory_order_release);
+    }
+
+    release();
+    handle->pin_ = pin;
+    return 0;
+}
+
+void reader::release(int n)
+{
+    if(pimpl_->group)
+    {
+        group_release(this, n);
+        return;
+    }
+
+    boost::unique_lock<boost::mutex> rd_lock(pimpl_->mutex, boost::defer_lock);
+    if(reader_use_lock(this))
+    {
+        rd_lock.lock();
+    }
+
+    //jgb_debug("{ stored = %d, serial = %d }", stored_, serial_);
+    int stored = stored_.load(std::memory_order_acquire);
+    uint8_t* cur = cur_.load(std::memory_order_relaxed);
+    struct mem_region* rg = stored > 0 ? reader_region(this) : nullptr;
+    int64_t hold = (stat_latency_ && pimpl_->held > 0) ? frame_clock() - pimpl_->request_time : 0L;
+    uint8_t* first = cur;
+    uint32_t first_serial = serial_;
+    bool lapped = false;
+    int steps = 0;
+    while(n > 0 && steps < stored)
+    {
+        jgb_assert(cur);
+        jgb_assert(cur + sizeof(struct frame_header) <= rg->end);
+
+        struct frame_header copy;
+        struct frame_header* hdr = reinterpret_cast<struct frame_header*>(cur);
+        if(buf_->leaky_)
+        {
+            if(!copy_header(cur, serial_, rg, &copy))
+            {
+                lapped = true;
+                break;
+            }
+            hdr = &copy;
+        }
+        uint8_t* pos = cur;
+
+        ++ serial_;
+        ++ steps;
+
+        if(hdr->len)
+        {
+            cur += hdr->total_len();
+            if(cur + sizeof(struct frame_header) > rg->end)
+            {
+                //jgb_debug("reader return");
+                cur = rg->start;
+            }
+        }
+        else
+        {
+            //jgb_debug("reader return");
+            jgb_assert(buf_->leaky_ || (hdr->flags & JGB_FRAME_PAD) || !hdr->start_offset);
+            cur = follow_redirect(*hdr, pos, &rg);
+            if(!cur)
+            {
+                // leaky 模式：帧头正在被覆盖，不移动读指针。
+                lapped = true;
+                break;
+            }
+            if(pimpl_->held > 0)
+            {
+                // request_frames() 所跳过的重定向帧，不计入释放的帧数。
+                ++ stat_frames_read_;
+                continue;
+            }
+        }
+
+        if(pimpl_->held > 0)
+        {
+            stat_bytes_read_ += hdr->len;
+            ++ stat_frames_read_;
+            -- pimpl_->held;
+            if(stat_latency_)
+            {
+                stat_hold_latency_.record(hold);
+            }
+        }
+        else
+        {
+            stat_bytes_discarded_ += hdr->len;
+            ++ stat_frames_discarded_;
+        }
+        -- n;
+    }
+
+    // leaky 模式：释放期间帧已被覆盖，不移动读指针，读者在下一次请求时转到最早的有效帧。
+    if(buf_->leaky_ && first && (lapped || frame_serial(first) != first_serial))
+    {
+        serial_ = first_serial;
+        pimpl_->held = 0;
+        holding_ = false;
+        return;
+    }
+
+    if(steps)
+    {
+        // 先设置所在的数据区，再移动读指针：写者根据读指针判断读者是否已经离开旧的数据区。
+        pimpl_->rgn = rg;
+        cur_.store(cur, std::memory_order_release);
+        holding_ = pimpl_->held > 0;
+
+        // 先移动读指针，再减少可读帧数：写者看到 stored_ 减少时，必然也能看到新的读指针。
+        stored_ -= steps;
+
+        // 通知写者，读指针已经移动。
+        notify_writer(this, rd_lock);
+
+        if(!stored_.load())
+        {
+            rearm_reader_event(this);
+        }
+    }
+}
+
+int reader::event_fd()
+{
+    if(buf_->shm_ || pimpl_->group)
+    {
+        return JGB_ERR_NOT_SUPPORT;
+    }
+    int fd = create_event(pimpl_->efd);
+    if(fd >= 0)
+    {
+        rearm_reader_event(this);
+    }
+    return fd;
+}
+
+bool reader::overwritten()
+{
+    return buf_->leaky_ && pimpl_->held > 0 && frame_lapped(this);
+}
+
+int reader::read_chunked(std::vector<uint8_t>* data, int* flags, int timeout)
+{
+    if(!data)
+    {
+        jgb_warning("Invalid arguments. { data = %p }", data);
+        return JGB_ERR_INVALID;
+    }
+    if(pimpl_->group)
+    {
+        // 组内的各块可能分发给不同的成员。
+        return JGB_ERR_NOT_SUPPORT;
+    }
+
+    boost::chrono::steady_clock::time_point deadline = boost::chrono::steady_clock::now()
+        + boost::chrono::milliseconds(timeout);
+    struct frame frm;
+    while(true)
+    {
+        int r = request_frame(&frm, remaining_ms(deadline));
+        if(r)
+        {
+            return r;
+        }
+
+        reader::Impl* impl = pimpl_.get();
+        int64_t lost = stat_frames_discarded_ + stat_frames_lost_;
+        if(impl->chunk_frames
+            && (!(frm.flags & JGB_FRAME_CHUNK) || lost != impl->chunk_lost))
+        {
+            // 写者中途失败，或者其间有块被丢弃、覆盖。
+            stat_chunks_dropped_ += impl->chunk_frames;
+            impl->chunk_frames = 0;
+        }
+        if(!impl->chunk_frames)
+        {
+            if(frm.flags & JGB_FRAME_CHUNK)
+            {
+                // 缺少开始的块。
+                ++ stat_chunks_dropped_;
+                release();
+                continue;
+            }
+            impl->chunk_data.clear();
+            impl->chunk_flags = 0;
+            impl->chunk_lost = lost;
+        }
+
+        impl->chunk_data.insert(impl->chunk_data.end(), frm.buf, frm.buf + frm.len);
+        impl->chunk_flags |= frm.flags;
+        ++ impl->chunk_frames;
+        if(overwritten())
+        {
+            stat_chunks_dropped_ += impl->chunk_frames;
+            impl->chunk_frames = 0;
+            release();
+            continue;
+        }
+        release();
+
+        if(frm.flags & JGB_FRAME_CONTINUED)
+        {
+            continue;
+        }
+        impl->chunk_frames = 0;
+        data->swap(impl->chunk_data);
+        impl->chunk_data.clear();
+        if(flags)
+        {
+            *flags = impl->chunk_flags & ~(JGB_FRAME_CONTINUED | JGB_FRAME_CHUNK);
+        }
+        return 0;
+    }
+}
+
+static inline struct index_entry& index_at(buffer* buf, uint32_t i)
+{
+    return buf->pimpl_->index[i & (buf->pimpl_->index.size() - 1)];
+}
+
+// 将刚提交的帧 hdr 加入帧索引，索引已满时丢弃最早的条目。
+static void index_add(buffer* buf, struct frame_header* hdr)
+{
+    buffer::Impl* impl = buf->pimpl_.get();
+    if(impl->index.empty())
+    {
+        return;
+    }
+    if(impl->index_tail - impl->index_head == impl->index.size())
+    {
+        ++ impl->index_head;
+    }
+    struct index_entry& e = index_at(buf, impl->index_tail);
+    e.serial = hdr->serial;
+    e.offset = reinterpret_cast<uint8_t*>(hdr) - buf->start_;
+    e.len = hdr->total_len();
+    e.flags = hdr->flags;
+    e.timestamp = hdr->timestamp;
+    ++ impl->index_tail;
+}
+
+// 写者即将写入 [from, to)（相对数据区开始位置的偏移量），从帧索引中删除与之重叠的最早的条目。
+// 写者按顺序写入，被覆盖的总是最早的帧；删除后剩余的条目仍然首尾相接。
+static void index_drop(buffer* buf, int from, int to)
+{
+    buffer::Impl* impl = buf->pimpl_.get();
+    // 文件模式：恢复的帧即将被覆盖，此后加入的读者从写指针开始。
+    if(impl->recover_cur
+        && impl->recover_cur >= buf->start_ + from && impl->recover_cur < buf->start_ + to)
+    {
+        impl->recover_cur = nullptr;
+    }
+    while(impl->index_head != impl->index_tail)
+    {
+        struct index_entry& e = index_at(buf, impl->index_head);
+        if(static_cast<int>(e.offset) >= to || static_cast<int>(e.offset) + e.len <= from)
+        {
+            break;
+        }
+        ++ impl->index_head;
+    }
+}
+
+// leaky 模式：写者即将写入 [from, to)，丢弃与之重叠的最早的帧。
+// 先修改被丢弃的帧的帧序号，再写入：读者在读取帧之后检查帧序号，即可发现帧已被覆盖。
+static void drop_frames(buffer* buf, uint8_t* from, uint8_t* to)
+{
+    if(!buf->leaky_)
+    {
+        return;
+    }
+
+    buffer::Impl* impl = buf->pimpl_.get();
+    while(impl->oldest_serial != buf->serial_)
+    {
+        uint8_t* p = impl->oldest;
+        struct frame_header* hdr = reinterpret_cast<struct frame_header*>(p);
+        if(p >= to || p + hdr->total_len() <= from)
+        {
+            break;
+        }
+
+        uint8_t* next = p + hdr->total_len();
+        if((!hdr->len && !(hdr->flags & JGB_FRAME_PAD)) || next + sizeof(struct frame_header) > buf->end_)
+        {
+            next = buf->start_;
+        }
+        __atomic_store_n(reinterpret_cast<uint32_t*>(p), ~impl->oldest_serial, __ATOMIC_RELAXED);
+        impl->oldest = next;
+        ++ impl->oldest_serial;
+    }
+    if(impl->oldest_serial == buf->serial_)
+    {
+        impl->oldest = buf->cur_;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+int reader::seek(seek_mode whence, int64_t arg)
+{
+    if(whence < seek_next || whence > seek_flags)
+    {
+        return JGB_ERR_INVALID;
+    }
+    if(buf_->shm_ || pimpl_->group)
+    {
+        return JGB_ERR_NOT_SUPPORT;
+    }
+    if(whence != seek_next && !buf_->index_size_)
+    {
+        jgb_warning("缓冲区没有帧索引。{ id = %s }", buf_->id().c_str());
+        return JGB_ERR_NOT_SUPPORT;
+    }
+    if(pimpl_->held > 0)
+    {
+        jgb_warning("读者持有帧时不能移动读取位置。{ reader = %s }", id_.c_str());
+        return JGB_ERR_DENIED;
+    }
+
+    // 排除写者修改帧索引、帧序号；lock_free 模式下暂停写者。
+    boost::unique_lock<boost::shared_mutex> lock(buf_->pimpl_->rw_mutex);
+    pause_writers(buf_);
+    boost::unique_lock<boost::mutex> rd_lock(pimpl_->mutex);
+
+    buffer::Impl* impl = buf_->pimpl_.get();
+    uint32_t head = impl->index_head;
+    uint32_t tail = impl->index_tail;
+    // 为 tail 时表示下一个提交的帧。
+    uint32_t found = tail;
+    int r = 0;
+    switch(whence)
+    {
+    case seek_next:
+        break;
+    case seek_latest:
+        if(head != tail)
+        {
+            found = tail - 1;
+        }
+        break;
+    case seek_oldest:
+        found = head;
+        break;
+    case seek_time:
+    {
+        // 提交时间随帧序号递增，二分查找。
+        uint32_t lo = head;
+        uint32_t hi = tail;
+        while(lo != hi)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if(index_at(buf_, mid).timestamp < arg)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        found = lo;
+        break;
+    }
+    case seek_flags:
+        r = JGB_ERR_NOT_FOUND;
+        for(uint32_t i=tail; i!=head; i--)
+        {
+            if(index_at(buf_, i - 1).flags & arg)
+            {
+                found = i - 1;
+                r = 0;
+                break;
+            }
+        }
+        break;
+    }
+
+    if(found == tail)
+    {
+        // 由写者在下一次提交时初始化。
+        pimpl_->rgn = nullptr;
+        serial_ = 0;
+        stored_.store(0);
+        cur_.store(nullptr);
+    }
+    else
+    {
+        struct index_entry& e = index_at(buf_, found);
+        pimpl_->rgn = impl->region;
+        serial_ = e.serial;
+        stored_.store(static_cast<int>(buf_->serial_ - e.serial));
+        cur_.store(impl->region->start + e.offset);
+    }
+    holding_ = false;
+    pimpl_->want_keyframe = false;
+    rd_lock.unlock();
+
+    resume_writers(buf_);
+    return r;
+}
+
+int writer::event_fd()
+{
+    if(buf_->shm_)
+    {
+        return JGB_ERR_NOT_SUPPORT;
+    }
+    return create_event(buf_->pimpl_->wr_efd);
+}
+
+writer::writer(buffer* buf)
+    : stat_bytes_written_(0L),
+    stat_frames_written_(0L),
+    stat_cancelled_(0L),
+    stat_timeout_(0L),
+    stat_bytes_compressed_(0L),
+    buf_(buf),
+    requested_len_(0),
+    reserved_len_(0),
+    pimpl_(new Impl())
+{
+    jgb_assert(buf_);
+}
+
+static int wait_reader_release(writer* wr, boost::unique_lock<boost::mutex>& lock, reader* rd, int timeout)
+{
+    if(rd->discard_ && !rd->holding_)
+    {
+        int n = 1;
+        if(rd->discard_keyframe_)
+        {
+            // 一次跳到下一个关键帧，避免读者从不完整的 GOP 开始读取。
+            bool found;
+            n = frames_before_keyframe(rd, true, &found);
+            rd->pimpl_->want_keyframe = !found;
+        }
+        lock.unlock();
+        rd->release(n);
+        lock.lock();
+        return 0;
+    }
+
+    if(rd->pimpl_->rd_release_cond.wait_for(lock, boost::chrono::milliseconds(timeout)) == boost::cv_status::no_timeout)
+    {
+        return 0; // 成功
+    }
+    else
+    {
+        jgb_debug("wait reader time out. { buf = %s, reader id = %s }",
+                  wr->buf_->id().c_str(),
+                  rd->id_.c_str());
+        ++ wr->stat_timeout_;
+        return JGB_ERR_TIMEOUT; // 超时
+    }
+}
+
+// 等待单个读者移动到适当的位置，直到 ready(cur, stored) 返回 true。
+// lock_free 模式下，只有读者尚未移动到适当的位置时才加锁等待；
+// 增删、移动读者的线程正在暂停写者时返回 JGB_ERR_RETRY，不再访问 rd。
+// 读者尚未读完旧的数据区时，相当于位于当前数据区的开始位置，当前数据区中的帧都尚未读取。
+template<typename F>
+static int wait_reader(writer* wr, reader* rd, int timeout, F check)
+{
+    auto ready = [wr, &check](int stored, uint8_t* cur)
+    {
+        buffer* buf = wr->buf_;
+        if(in_old_region(buf, cur))
+        {
+            return check(static_cast<int>(buf->serial_ - buf->pimpl_->region->serial), buf->start_);
+        }
+        return check(stored, cur);
+    };
+
+    int r;
+    if(!reader_use_lock(rd))
+    {
+        // 先读取 stored_，再读取 cur_：读者释放时先移动读指针，再减少可读帧数。
+        int stored = rd->stored_.load();
+        uint8_t* cur = rd->cur_.load();
+        if(!cur || ready(stored, cur))
+        {
+            return 0;
+        }
+    }
+
+    boost::unique_lock<boost::mutex> rd_lock(rd->pimpl_->mutex);
+    rd->pimpl_->wr_waiting.store(true);
+    while(true)
+    {
+        int stored = rd->stored_.load();
+        uint8_t* cur = rd->cur_.load();
+        // 读者尚未完成初始化。
+        if(!cur || ready(stored, cur))
+        {
+            r = 0;
+            break;
+        }
+        // 先登记等待，再检查 pause：pause_writers() 先设置 pause，再检查是否有写者在等待。
+        if(wr->buf_->lock_free_ && wr->buf_->pimpl_->pause.load())
+        {
+            r = JGB_ERR_RETRY;
+            break;
+        }
+        r = wait_reader_release(wr, rd_lock, rd, timeout);
+        if(r)
+        {
+            break;
+        }
+    }
+    rd->pimpl_->wr_waiting.store(false, std::memory_order_relaxed);
+    return r;
+}
+
+// 共享内存模式：等待所有进程的读者移动到适当的位置，直到 ready(cur, stored) 返回 true。
+// 读者进程已经退出时，回收其槽位。
+template<typename F>
+static int wait_shm_readers(writer* wr, int timeout, F ready)
+{
+    buffer* buf = wr->buf_;
+    struct shm_header* hdr = get_shm(buf);
+    boost::chrono::steady_clock::time_point deadline =
+        boost::chrono::steady_clock::now() + boost::chrono::milliseconds(timeout);
+    for(int i=0; i<JGB_SHM_MAX_READERS; i++)
+    {
+        struct shm_slot& slot = hdr->slots[i];
+        while(slot.state.load() == shm_slot_used)
+        {
+            uint32_t seq = hdr->rd_seq.load();
+            uint64_t pos = slot.pos.load();
+            // 读者尚未完成初始化。
+            if(pos == JGB_SHM_POS_NONE)
+            {
+                break;
+            }
+            int stored = static_cast<int>(buf->serial_ - static_cast<uint32_t>(pos >> 32));
+            if(ready(stored, buf->start_ + static_cast<uint32_t>(pos)))
+            {
+                break;
+            }
+
+            int ms = remaining_ms(deadline);
+            if(!ms)
+            {
+                int32_t pid = slot.pid.load();
+                if(!pid_alive(pid))
+                {
+                    jgb_warning("读者进程已退出，回收其槽位。{ buf = %s, slot = %d, pid = %d }",
+                                buf->id().c_str(), i, pid);
+                    shm_free_slot(hdr, slot);
+                    break;
+                }
+                jgb_debug("wait reader time out. { buf = %s, slot = %d, pid = %d }",
+                          buf->id().c_str(), i, pid);
+                ++ wr->stat_timeout_;
+                return JGB_ERR_TIMEOUT; // 超时
+            }
+            // 先登记等待，再检查读者是否已经移动：读者先移动读取位置，再检查是否有写者在等待。
+            hdr->wr_waiters.fetch_add(1);
+            if(hdr->rd_seq.load() == seq)
+            {
+                futex_wait(&hdr->rd_seq, seq, ms);
+            }
+            hdr->wr_waiters.fetch_sub(1);
+        }
+    }
+    return 0;
+}
+
+// 场景1：从写指针到缓冲区末尾的空间足以容纳新帧。
+static bool ready_scenario_1(writer* wr, int stored, uint8_t* cur)
+{
+    uint8_t* next = wr->buf_->cur_ + wr->reserved_len_;
+    if(wr->buf_->cur_ < cur)
+    {
+        return next <= cur;
+    }
+    else if(wr->buf_->cur_ > cur)
+    {
+        return true;
+    }
+    else
+    {
+        // 满：!stored 为 false
+        // 空：!stored 为 true
+        return !stored;
+    }
+}
+
+// 多写者模式：其他写者已申请、尚未发布的缓冲区相当于位于读者可见的写指针处的读者，
+// 其可读帧数为尚未发布的缓冲区数。等待之前申请的缓冲区发布，直到 ready(cur, stored) 返回 true。
+template<typename F>
+static int wait_reservations(writer* wr, int timeout, F ready)
+{
+    buffer* buf = wr->buf_;
+    if(!buf->multi_writer_)
+    {
+        return 0;
+    }
+
+    buffer::Impl* impl = buf->pimpl_.get();
+    boost::unique_lock<boost::mutex> mp_lock(impl->mp_mutex);
+    auto done = [impl, &ready]()
+    {
+        return ready(static_cast<int>(impl->reservations.size()), impl->pub_cur);
+    };
+    if(!impl->mp_cond.wait_for(mp_lock, boost::chrono::milliseconds(timeout), done))
+    {
+        jgb_debug("wait reservations time out. { buf = %s }", buf->id().c_str());
+        ++ wr->stat_timeout_;
+        return JGB_ERR_TIMEOUT; // 超时
+    }
+    return 0;
+}
+
+// 场景2：从缓冲区开始到写指针的空间足以容纳新帧。
+static bool ready_scenario_2(writer* wr, int stored, uint8_t* cur)
+{
+    uint8_t* next = wr->buf_->start_ + wr->reserved_len_;
+    if(wr->buf_->cur_ < cur)
+    {
+        return false;
+    }
+    else if(wr->buf_->cur_ > cur)
+    {
+        return next <= cur;
+    }
+    else
+    {
+        return !stored;
+    }
+}
+
+// 场景3：从缓冲区开始的空间足以容纳新帧，但超过了写指针。
+static bool ready_scenario_3(writer* wr, int stored, uint8_t* cur)
+{
+    // 只有读者为空时才可以继续。
+    return wr->buf_->cur_ == cur && !stored;
+}
+
+// 等待单个读者移动到适当的位置。
+int writer::wait_reader_scenario_1(reader* rd, int timeout)
+{
+    return wait_reader(this, rd, timeout, [this](int stored, uint8_t* cur)
+    {
+        return ready_scenario_1(this, stored, cur);
+    });
+}
+
+int writer::wait_readers_scenario_1(int timeout)
+{
+    if(buf_->shm_)
+    {
+        return wait_shm_readers(this, timeout, [this](int stored, uint8_t* cur)
+        {
+            return ready_scenario_1(this, stored, cur);
+        });
+    }
+
+    int r = wait_reservations(this, timeout, [this](int stored, uint8_t* cur)
+    {
+        return ready_scenario_1(this, stored, cur);
+    });
+    if(r)
+    {
+        return r;
+    }
+    return wait_readers(&writer::wait_reader_scenario_1, timeout);
+}
+
+int writer::wait_reader_scenario_2(reader* rd, int timeout)
+{
+    return wait_reader(this, rd, timeout, [this](int stored, uint8_t* cur)
+    {
+        return ready_scenario_2(this, stored, cur);
+    });
+}
+
+int writer::wait_readers_scenario_2(int timeout)
+{
+    if(buf_->shm_)
+    {
+        return wait_shm_readers(this, timeout, [this](int stored, uint8_t* cur)
+        {
+            return ready_scenario_2(this, stored, cur);
+        });
+    }
+
+    int r = wait_reservations(this, timeout, [this](int stored, uint8_t* cur)
+    {
+        return ready_scenario_2(this, stored, cur);
+    });
+    if(r)
+    {
+        return r;
+    }
+    return wait_readers(&writer::wait_reader_scenario_2, timeout);
+}
+
+int writer::wait_reader_scenario_3(reader* rd, int timeout)
+{
+    return wait_reader(this, rd, timeout, [this](int stored, uint8_t* cur)
+    {
+        return ready_scenario_3(this, stored, cur);
+    });
+}
+
+int writer::wait_readers_scenario_3(int timeout)
+{
+    if(buf_->shm_)
+    {
+        return wait_shm_readers(this, timeout, [this](int stored, uint8_t* cur)
+        {
+            return ready_scenario_3(this, stored, cur);
+        });
+    }
+
+    int r = wait_reservations(this, timeout, [this](int stored, uint8_t* cur)
+    {
+        return ready_scenario_3(this, stored, cur);
+    });
+    if(r)
+    {
+        return r;
+    }
+    return wait_readers(&writer::wait_reader_scenario_3, timeout);
+}
+
+int writer::wait_readers(int (writer::*wait)(reader*, int), int timeout)
+{
+    size_t i = 0;
+    while(i < pimpl_->readers.size())
+    {
+        int r = (this->*wait)(pimpl_->readers[i], timeout);
+        if(r == JGB_ERR_RETRY)
+        {
+            // 离开读者列表，等待增删、移动读者完成，之后按新的读者列表重新等待。
+            leave_readers();
+            enter_readers();
+            i = 0;
+            continue;
+        }
+        if(r)
+        {
+            return r;
+        }
+        ++ i;
+    }
+    return 0;
+}
+
+int writer::acquire_buffer_ownership(int timeout)
+{
+    boost::unique_lock<boost::mutex> owner_lock(buf_->pimpl_->owner_mutex);
+    if(!buf_->owner_)
+    {
+        buf_->owner_ = this;
+    }
+    else if(buf_->owner_ != this)
+    {
+        if(buf_->pimpl_->owner_cond.wait_for(owner_lock, boost::chrono::milliseconds(timeout),
+                                              [this](){ return buf_->owner_ == nullptr; }))
+        {
+            buf_->owner_ = this;
+        }
+        else
+        {
+            ++ stat_timeout_;
+            return JGB_ERR_TIMEOUT; // 超时
+        }
+    }
+    jgb_assert(buf_->owner_ == this);
+    return 0;
+}
+
+bool writer::check_buffer_ownership()
+{
+    boost::unique_lock<boost::mutex> owner_lock(buf_->pimpl_->owner_mutex);
     return buf_->owner_ == this;
 }
 
@@ -665,153 +3835,774 @@ void writer::release_buffer_ownership()
     buf_->pimpl_->owner_cond.notify_one();
 }
 
-int writer::request_buffer(uint8_t** buf, int len, int timeout)
-{
-    int frame_len = JGB_ALIGN(len, 4) + sizeof(struct frame_header);
-    uint8_t* next;
-    int r;
+// 开始访问读者列表，必要时刷新读者列表的快照。
+// 非 lock_free 模式下，调用者须持有 rw_mutex；lock_free 模式下，增删读者时会等待写者调用 leave_readers()。
+void writer::enter_readers()
+{
+    if(buf_->lock_free_)
+    {
+        while(true)
+        {
+            pimpl_->in_op.store(true);
+            if(!buf_->pimpl_->pause.load())
+            {
+                break;
+            }
+            pimpl_->in_op.store(false);
+            boost::unique_lock<boost::mutex> lock(buf_->pimpl_->pause_mutex);
+            buf_->pimpl_->pause_cond.wait(lock, [this](){ return !buf_->pimpl_->pause.load(); });
+        }
+    }
+
+    uint32_t gen = buf_->pimpl_->readers_gen.load(std::memory_order_acquire);
+    if(gen != pimpl_->readers_gen)
+    {
+        pimpl_->readers.assign(buf_->readers_.begin(), buf_->readers_.end());
+        pimpl_->readers_gen = gen;
+    }
+}
+
+void writer::leave_readers()
+{
+    if(buf_->lock_free_)
+    {
+        pimpl_->in_op.store(false, std::memory_order_release);
+    }
+}
+
+// 释放 request_buffer() 成功时获得的资源。
+void writer::end_request()
+{
+    reserved_len_ = 0;
+    pimpl_->batch = false;
+    pimpl_->batch_frames = 0;
+    pimpl_->batch_bytes = 0;
+    pimpl_->batch_used = 0;
+    struct shm_header* hdr = get_shm(buf_);
+    if(hdr)
+    {
+        publish();
+        shm_unlock_writer(hdr);
+    }
+    if(!buf_->lock_free_)
+    {
+        // 多写者模式下，申请成功后已经释放写入权；分块写入时保留写入权，直到写入最后一块。
+        if(!pimpl_->chunk_hold && (!buf_->multi_writer_ || check_buffer_ownership()))
+        {
+            release_buffer_ownership();
+        }
+        pimpl_->mutex.unlock();
+    }
+    pimpl_->res = nullptr;
+}
+
+// 共享内存模式：发布写指针及帧序号，通知其他进程的读者。
+// 写者可能在 request_buffer() 中移动写指针后取消提交，所以每次结束请求时都要发布写指针。
+void writer::publish()
+{
+    struct shm_header* hdr = get_shm(buf_);
+    if(hdr)
+    {
+        hdr->wr_off.store(buf_->cur_ - buf_->start_);
+        hdr->serial.store(buf_->serial_);
+        if(hdr->rd_waiters.load())
+        {
+            futex_wake(&hdr->serial, INT_MAX);
+        }
+    }
+}
+
+int writer::request_buffer(uint8_t** buf, int len, int timeout)
+{
+    if(!buf || len <= 0)
+    {
+        jgb_warning("Invalid arguments. { buf = %p, requested len = %d }", buf, len);
+        return JGB_ERR_INVALID;
+    }
+
+    int r = reserve(frame_size(len) + (buf_->crc_ ? sizeof(uint32_t) : 0), timeout);
+    if(!r)
+    {
+        *buf = writer_cur(this) + sizeof(struct frame_header);
+        requested_len_ = len;
+    }
+    return r;
+}
+
+int writer::request_batch(int len, int timeout)
+{
+    if(len < frame_size(1))
+    {
+        jgb_warning("Invalid arguments. { requested len = %d }", len);
+        return JGB_ERR_INVALID;
+    }
+
+    int r = reserve(len, timeout);
+    if(!r)
+    {
+        pimpl_->batch = true;
+        requested_len_ = 0;
+    }
+    return r;
+}
+
+int writer::request_batch_frame(uint8_t** buf, int len, int flags)
+{
+    if(!buf || len <= 0 || (flags & ~JGB_FRAME_USER_FLAGS))
+    {
+        jgb_warning("Invalid arguments. { buf = %p, requested len = %d, flags = 0x%x }", buf, len, flags);
+        return JGB_ERR_INVALID;
+    }
+
+    if(!pimpl_->batch)
+    {
+        jgb_warning("没有已申请的批量缓冲区。");
+        return JGB_ERR_INVALID;
+    }
+
+    int frame_len = frame_size(len) + (buf_->crc_ ? sizeof(uint32_t) : 0);
+    if(pimpl_->batch_used + frame_len > reserved_len_)
+    {
+        return JGB_ERR_LIMIT;
+    }
+
+    // 帧头在 commit_batch() 之前对读者不可见。
+    struct frame_header* hdr = reinterpret_cast<struct frame_header*>(writer_cur(this) + pimpl_->batch_used);
+    hdr->serial = buf_->serial_ + pimpl_->batch_frames;
+    hdr->len = len;
+    hdr->start_offset = 0;
+    hdr->flags = flags | (buf_->crc_ ? JGB_FRAME_CRC : 0);
+
+    *buf = reinterpret_cast<uint8_t*>(hdr) + sizeof(struct frame_header);
+    ++ pimpl_->batch_frames;
+    pimpl_->batch_bytes += len;
+    pimpl_->batch_used += frame_len;
+    return 0;
+}
+
+// 迁移到在线调整大小所分配的新数据区：在写指针处写入迁移帧，此后在新的数据区写入。
+// 调用者须持有写入权，已经调用 enter_readers()，并且读者已经读完写指针处的帧。
+void writer::migrate()
+{
+    struct mem_region* rg = buf_->pimpl_->pending_region.exchange(nullptr);
+    if(!rg)
+    {
+        return;
+    }
+    struct mem_region* old = buf_->pimpl_->region;
+    old->next = rg;
+
+    // 写指针处总能容纳一个帧头。
+    struct frame_header* hdr = reinterpret_cast<struct frame_header*>(buf_->cur_);
+    hdr->serial = buf_->serial_;
+    hdr->len = 0;
+    hdr->start_offset = 0;
+    hdr->flags = JGB_FRAME_MIGRATE;
+    hdr->timestamp = 0L;
+
+    // 尚未初始化的读者直接从新的数据区开始读取。
+    for(auto& reader : pimpl_->readers)
+    {
+        if(reader->cur_.load())
+        {
+            ack_reader(reader, 0);
+        }
+    }
+    ++ buf_->serial_;
+
+    rg->serial = buf_->serial_;
+    // 帧索引只包含当前数据区的帧。
+    buf_->pimpl_->index_head = buf_->pimpl_->index_tail;
+    buf_->pimpl_->old_regions.push_back(old);
+    buf_->pimpl_->region = rg;
+    buf_->start_ = rg->start;
+    buf_->end_ = rg->end;
+    buf_->len_ = rg->len;
+    buf_->cur_ = rg->start;
+    buf_->pimpl_->pub_cur = rg->start;
+    buf_->pimpl_->oldest = rg->start;
+    buf_->pimpl_->oldest_serial = buf_->serial_;
+    if(buf_->numa_node_ == buffer::numa_local)
+    {
+        buf_->pimpl_->mem_placed.store(false);
+    }
+
+    jgb_info("buf migrated. { id = %s, size = %d, old size = %d, serial = %u }",
+             buf_->id().c_str(), rg->len, old->len, rg->serial);
+}
+
+// 释放所有读者都已离开的旧数据区。读者随迁移帧依次经过各个数据区，所以按迁移的先后释放。
+// 调用者须持有写入权，并且已经调用 enter_readers()。
+static void reclaim_regions(writer* wr)
+{
+    std::list<struct mem_region*>& regions = wr->buf_->pimpl_->old_regions;
+    while(!regions.empty())
+    {
+        struct mem_region* rg = regions.front();
+        if(region_pinned(wr->buf_, rg))
+        {
+            return;
+        }
+        for(auto& reader : wr->pimpl_->readers)
+        {
+            // 读者离开数据区之后才移动读指针，此后不再访问该数据区。
+            uint8_t* cur = reader->cur_.load(std::memory_order_acquire);
+            if(cur >= rg->start && cur < rg->end)
+            {
+                return;
+            }
+        }
+        regions.pop_front();
+        jgb_debug("free old buffer region. { id = %s, size = %d }", wr->buf_->id().c_str(), rg->len);
+        free_region(rg);
+    }
+}
+
+// 在写指针处写入填充帧，直到 to，跳过其间被句柄引用的帧；to 之后的位置可能仍然不足以容纳新帧。
+// 调用者须持有写入权，并且已经调用 enter_readers()。填充帧只覆盖被引用的帧的帧头，不覆盖其数据。
+int writer::skip_pinned(uint8_t* to, int timeout)
+{
+    jgb_assert(to > buf_->cur_ && to <= buf_->end_);
+    reserved_len_ = to - buf_->cur_;
+    int r = wait_readers_scenario_1(timeout);
+    if(r)
+    {
+        return r;
+    }
+
+    index_drop(buf_, buf_->cur_ - buf_->start_, to - buf_->start_);
+    struct frame_header* hdr = reinterpret_cast<struct frame_header*>(buf_->cur_);
+    hdr->serial = buf_->serial_;
+    hdr->len = 0;
+    hdr->start_offset = reserved_len_ - sizeof(struct frame_header);
+    hdr->flags = JGB_FRAME_PAD;
+    hdr->timestamp = 0L;
+    ack_readers(0);
+    ++ buf_->serial_;
+
+    buf_->cur_ = to;
+    if(buf_->cur_ + sizeof(struct frame_header) > buf_->end_)
+    {
+        buf_->cur_ = buf_->start_;
+    }
+    jgb_debug("skip pinned frame. { buf id = %s, len = %d }", buf_->id().c_str(), reserved_len_);
+    return 0;
+}
+
+// 多写者模式：记录从 start 开始、长度为 len 的已申请的缓冲区，并将写指针移动到其后。
+// redirect 为 true 时记录绕回时写入的重定向帧，不移动写指针。调用者须持有 mp_mutex。
+void writer::add_reservation(uint8_t* start, int len, bool redirect)
+{
+    std::list<struct reservation>& rs = buf_->pimpl_->reservations;
+    rs.push_back({start, len, redirect ? 1 : 0, 0, redirect, redirect});
+    if(redirect)
+    {
+        return;
+    }
+
+    pimpl_->res = &rs.back();
+    buf_->cur_ = start + len;
+    if(buf_->cur_ + sizeof(struct frame_header) > buf_->end_)
+    {
+        buf_->cur_ = buf_->start_;
+    }
+}
+
+// 多写者模式：提交已申请的缓冲区，其中已写入 frames 帧、共 used 字节（包括帧头），载荷共 bytes 字节，
+// last 为最后一帧。剩余的空间用填充帧或者最后一帧的填充占满，读者据此移动到下一个缓冲区。
+// 之前申请的缓冲区都已提交时，依次发布。
+void writer::commit_reservation(int used, int frames, int bytes, uint8_t* last)
+{
+    struct reservation* res = pimpl_->res;
+    int left = res->len - used;
+    if(left >= static_cast<int>(sizeof(struct frame_header)))
+    {
+        struct frame_header* hdr = reinterpret_cast<struct frame_header*>(res->start + used);
+        hdr->serial = 0;
+        hdr->len = 0;
+        hdr->start_offset = left - sizeof(struct frame_header);
+        hdr->flags = JGB_FRAME_PAD;
+        hdr->timestamp = 0L;
+        ++ frames;
+    }
+    else if(left > 0)
+    {
+        jgb_assert(last);
+        reinterpret_cast<struct frame_header*>(last)->flags |= (left / 4) << JGB_FRAME_PAD_SHIFT;
+    }
+
+    boost::unique_lock<boost::mutex> mp_lock(buf_->pimpl_->mp_mutex);
+    res->frames = frames;
+    res->bytes = bytes;
+    res->done = true;
+    pimpl_->res = nullptr;
+
+    enter_readers();
+    publish_reservations();
+    leave_readers();
+}
+
+// 多写者模式：按申请的先后发布已提交的缓冲区，遇到尚未提交的缓冲区为止。
+// 帧序号、提交时间在发布时确定，所以读者看到的帧序号、提交时间都是递增的。
+// 调用者须持有 mp_mutex，并且已经调用 enter_readers()。
+void writer::publish_reservations()
+{
+    buffer::Impl* impl = buf_->pimpl_.get();
+    std::list<struct reservation>& rs = impl->reservations;
+    bool published = false;
+    int64_t now = frame_clock();
+    while(!rs.empty() && rs.front().done)
+    {
+        struct reservation& res = rs.front();
+        uint8_t* p = res.start;
+        for(int i=0; i<res.frames; i++)
+        {
+            struct frame_header* hdr = reinterpret_cast<struct frame_header*>(p);
+            hdr->serial = buf_->serial_ + i;
+            if(hdr->len)
+            {
+                hdr->timestamp = now;
+                index_add(buf_, hdr);
+            }
+            p += hdr->total_len();
+        }
+
+        // 通知读者之前，ack_reader() 以 pub_cur、buffer::serial_ 初始化读者。
+        ack_readers(res.bytes, res.frames);
+        buf_->serial_ += res.frames;
+
+        if(res.redirect)
+        {
+            impl->pub_cur = buf_->start_;
+        }
+        else
+        {
+            impl->pub_cur = res.start + res.len;
+            if(impl->pub_cur + sizeof(struct frame_header) > buf_->end_)
+            {
+                impl->pub_cur = buf_->start_;
+            }
+        }
+        rs.pop_front();
+        published = true;
+    }
+
+    if(published)
+    {
+        impl->mp_cond.notify_all();
+    }
+}
+
+// 为长度为 frame_len（包括帧头、填充）的连续缓冲区等待读者，成功时缓冲区从 buf_->cur_ 开始。
+int writer::reserve(int frame_len, int timeout)
+{
+    uint8_t* next;
+    int r;
+
+    if(!buf_->cur_)
+    {
+        jgb_warning("缓冲区未初始化。{ buf id = %s }", buf_->id().c_str());
+        return JGB_ERR_FAIL;
+    }
+
+    if(timeout < 0)
+    {
+        timeout = 0;
+    }
+
+    boost::shared_lock<boost::shared_mutex> buf_lock(buf_->pimpl_->rw_mutex, boost::defer_lock);
+    if(!buf_->lock_free_)
+    {
+        pimpl_->mutex.lock();
+
+        buf_lock.lock();
+        r = acquire_buffer_ownership(timeout);
+        if(r)
+        {
+            pimpl_->mutex.unlock();
+            return r;
+        }
+    }
+
+    // 在提交已申请的缓冲区之前重复请求分配缓冲区。
+    if(reserved_len_ > 0)
+    {
+        jgb_warning("存在未提交的已分配的缓冲区。 { buf id = %s, reserved_len_ = %d, writer = %p }",
+                    buf_->id().c_str(), reserved_len_, this);
+        if(!buf_->lock_free_)
+        {
+            release_buffer_ownership();
+            pimpl_->mutex.unlock();
+        }
+        return JGB_ERR_DENIED;
+    }
+
+    // 在写者线程所在的 NUMA 节点放置缓冲区。此时持有写入权，读者尚不可能访问新分配的内存。
+    if(buf_->numa_node_ == buffer::numa_local
+        && !buf_->pimpl_->mem_placed.load(std::memory_order_relaxed)
+        && !buf_->pimpl_->mem_placed.exchange(true))
+    {
+        buf_->pimpl_->region->locked = place_memory(buf_, buf_->start_, buf_->len_, current_numa_node());
+    }
+
+    struct shm_header* shm_hdr = get_shm(buf_);
+    if(shm_hdr)
+    {
+        r = shm_lock_writer(shm_hdr, timeout);
+        if(r)
+        {
+            ++ stat_timeout_;
+            release_buffer_ownership();
+            pimpl_->mutex.unlock();
+            return r;
+        }
+        // 其他进程的写者可能已经写入。
+        buf_->cur_ = buf_->start_ + shm_hdr->wr_off.load();
+        buf_->serial_ = shm_hdr->serial.load();
+    }
+
+    // 先清空 eventfd，再检查读者：此后读者释放帧时写入 eventfd。
+    if(buf_->pimpl_->wr_efd.load(std::memory_order_relaxed) >= 0)
+    {
+        rearm_event(buf_->pimpl_->wr_efd, buf_->pimpl_->wr_efd_armed);
+    }
 
-    if(!buf || len <= 0)
+    enter_readers();
+
+    // 多写者模式：mp_lock 保护已申请的缓冲区、帧索引，在等待读者之后加锁。
+    // 申请成功后释放写入权，其他写者即可申请。
+    boost::unique_lock<boost::mutex> mp_lock(buf_->pimpl_->mp_mutex, boost::defer_lock);
+    auto reserved = [this, &mp_lock]()
     {
-        jgb_warning("Invalid arguments. { buf = %p, requested len = %d }", buf, len);
-        return JGB_ERR_INVALID;
+        leave_readers();
+        if(mp_lock.owns_lock())
+        {
+            mp_lock.unlock();
+            release_buffer_ownership();
+        }
+        return 0;
+    };
+
+    // 在线调整大小：先在帧边界迁移到新的数据区。
+    // 多写者模式下，须等待已申请的缓冲区全部发布，之后再迁移。
+    if(buf_->pimpl_->pending_region.load(std::memory_order_relaxed) && reservations_idle(buf_))
+    {
+        // 迁移帧写在写指针处，须等待读者读完写指针处的帧。
+        reserved_len_ = sizeof(struct frame_header);
+        r = buf_->leaky_ ? 0 : wait_readers_scenario_1(timeout);
+        if(r)
+        {
+            leave_readers();
+            end_request();
+            return r;
+        }
+        drop_frames(buf_, buf_->cur_, buf_->cur_ + sizeof(struct frame_header));
+        migrate();
     }
+    reclaim_regions(this);
 
     if(frame_len > buf_->len_)
     {
         jgb_warning("缓冲区容量不足。{ buf id = %s, buf size = %d, requested len = %d }",
                     buf_->id().c_str(), buf_->len_,
-                    len);
+                    frame_len);
+        leave_readers();
+        end_request();
         return JGB_ERR_LIMIT;
     }
 
-    if(!buf_->cur_)
+    // 写者跳过被句柄引用的帧之后重新检查，参考 frame_handle。
+    boost::chrono::steady_clock::time_point deadline = boost::chrono::steady_clock::now()
+        + boost::chrono::milliseconds(timeout);
+    int skipped = 0;
+    while(true)
     {
-        jgb_warning("缓冲区未初始化。{ buf id = %s }", buf_->id().c_str());
-        return JGB_ERR_FAIL;
-    }
+        next = buf_->cur_ + frame_len;
+        reserved_len_ = frame_len;
+        // 场景1：从写指针到缓冲区末尾的空间足以容纳新帧。
+        // leaky 模式下不等待读者。
+        if(next <= buf_->end_)
+        {
+            r = buf_->leaky_ ? 0 : wait_readers_scenario_1(timeout);
+            uint8_t* pin_end;
+            if(!r && find_pin(buf_, buf_->cur_, next, &pin_end))
+            {
+                // 被引用的帧占满缓冲区时，无法容纳新帧。
+                skipped += pin_end - buf_->cur_;
+                if(skipped > buf_->len_ || pinned_len(buf_) + frame_len > buf_->len_)
+                {
+                    jgb_warning("被句柄引用的帧过多，缓冲区容量不足。{ buf id = %s, requested len = %d }",
+                                buf_->id().c_str(), frame_len);
+                    r = JGB_ERR_LIMIT;
+                    break;
+                }
+                r = skip_pinned(pin_end, remaining_ms(deadline));
+                if(!r)
+                {
+                    timeout = remaining_ms(deadline);
+                    continue;
+                }
+            }
+            else if(!r)
+            {
+                if(buf_->multi_writer_)
+                {
+                    mp_lock.lock();
+                }
+                drop_frames(buf_, buf_->cur_, next);
+                index_drop(buf_, buf_->cur_ - buf_->start_, next - buf_->start_);
+                if(buf_->multi_writer_)
+                {
+                    add_reservation(buf_->cur_, frame_len, false);
+                }
+                return reserved();
+            }
+        }
+        else
+        {
+            next = buf_->start_ + frame_len;
+            // 场景2：从缓冲区开始到写指针的空间足以容纳新帧。
+            if(next <= buf_->cur_)
+            {
+                r = buf_->leaky_ ? 0 : wait_readers_scenario_2(timeout);
+                if(!r)
+                {
+                    if(buf_->multi_writer_)
+                    {
+                        mp_lock.lock();
+                    }
+                    drop_frames(buf_, buf_->cur_, buf_->end_);
+                    drop_frames(buf_, buf_->start_, next);
+                    if(buf_->cur_ + sizeof(struct frame_header) <= buf_->end_)
+                    {
+                        // 填写重定向帧
+                        struct frame_header* hdr = reinterpret_cast<struct frame_header*>(buf_->cur_);
+                        hdr->serial = buf_->serial_;
+                        hdr->len = 0;
+                        hdr->start_offset = 0;
+                        hdr->flags = 0;
+                        hdr->timestamp = 0L;
 
-    if(timeout < 0)
-    {
-        timeout = 0;
+                        if(buf_->multi_writer_)
+                        {
+                            // 在之前申请的缓冲区之后发布。
+                            add_reservation(buf_->cur_, sizeof(struct frame_header), true);
+                        }
+                        else
+                        {
+                            // TODO：此时需要通知读者吗？
+                            ack_readers(0);
+                            ++ buf_->serial_;
+                        }
+                        //jgb_debug("buf_ %p, writer %p, cur %p, 重定向帧", buf_, this, cur_);
+                    }
+
+                    // 写指针之后的帧不再可达。
+                    index_drop(buf_, buf_->cur_ - buf_->start_, buf_->len_);
+                    index_drop(buf_, 0, next - buf_->start_);
+                    buf_->cur_ = buf_->start_;
+                    if(find_pin(buf_, buf_->start_, next, nullptr))
+                    {
+                        timeout = remaining_ms(deadline);
+                        continue;
+                    }
+                    if(buf_->multi_writer_)
+                    {
+                        add_reservation(buf_->cur_, frame_len, false);
+                        publish_reservations();
+                    }
+                    return reserved();
+                }
+            }
+            // 场景3：从缓冲区开始的空间足以容纳新帧，但超过了写指针。
+            else
+            {
+                r = buf_->leaky_ ? 0 : wait_readers_scenario_3(timeout);
+                if(!r)
+                {
+                    if(buf_->multi_writer_)
+                    {
+                        mp_lock.lock();
+                    }
+                    drop_frames(buf_, buf_->start_, buf_->end_);
+                    buf_->pimpl_->oldest = buf_->start_;
+                    buf_->pimpl_->recover_cur = nullptr;
+                    // 重置所有读者的读取位置。
+                    // 所有读者均为空，读者不会同时修改读指针。
+                    if(shm_hdr)
+                    {
+                        for(int i=0; i<JGB_SHM_MAX_READERS; i++)
+                        {
+                            struct shm_slot& slot = shm_hdr->slots[i];
+                            uint64_t pos = shm_pos(buf_->serial_, buf_->cur_ - buf_->start_);
+                            slot.pos.compare_exchange_strong(pos, shm_pos(buf_->serial_, 0));
+                        }
+                    }
+                    // 尚未读完旧数据区的读者，之后随迁移帧转到当前数据区的开始位置。
+                    // leaky 模式下只移动位于写指针处的读者，其他读者读指针处的帧已被丢弃。
+                    for(auto& reader : pimpl_->readers)
+                    {
+                        uint8_t* cur = reader->cur_.load(std::memory_order_relaxed);
+                        if(cur && !in_old_region(buf_, cur))
+                        {
+                            if(!buf_->leaky_)
+                            {
+                                reader->cur_.store(buf_->start_, std::memory_order_relaxed);
+                            }
+                            else if(cur == buf_->cur_)
+                            {
+                                reader->cur_.compare_exchange_strong(cur, buf_->start_);
+                            }
+                        }
+                    }
+
+                    buf_->pimpl_->index_head = buf_->pimpl_->index_tail;
+                    buf_->cur_ = buf_->start_;
+                    if(find_pin(buf_, buf_->start_, next, nullptr))
+                    {
+                        timeout = remaining_ms(deadline);
+                        continue;
+                    }
+                    if(buf_->multi_writer_)
+                    {
+                        // 已经没有尚未发布的缓冲区。
+                        buf_->pimpl_->pub_cur = buf_->start_;
+                        add_reservation(buf_->cur_, frame_len, false);
+                    }
+                    return reserved();
+                }
+            }
+        }
+        break;
     }
 
-    pimpl_->mutex.lock();
+    leave_readers();
+    end_request();
+    return r;
+}
 
-    boost::shared_lock<boost::shared_mutex> buf_lock(buf_->pimpl_->rw_mutex);
-    r = acquire_buffer_ownership(timeout);
-    if(r)
+// 根据读者的通知策略，判断提交 frames 帧、共 len 字节后是否需要通知读者。
+// 只统计读者等待期间提交的帧；读者未在等待时，无需通知。
+static bool should_notify(reader* rd, int len, int frames)
+{
+    reader::Impl* impl = rd->pimpl_.get();
+    if(!impl->rd_waiting.load())
     {
-        pimpl_->mutex.unlock();
-        return r;
+        impl->pending_frames = 0;
+        impl->pending_bytes = 0L;
+        return false;
     }
 
-    // 在提交已申请的缓冲区之前重复请求分配缓冲区。
-    if(reserved_len_ > 0)
+    impl->pending_frames += frames;
+    impl->pending_bytes += len;
+    if(impl->pending_frames >= rd->notify_frames_
+        || (rd->notify_bytes_ > 0 && impl->pending_bytes >= rd->notify_bytes_))
     {
-        jgb_warning("存在未提交的已分配的缓冲区。 { buf id = %s, reserved_len_ = %d, writer = %p }",
-                    buf_->id().c_str(), reserved_len_, this);
-        release_buffer_ownership();
-        pimpl_->mutex.unlock();
-        return JGB_ERR_DENIED;
+        impl->pending_frames = 0;
+        impl->pending_bytes = 0L;
+        return true;
     }
+    return false;
+}
 
-    next = buf_->cur_ + frame_len;
-    reserved_len_ = frame_len;
-    // 场景1：从写指针到缓冲区末尾的空间足以容纳新帧。
-    if(next <= buf_->end_)
+void writer::ack_reader(reader* rd, int len, int frames)
+{
+    if(reader_use_lock(rd))
     {
-        r = wait_readers_scenario_1(timeout);
-        if(!r)
+        boost::unique_lock<boost::mutex> rd_lock(rd->pimpl_->mutex);
+        if(!rd->cur_)
         {
-            *buf = buf_->cur_ + sizeof(struct frame_header);
-            requested_len_ = len;
-            return 0;
+            jgb_assert(!rd->stored_);
+            rd->cur_ = publish_cur(buf_);
+            rd->serial_ = buf_->serial_;
+            rd->pimpl_->rgn = buf_->pimpl_->region;
         }
-        reserved_len_ = 0;
-        release_buffer_ownership();
-        pimpl_->mutex.unlock();
-        return r;
+        rd->stored_ += frames;
+        bool notify = should_notify(rd, len, frames);
+        rd_lock.unlock();
+        if(notify)
+        {
+            rd->pimpl_->wr_commit_cond.notify_one();
+        }
+        signal_event(rd->pimpl_->efd, rd->pimpl_->efd_armed);
     }
     else
     {
-        next = buf_->start_ + frame_len;
-        // 场景2：从缓冲区开始到写指针的空间足以容纳新帧。
-        if(next <= buf_->cur_)
+        // 读者只在 stored_ 大于 0 时访问读指针，所以可以在增加 stored_ 之前初始化读指针。
+        if(!rd->cur_.load(std::memory_order_relaxed))
         {
-            r = wait_readers_scenario_2(timeout);
-            if(!r)
-            {
-                if(buf_->cur_ + sizeof(struct frame_header) <= buf_->end_)
-                {
-                    // 填写重定向帧
-                    struct frame_header* hdr = reinterpret_cast<struct frame_header*>(buf_->cur_);
-                    hdr->serial = buf_->serial_;
-                    hdr->len = 0;
-                    hdr->start_offset = 0;
-                    hdr->unused = 0;
-
-                    // TODO：此时需要通知读者吗？
-                    ack_readers();
-                    ++ buf_->serial_;
-                    //jgb_debug("buf_ %p, writer %p, cur %p, 重定向帧", buf_, this, cur_);
-                }
-
-                buf_->cur_ = buf_->start_;
-                *buf = buf_->cur_ + sizeof(struct frame_header);
-                requested_len_ = len;
-                return 0;
-            }
-            reserved_len_ = 0;
-            release_buffer_ownership();
-            pimpl_->mutex.unlock();
-            return r;
+            jgb_assert(!rd->stored_);
+            rd->cur_.store(publish_cur(buf_), std::memory_order_relaxed);
+            rd->serial_ = buf_->serial_;
+            rd->pimpl_->rgn = buf_->pimpl_->region;
         }
-        // 场景3：从缓冲区开始的空间足以容纳新帧，但超过了写指针。
-        else
+        rd->stored_ += frames;
+        if(should_notify(rd, len, frames))
         {
-            r = wait_readers_scenario_3(timeout);
-            if(!r)
             {
-                // 重置所有读者的读取位置。
-                for(auto& reader : buf_->readers_)
-                {
-                    reader->cur_ = buf_->start_;
-                }
-
-                buf_->cur_ = buf_->start_;
-                *buf = buf_->cur_ + sizeof(struct frame_header);
-                requested_len_ = len;
-                return 0;
+                boost::unique_lock<boost::mutex> rd_lock(rd->pimpl_->mutex);
             }
-            reserved_len_ = 0;
-            release_buffer_ownership();
-            pimpl_->mutex.unlock();
-            return r;
+            rd->pimpl_->wr_commit_cond.notify_one();
         }
+        signal_event(rd->pimpl_->efd, rd->pimpl_->efd_armed);
     }
 }
 
-void writer::ack_reader(reader* rd)
+// 文件模式：提交后记录写指针及最慢的读者的读取位置。
+// 在 leave_readers() 之前调用，读者列表不变；读者尚未读取的帧不会被覆盖，读指针处的帧序号有效。
+static void file_sync(writer* wr)
 {
-    boost::unique_lock<boost::mutex> rd_lock(rd->pimpl_->mutex);
-    if(!rd->cur_)
+    buffer* buf = wr->buf_;
+    struct file_header* fh = buf->pimpl_->file;
+    if(!fh)
     {
-        jgb_assert(!rd->stored_);
-        rd->cur_ = buf_->cur_;
-        rd->serial_ = buf_->serial_;
+        return;
     }
-    ++ rd->stored_;
-    rd_lock.unlock();
-    // TODO：允许设置通知阈值，以减少通知次数。
-    rd->pimpl_->wr_commit_cond.notify_one();
+
+    uint64_t wr_pos = shm_pos(buf->serial_, buf->cur_ - buf->start_);
+    uint64_t rd_pos = wr_pos;
+    uint32_t lag = 0;
+    for(auto& rd : wr->pimpl_->readers)
+    {
+        uint8_t* cur = rd->cur_.load();
+        if(!cur || cur == buf->cur_)
+        {
+            continue;
+        }
+        // 读者释放帧时先移动读指针，再减少 stored_，所以根据读指针处的帧确定帧序号。
+        uint32_t serial = reinterpret_cast<struct frame_header*>(cur)->serial;
+        if(buf->serial_ - serial > lag)
+        {
+            lag = buf->serial_ - serial;
+            rd_pos = shm_pos(serial, cur - buf->start_);
+        }
+    }
+    fh->rd_pos.store(rd_pos);
+    fh->wr_pos.store(wr_pos);
 }
 
-void writer::ack_readers()
+void writer::ack_readers(int len, int frames)
 {
-    for(auto& reader : buf_->readers_)
+    struct shm_header* hdr = get_shm(buf_);
+    if(hdr)
+    {
+        // 读者根据共享内存中的帧序号计算可读帧数，只需设置尚未确定的读取位置。
+        uint64_t pos = shm_pos(buf_->serial_, buf_->cur_ - buf_->start_);
+        for(int i=0; i<JGB_SHM_MAX_READERS; i++)
+        {
+            struct shm_slot& slot = hdr->slots[i];
+            uint64_t none = JGB_SHM_POS_NONE;
+            if(slot.state.load() == shm_slot_used)
+            {
+                slot.pos.compare_exchange_strong(none, pos);
+            }
+        }
+        return;
+    }
+
+    for(auto& reader : pimpl_->readers)
     {
-        ack_reader(reader);
+        ack_reader(reader, len, frames);
     }
 }
 
@@ -825,37 +4616,109 @@ int writer::cancel()
     return commit(0);
 }
 
-int writer::commit(int len, int start_offset)
+// 完整性校验：计算载荷的 CRC32C，保存在载荷之后。
+static void write_crc(struct frame_header* hdr)
+{
+    hdr->flags |= JGB_FRAME_CRC;
+    uint32_t crc = crc32c(reinterpret_cast<uint8_t*>(hdr) + sizeof(struct frame_header) + hdr->start_offset, hdr->len);
+    memcpy(hdr->crc_pos(), &crc, sizeof(crc));
+}
+
+// 压缩模式：原地压缩长度为 len 的载荷，返回压缩后的长度（包括原始长度），并设置 JGB_FRAME_LZ4。
+// 载荷较短或者压缩后不能更短时不压缩，返回 len。
+static int compress_frame(writer* wr, uint8_t* payload, int len, int* flags)
+{
+#ifdef JGB_HAVE_LZ4
+    if(len < JGB_LZ4_MIN_LEN)
+    {
+        return len;
+    }
+    std::vector<uint8_t>& src = wr->pimpl_->lz4_src;
+    src.assign(payload, payload + len);
+    // 至少节省 4 字节，即对齐后的帧更短。
+    int n = LZ4_compress_default(reinterpret_cast<const char*>(src.data()),
+                                 reinterpret_cast<char*>(payload) + sizeof(uint32_t),
+                                 len, len - 2 * sizeof(uint32_t));
+    if(n <= 0)
+    {
+        return len;
+    }
+    uint32_t raw_len = len;
+    memcpy(payload, &raw_len, sizeof(raw_len));
+    *flags |= JGB_FRAME_LZ4;
+    n += sizeof(uint32_t);
+    wr->stat_bytes_compressed_ += n;
+    return n;
+#else
+    (void) wr;
+    (void) payload;
+    (void) flags;
+    return len;
+#endif
+}
+
+int writer::commit(int len, int start_offset, int flags)
 {
-    boost::shared_lock<boost::shared_mutex> buf_lock(buf_->pimpl_->rw_mutex);
+    boost::shared_lock<boost::shared_mutex> buf_lock(buf_->pimpl_->rw_mutex, boost::defer_lock);
+    if(!buf_->lock_free_)
+    {
+        buf_lock.lock();
+    }
     if(reserved_len_ > 0)
     {
-        if(!check_buffer_ownership())
+        // 多写者模式下不持有写入权，而是持有已申请的缓冲区。
+        if(buf_->multi_writer_ ? !pimpl_->res : (!buf_->lock_free_ && !check_buffer_ownership()))
         {
             return JGB_ERR_INVALID;
         }
 
         // TODO: 如果确认拥有 pimpl_->mutex ？
 
+        if(pimpl_->batch && len)
+        {
+            jgb_warning("批量缓冲区须使用 commit_batch() 提交。");
+            return JGB_ERR_INVALID;
+        }
+
         if(len > 0
             && start_offset >= 0
-            && len + start_offset <= requested_len_)
+            && len + start_offset <= requested_len_
+            && !(flags & ~JGB_FRAME_USER_FLAGS))
         {
             //jgb_debug("serial = %d", buf_->serial_);
 
-            struct frame_header* hdr = reinterpret_cast<struct frame_header*>(buf_->cur_);
+            struct frame_header* hdr = reinterpret_cast<struct frame_header*>(writer_cur(this));
+            uint8_t* payload = reinterpret_cast<uint8_t*>(hdr) + sizeof(struct frame_header) + start_offset;
             hdr->serial = buf_->serial_;
-            hdr->len = len;
+            hdr->len = buf_->compress_ && !(flags & JGB_FRAME_LZ4) ? compress_frame(this, payload, len, &flags) : len;
             hdr->start_offset = start_offset;
-            hdr->unused = 0;
+            hdr->flags = flags;
+            hdr->timestamp = frame_clock();
+            if(buf_->crc_)
+            {
+                write_crc(hdr);
+            }
+
+            if(buf_->multi_writer_)
+            {
+                // 帧序号、提交时间在发布时确定。
+                commit_reservation(hdr->total_len(), 1, len, reinterpret_cast<uint8_t*>(hdr));
+                ++ stat_frames_written_;
+                stat_bytes_written_ += len;
+                end_request();
+                return 0;
+            }
 
             // 通知所有读者有新写入帧。
-            ack_readers();
+            enter_readers();
+            ack_readers(len);
+            index_add(buf_, hdr);
             //jgb_debug("{ buf %p, writer %p, cur %p, serial = %d, len = %d, commit %ld, reader num %u }",
             //          buf_, this, buf_->cur_, buf_->serial_,
             //          len, stat_frames_written_, buf_->readers_.size());
 
             // 因为 ack_readers() 引用 buf_->serial_，所以在 ack_readers() 返回后再更新 buf_->serial。
+            // 在 leave_readers() 之前更新帧序号及写指针，增加读者、移动读者时看到一致的状态。
             ++ buf_->serial_;
 
             buf_->cur_ += hdr->total_len();
@@ -865,13 +4728,13 @@ int writer::commit(int len, int start_offset)
                 //jgb_debug("writer return");
                 buf_->cur_ = buf_->start_;
             }
+            file_sync(this);
+            leave_readers();
 
             ++ stat_frames_written_;
             stat_bytes_written_ += len;
 
-            reserved_len_ = 0;
-            release_buffer_ownership();
-            pimpl_->mutex.unlock();
+            end_request();
 
             return 0; // 成功
         }
@@ -879,15 +4742,18 @@ int writer::commit(int len, int start_offset)
         {
             ++ stat_cancelled_;
 
-            reserved_len_ = 0;
-            release_buffer_ownership();
-            pimpl_->mutex.unlock();
+            if(buf_->multi_writer_)
+            {
+                commit_reservation(0, 0, 0, nullptr);
+            }
+
+            end_request();
 
             return 0;
         }
         else
         {
-            jgb_warning("Invalid arguments. { len=%d, start_offset=%d, requested_len=%d }", len, start_offset, requested_len_);
+            jgb_warning("Invalid arguments. { len=%d, start_offset=%d, requested_len=%d, flags=0x%x }", len, start_offset, requested_len_, flags);
             return JGB_ERR_INVALID;
         }
     }
@@ -898,8 +4764,101 @@ int writer::commit(int len, int start_offset)
     }
 }
 
+int writer::commit_batch()
+{
+    boost::shared_lock<boost::shared_mutex> buf_lock(buf_->pimpl_->rw_mutex, boost::defer_lock);
+    if(!buf_->lock_free_)
+    {
+        buf_lock.lock();
+    }
+    if(reserved_len_ <= 0 || !pimpl_->batch)
+    {
+        jgb_warning("没有已申请的批量缓冲区。");
+        return JGB_ERR_INVALID;
+    }
+    if(buf_->multi_writer_ ? !pimpl_->res : (!buf_->lock_free_ && !check_buffer_ownership()))
+    {
+        return JGB_ERR_INVALID;
+    }
+
+    int frames = pimpl_->batch_frames;
+    if(buf_->crc_)
+    {
+        for(int i=0, off=0; i<frames; i++)
+        {
+            struct frame_header* hdr = reinterpret_cast<struct frame_header*>(writer_cur(this) + off);
+            write_crc(hdr);
+            off += hdr->total_len();
+        }
+    }
+    if(!frames)
+    {
+        ++ stat_cancelled_;
+        if(buf_->multi_writer_)
+        {
+            commit_reservation(0, 0, 0, nullptr);
+        }
+        end_request();
+        return 0;
+    }
+
+    if(buf_->multi_writer_)
+    {
+        // 找到最后一帧，剩余的空间可能作为其填充。
+        uint8_t* last = pimpl_->res->start;
+        for(int i=1; i<frames; i++)
+        {
+            last += reinterpret_cast<struct frame_header*>(last)->total_len();
+        }
+        commit_reservation(pimpl_->batch_used, frames, pimpl_->batch_bytes, last);
+        stat_frames_written_ += frames;
+        stat_bytes_written_ += pimpl_->batch_bytes;
+        end_request();
+        return 0;
+    }
+
+    enter_readers();
+
+    // 各帧的提交时间相同。
+    int64_t now = frame_clock();
+    for(int off=0; off<pimpl_->batch_used; )
+    {
+        struct frame_header* hdr = reinterpret_cast<struct frame_header*>(buf_->cur_ + off);
+        hdr->timestamp = now;
+        index_add(buf_, hdr);
+        off += hdr->total_len();
+    }
+
+    // 一次扫描读者列表，通知所有读者有新写入的 frames 帧。
+    ack_readers(pimpl_->batch_bytes, frames);
+
+    buf_->serial_ += frames;
+
+    buf_->cur_ += pimpl_->batch_used;
+    jgb_assert(buf_->cur_ <= buf_->end_);
+    if(buf_->cur_ + sizeof(struct frame_header) > buf_->end_)
+    {
+        buf_->cur_ = buf_->start_;
+    }
+    file_sync(this);
+    leave_readers();
+
+    stat_frames_written_ += frames;
+    stat_bytes_written_ += pimpl_->batch_bytes;
+
+    end_request();
+
+    return 0; // 成功
+}
+
 int writer::put(uint8_t* buf, int len, int timeout)
 {
+    if(buf_->chunk_size_ > 0 && len > buf_->chunk_size_)
+    {
+        struct iovec iov = { buf, static_cast<size_t>(len) };
+        return putv(&iov, 1, timeout);
+    }
+
     int r;
     uint8_t* x_buf;
     r = request_buffer(&x_buf, len, timeout);
@@ -919,9 +4878,110 @@ int writer::put(uint8_t* buf, int len, int timeout)
     return r;
 }
 
+int writer::putv(const struct iovec* iov, int cnt, int timeout)
+{
+    int len = 0;
+    if(!iov || cnt <= 0)
+    {
+        jgb_warning("Invalid arguments. { iov = %p, cnt = %d }", iov, cnt);
+        return JGB_ERR_INVALID;
+    }
+    for(int i=0; i<cnt; i++)
+    {
+        if(iov[i].iov_len > static_cast<size_t>(INT_MAX - len))
+        {
+            return JGB_ERR_LIMIT;
+        }
+        len += iov[i].iov_len;
+    }
+
+    if(buf_->chunk_size_ > 0 && len > buf_->chunk_size_ && !buf_->shm_ && !buf_->multi_writer_)
+    {
+        return put_chunked(iov, cnt, len, timeout);
+    }
+
+    int r;
+    uint8_t* x_buf;
+    r = request_buffer(&x_buf, len, timeout);
+    if(!r)
+    {
+        // 各段数据直接复制到缓冲区，不需要先拼接。
+        uint8_t* p = x_buf;
+        for(int i=0; i<cnt; i++)
+        {
+            memcpy(p, iov[i].iov_base, iov[i].iov_len);
+            p += iov[i].iov_len;
+        }
+        r = commit(len, 0);
+        if(!r)
+        {
+            return 0;
+        }
+        else
+        {
+            jgb_assert(0);
+        }
+    }
+    return r;
+}
+
+// 各块依次申请、提交，timeout 为写入全部块的时长。
+// 写入最后一块之前保留写入权；中途失败时释放写入权，已写入的块由读者丢弃。
+int writer::put_chunked(const struct iovec* iov, int cnt, int len, int timeout)
+{
+    boost::chrono::steady_clock::time_point deadline = boost::chrono::steady_clock::now()
+        + boost::chrono::milliseconds(timeout);
+    int seg = 0;
+    size_t seg_off = 0;
+    for(int off=0; off<len; )
+    {
+        int n = std::min(buf_->chunk_size_, len - off);
+        uint8_t* x_buf;
+        // 申请失败时 end_request() 释放写入权。
+        pimpl_->chunk_hold = false;
+        int r = request_buffer(&x_buf, n, off ? remaining_ms(deadline) : timeout);
+        if(r)
+        {
+            return r;
+        }
+        // iov 的总长度不小于 len。
+        int copied = 0;
+        while(copied < n && seg < cnt)
+        {
+            size_t k = std::min(iov[seg].iov_len - seg_off, static_cast<size_t>(n - copied));
+            memcpy(x_buf + copied, static_cast<uint8_t*>(iov[seg].iov_base) + seg_off, k);
+            copied += k;
+            seg_off += k;
+            if(seg_off == iov[seg].iov_len)
+            {
+                ++ seg;
+                seg_off = 0;
+            }
+        }
+        jgb_assert(copied == n);
+        int flags = (off ? JGB_FRAME_CHUNK : 0) | (off + n < len ? JGB_FRAME_CONTINUED : 0);
+        off += n;
+        pimpl_->chunk_hold = off < len;
+        r = commit(n, 0, flags);
+        if(r)
+        {
+            // 取消提交时 end_request() 释放写入权。
+            pimpl_->chunk_hold = false;
+            cancel();
+            return r;
+        }
+    }
+    return 0;
+}
+
 int writer::fixed_header_size()
 {
     return sizeof(struct frame_header);
 }
 
+int writer::frame_size(int len)
+{
+    return JGB_ALIGN(len, 4) + sizeof(struct frame_header);
+}
+
 }
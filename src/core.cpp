@@ -304,10 +304,17 @@ int task::start()
             jgb_info("start task. { name = %s, id = %d }",
                       instance_->app_->name_.c_str(), instance_->id_);
 
-            init_io();
+            // 缓冲区分配失败时不启动任务。
+            int r = init_io();
+            if(r)
+            {
+                release_io();
+                jgb_fail("start task. { name = %s, id = %d, init_io() = %d }",
+                         instance_->app_->name_.c_str(), instance_->id_, r);
+                return r;
+            }
 
             // 启动任务
-            int r;
             run_ = true;
             if(workers_.size() != 1)
             {
@@ -417,6 +424,93 @@ int task::stop()
     }
 }
 
+// 将延迟直方图绑定到 conf/name。
+static void bind_histogram(config* conf, const char* name, latency_histogram* h)
+{
+    config* c = new config();
+    c->create("count", static_cast<int64_t>(0));
+    c->bind("count", &h->count_);
+    c->create("sum", static_cast<int64_t>(0));
+    c->bind("sum", &h->sum_);
+    c->create("max", static_cast<int64_t>(0));
+    c->bind("max", &h->max_);
+    value* v = new value(value::data_type::integer, latency_histogram::buckets, true);
+    v->bind(h->counts_);
+    v->valid_ = true;
+    c->create("buckets", v);
+    conf->create(name, c);
+}
+
+// 将读者的统计绑定到读者配置的 "stat"，可以通过配置树读取。
+static void bind_reader_stat(config* conf, reader* rd)
+{
+    conf->remove("stat");
+    config* c = new config();
+    c->create("frames_read", static_cast<int64_t>(0));
+    c->bind("frames_read", &rd->stat_frames_read_);
+    c->create("bytes_read", static_cast<int64_t>(0));
+    c->bind("bytes_read", &rd->stat_bytes_read_);
+    c->create("frames_discarded", static_cast<int64_t>(0));
+    c->bind("frames_discarded", &rd->stat_frames_discarded_);
+    c->create("bytes_discarded", static_cast<int64_t>(0));
+    c->bind("bytes_discarded", &rd->stat_bytes_discarded_);
+    c->create("frames_lost", static_cast<int64_t>(0));
+    c->bind("frames_lost", &rd->stat_frames_lost_);
+    c->create("crc_errors", static_cast<int64_t>(0));
+    c->bind("crc_errors", &rd->stat_crc_errors_);
+    c->create("timeout", static_cast<int64_t>(0));
+    c->bind("timeout", &rd->stat_timeout_);
+    // 单位纳秒，区间的划分参考 latency_histogram。
+    bind_histogram(c, "commit_latency", &rd->stat_commit_latency_);
+    bind_histogram(c, "hold_latency", &rd->stat_hold_latency_);
+    conf->create("stat", c);
+}
+
+// 后加入的读者从已提交的帧开始读取："latest"、"oldest"、最近的关键帧 "keyframe"，或者 seek_ms 毫秒之前。
+static void init_reader_seek(config* conf, reader* rd)
+{
+    int r;
+    int ms;
+    std::string seek;
+    if(!conf->get("seek_ms", ms))
+    {
+        r = rd->seek(reader::seek_time, frame_clock() - static_cast<int64_t>(ms) * 1000000);
+    }
+    else if(!conf->get("seek", seek))
+    {
+        if(seek == "latest")
+        {
+            r = rd->seek(reader::seek_latest);
+        }
+        else if(seek == "oldest")
+        {
+            r = rd->seek(reader::seek_oldest);
+        }
+        else if(seek == "keyframe")
+        {
+            r = rd->seek(reader::seek_flags, JGB_FRAME_KEYFRAME);
+        }
+        else if(seek == "next")
+        {
+            r = 0;
+        }
+        else
+        {
+            jgb_warning("invalid seek. { reader = %s, seek = %s }", rd->id_.c_str(), seek.c_str());
+            return;
+        }
+    }
+    else
+    {
+        return;
+    }
+
+    if(r)
+    {
+        jgb_warning("seek failed. { reader = %s, r = %d }", rd->id_.c_str(), r);
+    }
+}
+
 int task::init_io_readers()
 {
     int r;
@@ -435,31 +529,74 @@ int task::init_io_readers()
                 buffer* buf = buffer_manager::get_instance()->add_buffer(id);
                 if(buf)
                 {
+                    bool shm = false;
+                    val->conf_[i]->get("shm", shm);
+                    if(shm && !buf->len_)
+                    {
+                        // 读取其他进程创建的共享内存缓冲区。若尚未创建，读者在请求帧时重试。
+                        buf->shm_ = true;
+                        buf->attach();
+                    }
+
+                    // 读者的设置在加入缓冲区之前生效，参考 reader_options。
+                    reader_options opt;
+                    val->conf_[i]->get("discard", opt.discard);
+                    val->conf_[i]->get("discard_keyframe", opt.discard_keyframe);
+                    val->conf_[i]->get("notify_frames", opt.notify_frames);
+                    val->conf_[i]->get("notify_bytes", opt.notify_bytes);
+                    val->conf_[i]->get("notify_latency", opt.notify_latency);
+                    val->conf_[i]->get("spin", opt.spin);
+                    val->conf_[i]->get("stat_latency", opt.stat_latency);
+
                     reader* rd;
                     bool sync_rd0 = false;
                     val->conf_[i]->get("sync_rd0", sync_rd0);
-                    if(sync_rd0 && !buf->readers_.empty())
+                    // 同一消费者组的读者分担帧，每一帧只交给其中一个读者。
+                    std::string group;
+                    val->conf_[i]->get("group", group);
+                    if(!group.empty())
+                    {
+                        // 组的成员不支持 discard 及 seek。
+                        value* seek;
+                        if(opt.discard || opt.discard_keyframe
+                           || !val->conf_[i]->get("seek", &seek) || !val->conf_[i]->get("seek_ms", &seek))
+                        {
+                            jgb_warning("discard、seek 不适用于消费者组的成员，已忽略。{ buf_id = %s, group = %s }",
+                                        id.c_str(), group.c_str());
+                        }
+                        rd = buf->add_group_reader(group);
+                        if(rd)
+                        {
+                            // 组的成员不在 readers_ 中，写者不访问成员的设置。
+                            rd->notify_frames_ = opt.notify_frames < 1 ? 1 : opt.notify_frames;
+                            rd->notify_bytes_ = opt.notify_bytes;
+                            rd->notify_latency_ = opt.notify_latency;
+                            rd->spin_ = opt.spin;
+                            rd->stat_latency_ = opt.stat_latency;
+                        }
+                    }
+                    else if(sync_rd0 && buf->first_reader())
                     {
-                        reader* rd0 = buf->readers_.front();
-                        rd = buf->add_reader(rd0);
+                        // 消费者组内部的读者不作为 rd0。
+                        reader* rd0 = buf->first_reader();
+                        rd = buf->add_reader(rd0, opt);
                     }
                     else
                     {
-                        rd = buf->add_reader();
+                        rd = buf->add_reader(opt);
                     }
                     if(rd)
                     {
                         rd->id_ = (boost::format("%1%:%2%.%3%") % instance_->app_->name_.c_str() % instance_->id_ % i).str();
-                        bool discard;
-                        r = val->conf_[i]->get("discard", discard);
-                        if(!r)
+                        if(rd->discard_)
                         {
-                            rd->discard_ = discard;
-                            if(discard)
-                            {
-                                jgb_notice("reader discard mode enabled. { buf_id = %s, reader = %s }", id.c_str(), rd->id_.c_str());
-                            }
+                            jgb_notice("reader discard mode enabled. { buf_id = %s, reader = %s }", id.c_str(), rd->id_.c_str());
                         }
+                        if(group.empty())
+                        {
+                            init_reader_seek(val->conf_[i], rd);
+                        }
+                        bind_reader_stat(val->conf_[i], rd);
                         readers_.push_back(rd);
                     }
                     jgb_assert(rd);
@@ -471,9 +608,94 @@ int task::init_io_readers()
     return 0;
 }
 
+// 读取缓冲区的内存选项。
+static void init_buffer_memory(buffer* buf, config* conf)
+{
+    std::string huge_pages;
+    if(!conf->get("huge_pages", huge_pages))
+    {
+        if(huge_pages == "transparent")
+        {
+            buf->huge_pages_ = buffer::huge_pages_transparent;
+        }
+        else if(huge_pages == "explicit")
+        {
+            buf->huge_pages_ = buffer::huge_pages_explicit;
+        }
+        else if(huge_pages != "none")
+        {
+            jgb_warning("invalid huge_pages. { buf_id = %s, huge_pages = %s }", buf->id_.c_str(), huge_pages.c_str());
+        }
+    }
+    conf->get("mlock", buf->mlock_);
+    conf->get("prefault", buf->prefault_);
+
+    std::string node;
+    if(!conf->get("numa_node", node))
+    {
+        if(node == "local")
+        {
+            buf->numa_node_ = buffer::numa_local;
+        }
+        else
+        {
+            jgb_warning("invalid numa_node. { buf_id = %s, numa_node = %s }", buf->id_.c_str(), node.c_str());
+        }
+    }
+    else
+    {
+        conf->get("numa_node", buf->numa_node_);
+    }
+}
+
+// 缓冲区已经分配：配置项 path 与缓冲区当前的选项 cur 不一致时告警。
+template<typename T>
+static void check_buffer_option(buffer* buf, config* conf, const char* path, const T& cur)
+{
+    T val;
+    if(!conf->get(path, val) && val != cur)
+    {
+        jgb_warning("缓冲区已经分配，忽略与之不一致的配置。{ buf_id = %s, option = %s }", buf->id_.c_str(), path);
+    }
+}
+
+int init_buffer(buffer* buf, config* conf, int len)
+{
+    if(buf->len_ > 0)
+    {
+        // 其他写者已经分配了缓冲区，读者、写者可能正在访问，不修改模式和大小。
+        if(len != buf->len_)
+        {
+            jgb_warning("缓冲区已经分配，忽略与之不一致的配置。{ buf_id = %s, buf_size = %d, size = %d }",
+                        buf->id_.c_str(), len, buf->len_);
+        }
+        check_buffer_option(buf, conf, "lock_free", buf->lock_free_);
+        check_buffer_option(buf, conf, "index_size", buf->index_size_);
+        check_buffer_option(buf, conf, "leaky", buf->leaky_);
+        check_buffer_option(buf, conf, "multi_writer", buf->multi_writer_);
+        check_buffer_option(buf, conf, "chunk_size", buf->chunk_size_);
+        check_buffer_option(buf, conf, "compress", buf->compress_);
+        check_buffer_option(buf, conf, "crc", buf->crc_);
+        check_buffer_option(buf, conf, "file", buf->file_);
+        return 0;
+    }
+
+    conf->get("lock_free", buf->lock_free_);
+    conf->get("index_size", buf->index_size_);
+    conf->get("leaky", buf->leaky_);
+    conf->get("multi_writer", buf->multi_writer_);
+    conf->get("chunk_size", buf->chunk_size_);
+    conf->get("compress", buf->compress_);
+    conf->get("crc", buf->crc_);
+    conf->get("file", buf->file_);
+    init_buffer_memory(buf, conf);
+    return buf->resize(len);
+}
+
 int task::init_io_writers()
 {
     int r;
+    int ret = 0;
     value* val;
 
     // 打开写者
@@ -495,11 +717,27 @@ int task::init_io_writers()
                         wr->id_ = (boost::format("%1%:%2%.%3%") % instance_->app_->name_.c_str() % instance_->id_ % i).str();
                         writers_.push_back(wr);
 
+                        if(!buf->len_)
+                        {
+                            val->conf_[i]->get("shm", buf->shm_);
+                        }
+
                         int sz;
                         r = val->conf_[i]->get("buf_size", sz);
                         if(!r)
                         {
-                            buf->resize(sz);
+                            r = init_buffer(buf, val->conf_[i], sz);
+                            if(r)
+                            {
+                                // 保留写者，以免改变其后的写者的序号；由 release_io() 关闭。
+                                jgb_fail("init buffer. { buf_id = %s, buf_size = %d, r = %d }", id.c_str(), sz, r);
+                                ret = r;
+                            }
+                        }
+                        else if(buf->shm_)
+                        {
+                            // 写入其他进程创建的共享内存缓冲区。
+                            buf->attach();
                         }
                     }
                     jgb_assert(wr);
@@ -508,18 +746,27 @@ int task::init_io_writers()
             }
         }
     }
-    return 0;
+    return ret;
 }
 
 int task::init_io()
 {
     init_io_readers();
-    init_io_writers();
-    return 0;
+    return init_io_writers();
 }
 
 void task::release_io()
 {
+    // 解除绑定到读者配置的统计。
+    value* val;
+    if(!instance_->conf_->get("task/readers", &val))
+    {
+        for(int i=0; i<val->len_; i++)
+        {
+            val->conf_[i]->remove("stat");
+        }
+    }
+
     // 关闭读者
     for(auto rd: readers_)
     {
@@ -29,6 +29,11 @@
 #include <string.h>
 #include <boost/chrono.hpp>
 #include <boost/thread/thread.hpp>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
 
 namespace jgb
 {
@@ -321,4 +326,107 @@ int path_get_part(const char** start, const char** end)
     return 0;
 }
 
+// CRC32C 的查表实现：每次处理 8 字节（slicing-by-8）。
+struct crc32c_tables
+{
+    uint32_t t[8][256];
+
+    crc32c_tables()
+    {
+        for(uint32_t i=0; i<256; i++)
+        {
+            uint32_t c = i;
+            for(int k=0; k<8; k++)
+            {
+                c = (c >> 1) ^ (0x82f63b78 & (0U - (c & 1)));
+            }
+            t[0][i] = c;
+        }
+        for(uint32_t i=0; i<256; i++)
+        {
+            for(int k=1; k<8; k++)
+            {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+static uint32_t crc32c_sw(uint32_t c, const uint8_t* p, size_t len)
+{
+    static const crc32c_tables tables;
+    const uint32_t (*t)[256] = tables.t;
+    while(len >= 8)
+    {
+        uint32_t lo;
+        uint32_t hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= c;
+        c = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+            ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while(len--)
+    {
+        c = (c >> 8) ^ t[0][(c ^ *p++) & 0xff];
+    }
+    return c;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t c, const uint8_t* p, size_t len)
+{
+    uint64_t c64 = c;
+    while(len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c64 = _mm_crc32_u64(c64, v);
+        p += 8;
+        len -= 8;
+    }
+    c = static_cast<uint32_t>(c64);
+    while(len--)
+    {
+        c = _mm_crc32_u8(c, *p++);
+    }
+    return c;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_hw(uint32_t c, const uint8_t* p, size_t len)
+{
+    while(len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = __crc32cd(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while(len--)
+    {
+        c = __crc32cb(c, *p++);
+    }
+    return c;
+}
+#endif
+
+uint32_t crc32c(const void* data, size_t len, uint32_t crc)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+#if defined(__x86_64__)
+    static const bool hw = __builtin_cpu_supports("sse4.2");
+    if(hw)
+    {
+        return ~crc32c_hw(~crc, p, len);
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    return ~crc32c_hw(~crc, p, len);
+#endif
+    return ~crc32c_sw(~crc, p, len);
+}
+
 } // namespace jgb
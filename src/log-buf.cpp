@@ -96,6 +96,9 @@ static int init(void* conf)
         {
             buf = jgb::buffer_manager::get_instance()->add_buffer(buf_id);
             jgb_assert(buf);
+            // 使用文件时，进程重新启动后可以读取崩溃之前的日志。
+            c->get("file", buf->file_);
+            c->get("compress", buf->compress_);
             buf->resize(buf_size);
             wr = buf->add_writer();
             if(wr)
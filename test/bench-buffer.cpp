@@ -0,0 +1,267 @@
+#include <jgb/core.h>
+#include <jgb/helper.h>
+#include <jgb/buffer.h>
+#include <boost/thread.hpp>
+#include <atomic>
+#include <unistd.h>
+#include <vector>
+
+// 缓冲区吞吐量基准测试：各用例运行 duration 毫秒，统计写者、读者的帧数及字节数，结果以 JSON 输出到标准输出。
+// 用例分为三组：frame_size 改变帧长；readers 改变读者数量及读者是否 discard；writers 改变写者数量及是否 multi_writer。
+// 用法：bench-buffer [-d duration_ms] [-o output.json] [-q]，-q 只运行较少的用例。
+
+extern int jgb_log_print_level;
+
+struct bench_case
+{
+    const char* group;
+    int frame_size;
+    int readers;
+    int writers;
+    bool discard;
+    bool multi_writer;
+};
+
+struct bench_result
+{
+    double seconds;
+    int64_t frames_written;
+    int64_t bytes_written;
+    // 各读者之和。
+    int64_t frames_read;
+    int64_t bytes_read;
+    int64_t frames_discarded;
+    int64_t frames_lost;
+};
+
+static std::atomic<bool> bench_stop;
+static std::atomic<int> bench_ready;
+
+static void write_thread(jgb::writer* wr, int len)
+{
+    std::vector<uint8_t> data(len, 0x5a);
+    ++ bench_ready;
+    while(!bench_stop)
+    {
+        wr->put(data.data(), len, 100);
+    }
+}
+
+static void read_thread(jgb::reader* rd)
+{
+    struct jgb::frame frms[64];
+    int count;
+    uint8_t sum = 0;
+    ++ bench_ready;
+    while(!bench_stop)
+    {
+        if(!rd->request_frames(frms, 64, &count, 100))
+        {
+            // 读取载荷的第一个字节，计入访问内存的开销。
+            for(int i=0; i<count; i++)
+            {
+                sum += frms[i].buf[0];
+            }
+            rd->release(count);
+        }
+    }
+    (void) sum;
+}
+
+static void run_case(const bench_case& c, int duration, bench_result* res)
+{
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("bench");
+    std::vector<jgb::writer*> wrs;
+    for(int i=0; i<c.writers; i++)
+    {
+        wrs.push_back(buf->add_writer());
+    }
+    buf->multi_writer_ = c.multi_writer;
+    // 至少容纳 8 帧。
+    int len = std::max(4 << 20, 8 * jgb::writer::frame_size(c.frame_size) + jgb::writer::fixed_header_size());
+    buf->resize(len);
+    std::vector<jgb::reader*> rds;
+    for(int i=0; i<c.readers; i++)
+    {
+        rds.push_back(buf->add_reader(c.discard));
+    }
+
+    bench_stop = false;
+    bench_ready = 0;
+    boost::thread_group threads;
+    for(auto rd: rds)
+    {
+        threads.create_thread([rd]() { read_thread(rd); });
+    }
+    for(auto wr: wrs)
+    {
+        int sz = c.frame_size;
+        threads.create_thread([wr, sz]() { write_thread(wr, sz); });
+    }
+    while(bench_ready < c.readers + c.writers)
+    {
+        usleep(1000);
+    }
+
+    // 只统计 duration 期间的帧。
+    int64_t frames0 = 0;
+    int64_t bytes0 = 0;
+    buf->writer_stat(&frames0, &bytes0);
+    std::vector<int64_t> rd_frames0;
+    std::vector<int64_t> rd_bytes0;
+    std::vector<int64_t> rd_discarded0;
+    std::vector<int64_t> rd_lost0;
+    for(auto rd: rds)
+    {
+        rd_frames0.push_back(rd->stat_frames_read_);
+        rd_bytes0.push_back(rd->stat_bytes_read_);
+        rd_discarded0.push_back(rd->stat_frames_discarded_);
+        rd_lost0.push_back(rd->stat_frames_lost_);
+    }
+    int64_t t0 = jgb::frame_clock();
+    jgb::sleep(duration);
+    int64_t t1 = jgb::frame_clock();
+
+    *res = {};
+    res->seconds = (t1 - t0) / 1e9;
+    buf->writer_stat(&res->frames_written, &res->bytes_written);
+    res->frames_written -= frames0;
+    res->bytes_written -= bytes0;
+    for(size_t i=0; i<rds.size(); i++)
+    {
+        res->frames_read += rds[i]->stat_frames_read_ - rd_frames0[i];
+        res->bytes_read += rds[i]->stat_bytes_read_ - rd_bytes0[i];
+        res->frames_discarded += rds[i]->stat_frames_discarded_ - rd_discarded0[i];
+        res->frames_lost += rds[i]->stat_frames_lost_ - rd_lost0[i];
+    }
+
+    bench_stop = true;
+    threads.join_all();
+    for(auto rd: rds)
+    {
+        buf->remove_reader(rd);
+    }
+    for(auto wr: wrs)
+    {
+        buf->remove_writer(wr);
+    }
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+}
+
+static void add_cases(std::vector<bench_case>& cases, bool quick)
+{
+    const int sizes[] = { 16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576 };
+    for(int sz: sizes)
+    {
+        if(!quick || sz == 64 || sz == 4096 || sz == 1048576)
+        {
+            cases.push_back({ "frame_size", sz, 1, 1, false, false });
+        }
+    }
+
+    const int readers[] = { 1, 2, 4, 8, 16 };
+    const int rd_sizes[] = { 64, 4096, 65536 };
+    for(int sz: rd_sizes)
+    {
+        if(quick && sz != 4096)
+        {
+            continue;
+        }
+        for(int discard=0; discard<2; discard++)
+        {
+            for(int n: readers)
+            {
+                if(!quick || n == 1 || n == 16)
+                {
+                    cases.push_back({ "readers", sz, n, 1, !!discard, false });
+                }
+            }
+        }
+    }
+
+    const int writers[] = { 1, 2, 4, 8 };
+    const int wr_sizes[] = { 64, 4096 };
+    for(int sz: wr_sizes)
+    {
+        if(quick && sz != 4096)
+        {
+            continue;
+        }
+        for(int mw=0; mw<2; mw++)
+        {
+            for(int n: writers)
+            {
+                if(!quick || n == 1 || n == 4)
+                {
+                    cases.push_back({ "writers", sz, 1, n, false, !!mw });
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int duration = 200;
+    const char* output = nullptr;
+    bool quick = false;
+    int c;
+    while((c = getopt(argc, argv, "d:o:q")) != -1)
+    {
+        switch(c)
+        {
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'q':
+            quick = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d duration_ms] [-o output.json] [-q]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(duration <= 0)
+    {
+        duration = 200;
+    }
+    FILE* fp = output ? fopen(output, "w") : stdout;
+    if(!fp)
+    {
+        jgb_fail("open output failed. { output = %s }", output);
+        return 1;
+    }
+    // 调整缓冲区大小等日志不影响结果的解析。
+    jgb_log_print_level = JGB_LOG_WARNING;
+
+    std::vector<bench_case> cases;
+    add_cases(cases, quick);
+    fprintf(fp, "{\n  \"benchmark\": \"buffer\",\n  \"duration_ms\": %d,\n  \"cpus\": %ld,\n  \"results\": [",
+            duration, sysconf(_SC_NPROCESSORS_ONLN));
+    for(size_t i=0; i<cases.size(); i++)
+    {
+        const bench_case& bc = cases[i];
+        bench_result res;
+        run_case(bc, duration, &res);
+        fprintf(fp, "%s\n    { \"group\": \"%s\", \"frame_size\": %d, \"readers\": %d, \"writers\": %d, "
+                "\"discard\": %s, \"multi_writer\": %s, "
+                "\"frames_per_sec\": %.0f, \"bytes_per_sec\": %.0f, "
+                "\"read_frames_per_sec\": %.0f, \"read_bytes_per_sec\": %.0f, "
+                "\"frames_discarded\": %ld, \"frames_lost\": %ld }",
+                i ? "," : "", bc.group, bc.frame_size, bc.readers, bc.writers,
+                bc.discard ? "true" : "false", bc.multi_writer ? "true" : "false",
+                res.frames_written / res.seconds, res.bytes_written / res.seconds,
+                res.frames_read / res.seconds, res.bytes_read / res.seconds,
+                res.frames_discarded, res.frames_lost);
+        fflush(fp);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    if(fp != stdout)
+    {
+        fclose(fp);
+    }
+    return 0;
+}
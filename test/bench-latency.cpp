@@ -0,0 +1,394 @@
+#include <jgb/core.h>
+#include <jgb/helper.h>
+#include <jgb/buffer.h>
+#include <boost/thread.hpp>
+#include <atomic>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+// 提交到获取的延迟基准测试：写者按固定间隔提交帧（帧的 timestamp 为提交时间），
+// 各读者在 request_frame() 返回后读取时钟，差值计入直方图，输出 p50/p99/p99.9/max（纳秒）。
+// 用例为唤醒策略 × 读者数量 × 是否绑定 CPU，结果以 JSON 输出。
+// 可以单独运行（bench-latency），也可以作为应用 bench_latency 由 module.json 加载，运行一次后结束。
+
+struct latency_params
+{
+    int frames;       // 每个用例写入的帧数
+    int interval_us;  // 写者提交的间隔
+    int frame_size;
+    std::vector<std::string> policies;
+    std::vector<int> readers;
+    std::vector<bool> pins;
+    std::string output; // 为空时输出到标准输出
+
+    latency_params()
+        : frames(5000),
+        interval_us(100),
+        frame_size(64),
+        policies({ "notify", "spin", "poll", "eventfd", "batch" }),
+        readers({ 1, 4, 16 }),
+        pins({ false, true })
+    {
+    }
+};
+
+struct latency_run
+{
+    const latency_params* params;
+    std::string policy;
+    bool pin;
+    std::vector<jgb::reader*> rds;
+    std::vector<jgb::latency_histogram> hists;
+    std::atomic<int> ready;
+    std::atomic<int> done;
+    std::atomic<bool> stop;
+};
+
+// 绑定当前线程到第 idx 个 CPU（按在线 CPU 数取模）。
+static void pin_thread(int idx)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus > 0 ? idx % cpus : 0, &set);
+    int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(r)
+    {
+        jgb_warning("pthread_setaffinity_np. { cpu = %d, r = %d }", idx, r);
+    }
+}
+
+static void latency_reader(latency_run* run, int idx)
+{
+    if(run->pin)
+    {
+        // CPU 0 留给写者。
+        pin_thread(idx + 1);
+    }
+    jgb::reader* rd = run->rds[idx];
+    jgb::latency_histogram& h = run->hists[idx];
+    bool poll_mode = run->policy == "poll";
+    int efd = run->policy == "eventfd" ? rd->event_fd() : -1;
+    ++ run->ready;
+
+    int got = 0;
+    while(got < run->params->frames && !run->stop)
+    {
+        struct jgb::frame frm;
+        int r;
+        if(efd >= 0)
+        {
+            r = rd->request_frame(&frm, 0);
+            if(r)
+            {
+                // 没有可读帧时 eventfd 已被清空。
+                struct pollfd pfd = { efd, POLLIN, 0 };
+                poll(&pfd, 1, 100);
+                continue;
+            }
+        }
+        else
+        {
+            r = rd->request_frame(&frm, poll_mode ? 0 : 100);
+            if(r)
+            {
+                if(poll_mode)
+                {
+                    // 读者多于 CPU 时让出 CPU，避免写者长时间得不到运行。
+                    boost::this_thread::yield();
+                }
+                continue;
+            }
+        }
+        h.record(jgb::frame_clock() - frm.timestamp);
+        rd->release();
+        ++ got;
+    }
+    ++ run->done;
+}
+
+static void latency_writer(latency_run* run, jgb::writer* wr)
+{
+    if(run->pin)
+    {
+        pin_thread(0);
+    }
+    const latency_params* p = run->params;
+    std::vector<uint8_t> data(p->frame_size, 0x5a);
+    int64_t next = jgb::frame_clock();
+    for(int i=0; i<p->frames && !run->stop; i++)
+    {
+        next += static_cast<int64_t>(p->interval_us) * 1000;
+        struct timespec ts = { static_cast<time_t>(next / 1000000000L), static_cast<long>(next % 1000000000L) };
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        {
+        }
+        wr->put(data.data(), p->frame_size, 1000);
+    }
+}
+
+// 读者的唤醒策略。
+static int set_policy(jgb::reader* rd, const std::string& policy)
+{
+    if(policy == "notify" || policy == "poll" || policy == "eventfd")
+    {
+        // 默认：每帧通知一次；poll、eventfd 由读者线程自行等待。
+        return 0;
+    }
+    if(policy == "spin")
+    {
+        rd->spin_ = 50;
+        return 0;
+    }
+    if(policy == "batch")
+    {
+        rd->notify_frames_ = 8;
+        rd->notify_latency_ = 1;
+        return 0;
+    }
+    return JGB_ERR_INVALID;
+}
+
+static int run_latency_case(const latency_params& p, const std::string& policy, int readers, bool pin,
+                            jgb::latency_histogram* merged)
+{
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("bench.latency");
+    jgb::writer* wr = buf->add_writer();
+    buf->resize(std::max(1 << 20, 64 * jgb::writer::frame_size(p.frame_size)));
+
+    latency_run run;
+    run.params = &p;
+    run.policy = policy;
+    run.pin = pin;
+    run.hists.resize(readers);
+    run.ready = 0;
+    run.done = 0;
+    run.stop = false;
+    int r = 0;
+    for(int i=0; i<readers && !r; i++)
+    {
+        jgb::reader* rd = buf->add_reader();
+        run.rds.push_back(rd);
+        r = set_policy(rd, policy);
+    }
+
+    if(!r)
+    {
+        boost::thread_group threads;
+        for(int i=0; i<readers; i++)
+        {
+            threads.create_thread([&run, i]() { latency_reader(&run, i); });
+        }
+        while(run.ready < readers)
+        {
+            usleep(1000);
+        }
+        boost::thread writer([&run, wr]() { latency_writer(&run, wr); });
+        writer.join();
+        // 读者最多再等待 1 秒。
+        for(int i=0; i<100 && run.done < readers; i++)
+        {
+            jgb::sleep(10);
+        }
+        run.stop = true;
+        threads.join_all();
+
+        merged->reset();
+        for(auto& h: run.hists)
+        {
+            merged->count_ += h.count_;
+            merged->sum_ += h.sum_;
+            merged->max_ = std::max(merged->max_, h.max_);
+            for(int i=0; i<jgb::latency_histogram::buckets; i++)
+            {
+                merged->counts_[i] += h.counts_[i];
+            }
+        }
+    }
+    else
+    {
+        jgb_warning("invalid policy. { policy = %s }", policy.c_str());
+    }
+
+    for(auto rd: run.rds)
+    {
+        buf->remove_reader(rd);
+    }
+    buf->remove_writer(wr);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+    return r;
+}
+
+static int run_latency(const latency_params& p)
+{
+    FILE* fp = p.output.empty() ? stdout : fopen(p.output.c_str(), "w");
+    if(!fp)
+    {
+        jgb_fail("open output failed. { output = %s }", p.output.c_str());
+        return JGB_ERR_IO;
+    }
+    fprintf(fp, "{\n  \"benchmark\": \"latency\",\n  \"frames\": %d,\n  \"interval_us\": %d,\n"
+            "  \"frame_size\": %d,\n  \"cpus\": %ld,\n  \"results\": [",
+            p.frames, p.interval_us, p.frame_size, sysconf(_SC_NPROCESSORS_ONLN));
+    bool first = true;
+    for(auto& policy: p.policies)
+    {
+        for(int readers: p.readers)
+        {
+            for(bool pin: p.pins)
+            {
+                jgb::latency_histogram h;
+                if(run_latency_case(p, policy, readers, pin, &h))
+                {
+                    continue;
+                }
+                fprintf(fp, "%s\n    { \"policy\": \"%s\", \"readers\": %d, \"pin\": %s, \"count\": %ld, "
+                        "\"mean_ns\": %ld, \"p50_ns\": %ld, \"p99_ns\": %ld, \"p999_ns\": %ld, \"max_ns\": %ld }",
+                        first ? "" : ",", policy.c_str(), readers, pin ? "true" : "false", h.count_,
+                        h.count_ ? h.sum_ / h.count_ : 0L,
+                        h.percentile(50), h.percentile(99), h.percentile(99.9), h.max_);
+                fflush(fp);
+                first = false;
+            }
+        }
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    if(fp != stdout)
+    {
+        fclose(fp);
+    }
+    return 0;
+}
+
+#ifdef BENCH_LATENCY_STANDALONE
+
+extern int jgb_log_print_level;
+
+// 用法：bench-latency [-n frames] [-i interval_us] [-s frame_size] [-o output.json] [-q]，-q 只运行较少的用例。
+int main(int argc, char* argv[])
+{
+    latency_params p;
+    int c;
+    while((c = getopt(argc, argv, "n:i:s:o:q")) != -1)
+    {
+        switch(c)
+        {
+        case 'n':
+            p.frames = atoi(optarg);
+            break;
+        case 'i':
+            p.interval_us = atoi(optarg);
+            break;
+        case 's':
+            p.frame_size = atoi(optarg);
+            break;
+        case 'o':
+            p.output = optarg;
+            break;
+        case 'q':
+            p.policies = { "notify", "spin" };
+            p.readers = { 1, 4 };
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-i interval_us] [-s frame_size] [-o output.json] [-q]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(p.frames <= 0 || p.interval_us < 0 || p.frame_size <= 0)
+    {
+        fprintf(stderr, "invalid arguments.\n");
+        return 1;
+    }
+    // 调整缓冲区大小等日志不影响结果的解析。
+    jgb_log_print_level = JGB_LOG_WARNING;
+    return run_latency(p) ? 1 : 0;
+}
+
+#else
+
+// 应用 bench_latency：配置项 frames、interval_us、frame_size、output 同命令行参数，
+// policies、readers 为数组，pin 为 true/false 时只运行绑定/不绑定 CPU 的用例。
+static int tsk_init(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    latency_params* p = new latency_params;
+    jgb::config* conf = w->get_config();
+    conf->get("frames", p->frames);
+    conf->get("interval_us", p->interval_us);
+    conf->get("frame_size", p->frame_size);
+    conf->get("output", p->output);
+    jgb::value* val;
+    if(!conf->get("policies", &val) && val->type_ == jgb::value::data_type::string)
+    {
+        p->policies.clear();
+        for(int i=0; i<val->len_; i++)
+        {
+            p->policies.push_back(val->str(i));
+        }
+    }
+    if(!conf->get("readers", &val) && val->type_ == jgb::value::data_type::integer)
+    {
+        p->readers.clear();
+        for(int i=0; i<val->len_; i++)
+        {
+            p->readers.push_back(val->int64(i));
+        }
+    }
+    bool pin;
+    if(!conf->get("pin", pin))
+    {
+        p->pins = { pin };
+    }
+    if(p->frames <= 0 || p->interval_us < 0 || p->frame_size <= 0)
+    {
+        jgb_fail("invalid config. { frames = %d, interval_us = %d, frame_size = %d }",
+                 p->frames, p->interval_us, p->frame_size);
+        delete p;
+        return JGB_ERR_INVALID;
+    }
+    w->task_->instance_->user_ = p;
+    return 0;
+}
+
+static int tsk_loop(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    latency_params* p = (latency_params*) w->get_user();
+    int r = run_latency(*p);
+    return r ? r : JGB_ERR_END;
+}
+
+static void tsk_exit(void* worker)
+{
+    jgb::worker* w = (jgb::worker*) worker;
+    latency_params* p = (latency_params*) w->get_user();
+    delete p;
+    w->task_->instance_->user_ = nullptr;
+}
+
+static loop_ptr_t loops[] = { tsk_loop, nullptr };
+
+static jgb_loop_t loop
+{
+    .setup = tsk_init,
+    .loops = loops,
+    .exit = tsk_exit
+};
+
+jgb_api_t bench_latency
+{
+    .version = MAKE_API_VERSION(0, 1),
+    .desc = "buffer commit-to-consume latency benchmark",
+    .init = nullptr,
+    .release = nullptr,
+    .create = nullptr,
+    .destroy = nullptr,
+    .commit = nullptr,
+    .loop = &loop
+};
+
+#endif
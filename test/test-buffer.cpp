@@ -1,6 +1,14 @@
 #include <jgb/core.h>
 #include <jgb/helper.h>
 #include <jgb/buffer.h>
+#include <boost/thread.hpp>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <functional>
+#include <vector>
 #include "check_u32_context.h"
 #include "write_32u_context.h"
 
@@ -28,7 +36,8 @@ static void test_01()
     jgb_debug("{ buf = %p, buf->id = %s, buf->ref = %d",
               buf, buf->id_.c_str(), buf->ref_);
 
-    buf->resize(1024);
+    // 三帧恰好填满缓冲区。
+    buf->resize(3 * jgb::writer::fixed_header_size() + JGB_ALIGN(239,4) + JGB_ALIGN(237,4) + JGB_ALIGN(495,4));
 
     for(int i=0; i<30; i++)
     {
@@ -326,7 +335,7 @@ static void test_06()
     jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#06");
     jgb::writer* wr = buf->add_writer();
     jgb::reader* rd = buf->add_reader();
-    buf->resize(168);
+    buf->resize(3 * jgb::writer::fixed_header_size() + 20 + 60 + 40);
     rd->discard_ = true;
     int r;
     uint8_t* p;
@@ -442,8 +451,2299 @@ static void test_08()
     jgb::buffer_manager::get_instance()->remove_buffer(buf);
 }
 
+// lock_free 模式：一个写者线程，多个读者线程。
+static void test_09()
+{
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#09");
+    const int frames = 20000;
+    buf->lock_free_ = true;
+    jgb::writer* wr = buf->add_writer();
+    jgb_assert(wr);
+    jgb_assert(!buf->add_writer());
+    jgb::reader* rd[3];
+    rd[0] = buf->add_reader();
+    rd[1] = buf->add_reader();
+    rd[2] = buf->add_reader(true);
+    buf->resize(4096);
+    jgb_assert(buf->lock_free_);
+
+    boost::thread wr_thread([wr]()
+    {
+        jgb::write_32u_context wr_ctx;
+        uint8_t data[500];
+        for(int i=0; i<frames; i++)
+        {
+            int len = 8 + random() % 493;
+            wr_ctx.fill(data, len);
+            int r = wr->put(data, len, 1000);
+            jgb_assert(!r);
+        }
+    });
+
+    auto read = [](jgb::reader* rd, bool check, int count)
+    {
+        jgb::check_u32_context chk_ctx;
+        struct jgb::frame frm;
+        int n = 0;
+        int timeout = 0;
+        while(n < count && timeout < 10)
+        {
+            int r = rd->request_frame(&frm, 100);
+            if(!r)
+            {
+                jgb_assert(frm.len > 0);
+                if(check)
+                {
+                    jgb_assert(!chk_ctx.check(frm.buf, frm.len));
+                }
+                rd->release();
+                ++ n;
+                timeout = 0;
+            }
+            else
+            {
+                jgb_assert(r == JGB_ERR_TIMEOUT);
+                ++ timeout;
+            }
+        }
+        return n;
+    };
+
+    int n0 = 0;
+    int n1 = 0;
+    int n2 = 0;
+    boost::thread rd_thread0([&](){ n0 = read(rd[0], true, frames); });
+    boost::thread rd_thread1([&](){ n1 = read(rd[1], true, frames); });
+    boost::thread rd_thread2([&](){ n2 = read(rd[2], false, frames); });
+
+    // 运行中克隆读者。
+    jgb::sleep(10);
+    jgb::reader* rd3 = buf->add_reader(rd[0]);
+    jgb_assert(rd3);
+    int n3 = read(rd3, true, frames);
+
+    wr_thread.join();
+    rd_thread0.join();
+    rd_thread1.join();
+    rd_thread2.join();
+    jgb_assert(n0 == frames);
+    jgb_assert(n1 == frames);
+    jgb_assert(n2 > 0);
+    jgb_assert(n3 > 0);
+    jgb_debug("{ n0 = %d, n1 = %d, n2 = %d, n3 = %d, discarded = %ld }",
+              n0, n1, n2, n3, rd[2]->stat_frames_discarded_);
+
+    buf->remove_reader(rd3);
+    for(int i=0; i<3; i++)
+    {
+        buf->remove_reader(rd[i]);
+    }
+
+    // 写者等待不读取的读者期间删除该读者：不必等到写者超时，写者随即写入。
+    jgb::reader* slow = buf->add_reader();
+    uint8_t data[100] = { 0 };
+    while(!wr->put(data, sizeof(data), 0))
+    {
+    }
+    int r = 0;
+    boost::thread wr_thread2([wr, &data, &r]()
+    {
+        r = wr->put(data, sizeof(data), 60000);
+    });
+    jgb::sleep(50);
+    boost::chrono::steady_clock::time_point t0 = boost::chrono::steady_clock::now();
+    buf->remove_reader(slow);
+    wr_thread2.join();
+    int64_t ms = boost::chrono::duration_cast<boost::chrono::milliseconds>(boost::chrono::steady_clock::now() - t0).count();
+    jgb_assert(!r);
+    jgb_assert(ms < 1000);
+
+    buf->remove_writer(wr);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+}
+
+// 通知策略及自旋等待。
+static void test_10()
+{
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#10");
+    const int frames = 5000;
+    jgb::writer* wr = buf->add_writer();
+    jgb::reader* rd = buf->add_reader();
+    rd->notify_frames_ = 4;
+    rd->notify_bytes_ = 1024;
+    rd->notify_latency_ = 20;
+    rd->spin_ = 100;
+    buf->resize(4096);
+
+    // 写者只提交一帧，未达到通知阈值，读者在 notify_latency_ 之后自行发现新帧。
+    boost::thread wr_thread0([wr]()
+    {
+        jgb::sleep(50);
+        uint8_t data[16] = { 0 };
+        int r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+    });
+
+    struct jgb::frame frm;
+    boost::chrono::steady_clock::time_point t0 = boost::chrono::steady_clock::now();
+    int r = rd->request_frame(&frm, 1000);
+    int64_t ms = boost::chrono::duration_cast<boost::chrono::milliseconds>(boost::chrono::steady_clock::now() - t0).count();
+    jgb_assert(!r);
+    jgb_assert(frm.len == 16);
+    jgb_assert(ms < 500);
+    rd->release();
+    wr_thread0.join();
+
+    boost::thread wr_thread1([wr]()
+    {
+        jgb::write_32u_context wr_ctx;
+        uint8_t data[300];
+        for(int i=0; i<frames; i++)
+        {
+            int len = 8 + random() % 293;
+            wr_ctx.fill(data, len);
+            int r = wr->put(data, len, 1000);
+            jgb_assert(!r);
+        }
+    });
+
+    jgb::check_u32_context chk_ctx;
+    for(int i=0; i<frames; i++)
+    {
+        r = rd->request_frame(&frm, 1000);
+        jgb_assert(!r);
+        jgb_assert(!chk_ctx.check(frm.buf, frm.len));
+        rd->release();
+    }
+    wr_thread1.join();
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(r == JGB_ERR_TIMEOUT);
+
+    buf->remove_writer(wr);
+    buf->remove_reader(rd);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+}
+
+// 批量读取。
+static void test_11()
+{
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#11");
+    jgb::writer* wr = buf->add_writer();
+    jgb::reader* rd = buf->add_reader();
+    uint8_t data[40];
+    // 可以容纳 4 帧及一个重定向帧。
+    buf->resize(4 * jgb::writer::frame_size(sizeof(data)) + jgb::writer::fixed_header_size() + 8);
+
+    struct jgb::frame frms[8];
+    int count;
+    int r;
+
+    for(int i=0; i<4; i++)
+    {
+        memset(data, i, sizeof(data));
+        r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+    }
+    r = rd->request_frames(frms, 2, &count, 0);
+    jgb_assert(!r);
+    jgb_assert(count == 2);
+    jgb_assert(frms[0].buf[0] == 0);
+    jgb_assert(frms[1].buf[0] == 1);
+    rd->release(2);
+
+    // 第 5 帧写到缓冲区开始位置，读者批量读取时跳过重定向帧。
+    memset(data, 4, sizeof(data));
+    r = wr->put(data, sizeof(data), 0);
+    jgb_assert(!r);
+    jgb_assert(rd->stored_ == 4);
+    r = rd->request_frames(frms, 8, &count, 0);
+    jgb_assert(!r);
+    jgb_assert(count == 3);
+    for(int i=0; i<count; i++)
+    {
+        jgb_assert(frms[i].len == sizeof(data));
+        jgb_assert(frms[i].buf[0] == 2 + i);
+        jgb_assert(frms[i].buf[sizeof(data) - 1] == 2 + i);
+    }
+
+    // 部分释放后，再次请求时从第一个未释放的帧开始。
+    rd->release(1);
+    jgb_assert(rd->holding_);
+    r = rd->request_frames(frms, 8, &count, 0);
+    jgb_assert(!r);
+    jgb_assert(count == 2);
+    jgb_assert(frms[0].buf[0] == 3);
+    jgb_assert(frms[1].buf[0] == 4);
+    rd->release(count);
+    jgb_assert(!rd->holding_);
+    jgb_assert(!rd->stored_);
+    jgb_assert(rd->stat_frames_read_ == 6);
+    r = rd->request_frames(frms, 8, &count, 0);
+    jgb_assert(r == JGB_ERR_TIMEOUT);
+    jgb_assert(count == 0);
+
+    buf->remove_writer(wr);
+    buf->remove_reader(rd);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+
+    // 写者线程连续写入，读者批量读取并校验。
+    for(int lock_free=0; lock_free<2; lock_free++)
+    {
+        const int frames = 20000;
+        buf = jgb::buffer_manager::get_instance()->add_buffer("test#11");
+        buf->lock_free_ = lock_free;
+        wr = buf->add_writer();
+        rd = buf->add_reader();
+        buf->resize(4096);
+
+        boost::thread wr_thread([wr]()
+        {
+            jgb::write_32u_context wr_ctx;
+            uint8_t data[200];
+            for(int i=0; i<frames; i++)
+            {
+                int len = 8 + random() % 193;
+                wr_ctx.fill(data, len);
+                int r = wr->put(data, len, 1000);
+                jgb_assert(!r);
+            }
+        });
+
+        jgb::check_u32_context chk_ctx;
+        int n = 0;
+        while(n < frames)
+        {
+            r = rd->request_frames(frms, 1 + random() % 8, &count, 1000);
+            jgb_assert(!r);
+            for(int i=0; i<count; i++)
+            {
+                jgb_assert(!chk_ctx.check(frms[i].buf, frms[i].len));
+            }
+            rd->release(count);
+            n += count;
+        }
+        wr_thread.join();
+        jgb_assert(n == frames);
+        jgb_assert(!rd->stored_);
+
+        buf->remove_writer(wr);
+        buf->remove_reader(rd);
+        jgb::buffer_manager::get_instance()->remove_buffer(buf);
+    }
+}
+
+// 批量写入。
+static void test_12()
+{
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#12");
+    jgb::writer* wr = buf->add_writer();
+    jgb::reader* rd = buf->add_reader();
+    buf->resize(256);
+
+    uint8_t* p;
+    struct jgb::frame frms[8];
+    int count;
+    int r;
+
+    r = wr->request_batch(3 * jgb::writer::frame_size(40), 0);
+    jgb_assert(!r);
+    for(int i=0; i<3; i++)
+    {
+        r = wr->request_batch_frame(&p, 40);
+        jgb_assert(!r);
+        memset(p, i, 40);
+    }
+    r = wr->request_batch_frame(&p, 1);
+    jgb_assert(r == JGB_ERR_LIMIT);
+    r = wr->commit(40);
+    jgb_assert(r == JGB_ERR_INVALID);
+    jgb_assert(!rd->stored_);
+    r = wr->commit_batch();
+    jgb_assert(!r);
+    jgb_assert(rd->stored_ == 3);
+    jgb_assert(wr->stat_frames_written_ == 3);
+
+    r = rd->request_frames(frms, 8, &count, 0);
+    jgb_assert(!r);
+    jgb_assert(count == 3);
+    for(int i=0; i<count; i++)
+    {
+        jgb_assert(frms[i].len == 40);
+        jgb_assert(frms[i].buf[0] == i);
+    }
+    rd->release(count);
+
+    // 没有追加任何帧时相当于取消。
+    r = wr->request_batch(jgb::writer::frame_size(40), 0);
+    jgb_assert(!r);
+    r = wr->commit_batch();
+    jgb_assert(!r);
+    jgb_assert(wr->stat_cancelled_ == 1);
+    r = wr->request_batch(jgb::writer::frame_size(40), 0);
+    jgb_assert(!r);
+    r = wr->request_batch_frame(&p, 40);
+    jgb_assert(!r);
+    r = wr->cancel();
+    jgb_assert(!r);
+    jgb_assert(!rd->stored_);
+    r = wr->commit_batch();
+    jgb_assert(r == JGB_ERR_INVALID);
+
+    buf->remove_writer(wr);
+    buf->remove_reader(rd);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+
+    // 写者线程批量写入，读者逐帧读取并校验。
+    for(int lock_free=0; lock_free<2; lock_free++)
+    {
+        const int frames = 20000;
+        buf = jgb::buffer_manager::get_instance()->add_buffer("test#12");
+        buf->lock_free_ = lock_free;
+        wr = buf->add_writer();
+        rd = buf->add_reader();
+        jgb::reader* rd1 = buf->add_reader(true);
+        buf->resize(4096);
+
+        boost::thread wr_thread([wr]()
+        {
+            jgb::write_32u_context wr_ctx;
+            int n = 0;
+            while(n < frames)
+            {
+                int r = wr->request_batch(1024, 1000);
+                jgb_assert(!r);
+                while(n < frames)
+                {
+                    uint8_t* p;
+                    int len = 8 + random() % 193;
+                    r = wr->request_batch_frame(&p, len);
+                    if(r)
+                    {
+                        jgb_assert(r == JGB_ERR_LIMIT);
+                        break;
+                    }
+                    wr_ctx.fill(p, len);
+                    ++ n;
+                }
+                r = wr->commit_batch();
+                jgb_assert(!r);
+            }
+        });
+
+        jgb::check_u32_context chk_ctx;
+        struct jgb::frame frm;
+        for(int i=0; i<frames; i++)
+        {
+            r = rd->request_frame(&frm, 1000);
+            jgb_assert(!r);
+            jgb_assert(!chk_ctx.check(frm.buf, frm.len));
+            rd->release();
+        }
+        wr_thread.join();
+        jgb_assert(!rd->stored_);
+        jgb_assert(wr->stat_frames_written_ == frames);
+
+        buf->remove_writer(wr);
+        buf->remove_reader(rd);
+        buf->remove_reader(rd1);
+        jgb::buffer_manager::get_instance()->remove_buffer(buf);
+    }
+}
+
+// 共享内存缓冲区：另一个缓冲区对象连接同一块共享内存，以及子进程读写。
+static void test_13()
+{
+    const int frames = 20000;
+    struct jgb::frame frm;
+    int r;
+
+    // 删除上次异常退出时残留的共享内存。
+    shm_unlink("/jgb.test#13");
+
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#13");
+    buf->shm_ = true;
+    jgb::writer* wr = buf->add_writer();
+    jgb::reader* rd = buf->add_reader();
+    r = buf->resize(4096);
+    jgb_assert(!r);
+
+    jgb::buffer* other = new jgb::buffer("test#13");
+    r = other->attach();
+    jgb_assert(!r);
+    jgb_assert(other->len_ == 4096);
+    jgb_assert(other->start_ != buf->start_);
+    jgb::reader* rd1 = other->add_reader();
+    jgb::writer* wr1 = other->add_writer();
+
+    auto read = [](jgb::reader* rd, int count)
+    {
+        jgb::check_u32_context chk_ctx;
+        struct jgb::frame frm;
+        for(int i=0; i<count; i++)
+        {
+            int r = rd->request_frame(&frm, 1000);
+            jgb_assert(!r);
+            jgb_assert(!chk_ctx.check(frm.buf, frm.len));
+            rd->release();
+        }
+    };
+
+    boost::thread wr_thread([wr]()
+    {
+        jgb::write_32u_context wr_ctx;
+        uint8_t data[200];
+        for(int i=0; i<frames; i++)
+        {
+            int len = 8 + random() % 193;
+            wr_ctx.fill(data, len);
+            int r = wr->put(data, len, 1000);
+            jgb_assert(!r);
+        }
+    });
+    boost::thread rd_thread([&](){ read(rd1, frames); });
+    read(rd, frames);
+    wr_thread.join();
+    rd_thread.join();
+
+    // 另一个缓冲区对象的写者接着写入。
+    uint8_t data[16] = { 1, 2, 3, 4 };
+    r = wr1->put(data, sizeof(data), 0);
+    jgb_assert(!r);
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(!r);
+    jgb_assert(frm.len == sizeof(data));
+    jgb_assert(!memcmp(frm.buf, data, sizeof(data)));
+    rd->release();
+    r = rd1->request_frame(&frm, 0);
+    jgb_assert(!r);
+    rd1->release();
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(r == JGB_ERR_TIMEOUT);
+
+    // 子进程写入。
+    pid_t pid = fork();
+    jgb_assert(pid >= 0);
+    if(!pid)
+    {
+        jgb::buffer child_buf("test#13");
+        if(child_buf.attach())
+        {
+            _exit(1);
+        }
+        jgb::writer* child_wr = child_buf.add_writer();
+        jgb::write_32u_context wr_ctx;
+        uint8_t data[200];
+        for(int i=0; i<1000; i++)
+        {
+            int len = 8 + random() % 193;
+            wr_ctx.fill(data, len);
+            if(child_wr->put(data, len, 1000))
+            {
+                _exit(2);
+            }
+        }
+        child_buf.remove_writer(child_wr);
+        _exit(0);
+    }
+    boost::thread rd_thread1([&](){ read(rd1, 1000); });
+    read(rd, 1000);
+    rd_thread1.join();
+    int status;
+    jgb_assert(waitpid(pid, &status, 0) == pid);
+    jgb_assert(WIFEXITED(status) && !WEXITSTATUS(status));
+
+    // 读者进程退出时没有释放槽位，写者超时后回收其槽位。
+    pid = fork();
+    jgb_assert(pid >= 0);
+    if(!pid)
+    {
+        jgb::buffer child_buf("test#13");
+        if(child_buf.attach())
+        {
+            _exit(1);
+        }
+        child_buf.add_reader();
+        _exit(0);
+    }
+    jgb_assert(waitpid(pid, &status, 0) == pid);
+    jgb_assert(WIFEXITED(status) && !WEXITSTATUS(status));
+    buf->remove_reader(rd);
+    other->remove_reader(rd1);
+    for(int i=0; i<100; i++)
+    {
+        uint8_t data[200] = { 0 };
+        r = wr->put(data, sizeof(data), 100);
+        jgb_assert(!r);
+    }
+    jgb_assert(!wr->stat_timeout_);
+
+    other->remove_writer(wr1);
+    delete other;
+    buf->remove_writer(wr);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+    jgb_assert(shm_unlink("/jgb.test#13") && errno == ENOENT);
+}
+
+// 多段数据写入一帧。
+static void test_14()
+{
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#14");
+    jgb::writer* wr = buf->add_writer();
+    jgb::reader* rd = buf->add_reader();
+    buf->resize(1024);
+
+    uint8_t hdr[3] = { 1, 2, 3 };
+    uint8_t payload[100];
+    uint8_t trailer[5] = { 4, 5, 6, 7, 8 };
+    memset(payload, 0xaa, sizeof(payload));
+    struct iovec iov[4] =
+    {
+        { hdr, sizeof(hdr) },
+        { payload, sizeof(payload) },
+        { nullptr, 0 },
+        { trailer, sizeof(trailer) }
+    };
+
+    int r = wr->putv(iov, 4, 0);
+    jgb_assert(!r);
+    r = wr->putv(iov, 0, 0);
+    jgb_assert(r == JGB_ERR_INVALID);
+    r = wr->putv(&iov[2], 1, 0);
+    jgb_assert(r == JGB_ERR_INVALID);
+
+    struct jgb::frame frm;
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(!r);
+    jgb_assert(frm.len == sizeof(hdr) + sizeof(payload) + sizeof(trailer));
+    jgb_assert(!memcmp(frm.buf, hdr, sizeof(hdr)));
+    jgb_assert(!memcmp(frm.buf + sizeof(hdr), payload, sizeof(payload)));
+    jgb_assert(!memcmp(frm.buf + sizeof(hdr) + sizeof(payload), trailer, sizeof(trailer)));
+    rd->release();
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(r == JGB_ERR_TIMEOUT);
+
+    buf->remove_writer(wr);
+    buf->remove_reader(rd);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+}
+
+// 内存选项：大页、锁定内存、预先分配、NUMA 节点。
+static void test_15()
+{
+    const jgb::buffer::huge_pages_mode modes[] =
+    {
+        jgb::buffer::huge_pages_transparent,
+        jgb::buffer::huge_pages_explicit
+    };
+    const int nodes[] = { 0, jgb::buffer::numa_local };
+    for(int i=0; i<2; i++)
+    {
+        jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#15");
+        buf->huge_pages_ = modes[i];
+        buf->mlock_ = true;
+        buf->prefault_ = true;
+        buf->numa_node_ = nodes[i];
+        jgb::writer* wr = buf->add_writer();
+        jgb::reader* rd = buf->add_reader();
+        int r = buf->resize(3 * 1024 * 1024);
+        jgb_assert(!r);
+        // numa_local：第一次写入时才放置。
+        jgb_assert(buf->stat_prefaulted_ == (nodes[i] != jgb::buffer::numa_local));
+
+        jgb::write_32u_context wr_ctx;
+        jgb::check_u32_context chk_ctx;
+        uint8_t data[4096];
+        struct jgb::frame frm;
+        for(int j=0; j<2000; j++)
+        {
+            int len = 8 + random() % 4089;
+            wr_ctx.fill(data, len);
+            r = wr->put(data, len, 0);
+            jgb_assert(!r);
+            r = rd->request_frame(&frm, 0);
+            jgb_assert(!r);
+            jgb_assert(!chk_ctx.check(frm.buf, frm.len));
+            rd->release();
+        }
+        jgb_assert(buf->stat_prefaulted_);
+        jgb_debug("{ huge_pages = %d, locked = %d, numa node = %d }",
+                  buf->stat_huge_pages_, buf->stat_locked_, buf->stat_numa_node_);
+
+        buf->remove_writer(wr);
+        buf->remove_reader(rd);
+        jgb::buffer_manager::get_instance()->remove_buffer(buf);
+    }
+}
+
+// 读写过程中在线调整缓冲区大小。
+static void test_16()
+{
+    const int frames = 20000;
+    const int sizes[] = { 65536, 1024, 8192, 2048 };
+    for(int mode=0; mode<2; mode++)
+    {
+        jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#16");
+        buf->lock_free_ = mode;
+        jgb::writer* wr = buf->add_writer();
+        jgb::reader* rd[3];
+        rd[0] = buf->add_reader();
+        rd[1] = buf->add_reader();
+        rd[2] = buf->add_reader(true);
+        int r = buf->resize(4096);
+        jgb_assert(!r);
+        // 写者尚未写入时多次调整，只有最后一次生效。
+        r = buf->resize(512);
+        jgb_assert(!r);
+        r = buf->resize(4096);
+        jgb_assert(!r);
+
+        boost::thread wr_thread([wr]()
+        {
+            jgb::write_32u_context wr_ctx;
+            uint8_t data[500];
+            // 不使用 random()，以免影响其他测试所使用的随机数序列。
+            unsigned seed = 16;
+            for(int i=0; i<frames; i++)
+            {
+                int len = 8 + rand_r(&seed) % 493;
+                wr_ctx.fill(data, len);
+                int r = wr->put(data, len, 1000);
+                jgb_assert(!r);
+            }
+        });
+
+        auto read = [](jgb::reader* rd, bool check, int count)
+        {
+            jgb::check_u32_context chk_ctx;
+            struct jgb::frame frms[8];
+            int n = 0;
+            int timeout = 0;
+            while(n < count && timeout < 10)
+            {
+                int got = 0;
+                int r = rd->request_frames(frms, 1 + n % 8, &got, 100);
+                if(!r)
+                {
+                    for(int i=0; i<got; i++)
+                    {
+                        jgb_assert(frms[i].len > 0);
+                        if(check)
+                        {
+                            jgb_assert(!chk_ctx.check(frms[i].buf, frms[i].len));
+                        }
+                    }
+                    rd->release(got);
+                    n += got;
+                    timeout = 0;
+                }
+                else
+                {
+                    jgb_assert(r == JGB_ERR_TIMEOUT);
+                    ++ timeout;
+                }
+            }
+            return n;
+        };
+
+        int n[3] = { 0 };
+        boost::thread rd_thread0([&](){ n[0] = read(rd[0], true, frames); });
+        boost::thread rd_thread1([&](){ n[1] = read(rd[1], true, frames); });
+        boost::thread rd_thread2([&](){ n[2] = read(rd[2], false, frames); });
+
+        // 读写过程中调整大小，并克隆可能尚未离开旧内存的读者。
+        jgb::reader* rd3 = nullptr;
+        int n3 = 0;
+        boost::thread rd_thread3;
+        for(auto& size : sizes)
+        {
+            jgb::sleep(5);
+            r = buf->resize(size);
+            jgb_assert(!r);
+            if(!rd3)
+            {
+                jgb::sleep(1);
+                rd3 = buf->add_reader(rd[0]);
+                jgb_assert(rd3);
+                rd_thread3 = boost::thread([&](){ n3 = read(rd3, true, frames); });
+            }
+        }
+
+        wr_thread.join();
+        rd_thread0.join();
+        rd_thread1.join();
+        rd_thread2.join();
+        rd_thread3.join();
+        jgb_assert(n[0] == frames);
+        jgb_assert(n[1] == frames);
+        jgb_assert(n[2] > 0);
+        jgb_assert(n3 > 0);
+        jgb_assert(buf->len_ == sizes[3]);
+        jgb_debug("{ lock_free = %d, n2 = %d, n3 = %d, discarded = %ld }",
+                  mode, n[2], n3, rd[2]->stat_frames_discarded_);
+
+        buf->remove_reader(rd3);
+        for(int i=0; i<3; i++)
+        {
+            buf->remove_reader(rd[i]);
+        }
+        buf->remove_writer(wr);
+        jgb::buffer_manager::get_instance()->remove_buffer(buf);
+    }
+}
+
+// 帧时间戳及延迟直方图。
+static void test_17()
+{
+    jgb::latency_histogram h;
+    for(int64_t v=0; v<(1L << 40); v=v*3/2+1)
+    {
+        int i = jgb::latency_histogram::bucket_index(v);
+        jgb_assert(jgb::latency_histogram::bucket_low(i) <= v);
+        if(i < jgb::latency_histogram::buckets - 1)
+        {
+            jgb_assert(v < jgb::latency_histogram::bucket_low(i + 1));
+            jgb_assert(jgb::latency_histogram::bucket_low(i + 1) - jgb::latency_histogram::bucket_low(i)
+                       <= std::max(jgb::latency_histogram::bucket_low(i) / 8, 1L));
+        }
+    }
+    jgb_assert(!h.percentile(50));
+    for(int i=1; i<=1000; i++)
+    {
+        h.record(i * 1000L);
+    }
+    jgb_assert(h.count_ == 1000);
+    jgb_assert(h.max_ == 1000000L);
+    int64_t p50 = h.percentile(50);
+    jgb_assert(p50 >= 500000L && p50 <= 500000L * 9 / 8);
+    jgb_assert(h.percentile(100) == 1000000L);
+
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#17");
+    jgb::writer* wr = buf->add_writer();
+    jgb::reader* rd = buf->add_reader();
+    buf->resize(4096);
+
+    uint8_t data[16] = { 0 };
+    int64_t t0 = jgb::frame_clock();
+    int r = wr->put(data, sizeof(data), 0);
+    jgb_assert(!r);
+    int64_t t1 = jgb::frame_clock();
+    jgb::sleep(20);
+    struct jgb::frame frm;
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(!r);
+    jgb_assert(frm.timestamp >= t0 && frm.timestamp <= t1);
+    jgb::sleep(10);
+    rd->release();
+    jgb_assert(rd->stat_commit_latency_.count_ == 1);
+    jgb_assert(rd->stat_commit_latency_.max_ >= 20000000L);
+    jgb_assert(rd->stat_hold_latency_.count_ == 1);
+    jgb_assert(rd->stat_hold_latency_.max_ >= 10000000L);
+
+    // 批量提交的帧具有相同的提交时间；持有的每一帧都计入持有时长。
+    uint8_t* p;
+    r = wr->request_batch(3 * jgb::writer::frame_size(sizeof(data)), 0);
+    jgb_assert(!r);
+    for(int i=0; i<3; i++)
+    {
+        r = wr->request_batch_frame(&p, sizeof(data));
+        jgb_assert(!r);
+    }
+    r = wr->commit_batch();
+    jgb_assert(!r);
+    struct jgb::frame frms[4];
+    int count;
+    r = rd->request_frames(frms, 4, &count, 0);
+    jgb_assert(!r);
+    jgb_assert(count == 3);
+    jgb_assert(frms[0].timestamp == frms[2].timestamp);
+    rd->release(count);
+    jgb_assert(rd->stat_commit_latency_.count_ == 4);
+    jgb_assert(rd->stat_hold_latency_.count_ == 4);
+
+    // 关闭统计。
+    rd->stat_latency_ = false;
+    r = wr->put(data, sizeof(data), 0);
+    jgb_assert(!r);
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(!r);
+    rd->release();
+    jgb_assert(rd->stat_commit_latency_.count_ == 4);
+    jgb_assert(rd->stat_hold_latency_.count_ == 4);
+
+    buf->remove_writer(wr);
+    buf->remove_reader(rd);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+}
+
+// 创建缓冲区 id 及一个写者，lock_free 为 true 时使用 lock_free 模式；setup 设置须在 resize() 之前设置的选项。
+static jgb::buffer* open_buffer(const char* id, bool lock_free, int len, jgb::writer** wr,
+                                const std::function<void(jgb::buffer*)>& setup = nullptr)
+{
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer(id);
+    *wr = buf->add_writer();
+    buf->lock_free_ = lock_free;
+    if(setup)
+    {
+        setup(buf);
+    }
+    int r = buf->resize(len);
+    jgb_assert(!r);
+    return buf;
+}
+
+// 删除 open_buffer() 创建的缓冲区、写者，以及读者 rd。
+static void close_buffer(jgb::buffer* buf, jgb::writer* wr, jgb::reader* rd = nullptr)
+{
+    buf->remove_writer(wr);
+    if(rd)
+    {
+        buf->remove_reader(rd);
+    }
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+}
+
+// 分别在加锁模式、lock_free 模式下以 open_buffer() 创建缓冲区，运行 body 后删除；body 删除自己加入的读者。
+static void each_mode(const char* id, int len, const std::function<void(jgb::buffer*, jgb::writer*)>& body,
+                      const std::function<void(jgb::buffer*)>& setup = nullptr)
+{
+    for(int lock_free=0; lock_free<2; lock_free++)
+    {
+        jgb::writer* wr;
+        jgb::buffer* buf = open_buffer(id, lock_free, len, &wr, setup);
+        body(buf, wr);
+        close_buffer(buf, wr);
+    }
+}
+
+// 帧索引：后加入的读者按时间、最早、最近的帧移动读取位置。
+static void test_18()
+{
+    each_mode("test#18", 1024, [](jgb::buffer* buf, jgb::writer* wr)
+    {
+        uint8_t data[16] = { 0 };
+        int64_t t5 = 0;
+        int r;
+        for(int i=0; i<10; i++)
+        {
+            if(i == 5)
+            {
+                jgb::sleep(5);
+                t5 = jgb::frame_clock();
+            }
+            data[0] = i;
+            r = wr->put(data, sizeof(data), 0);
+            jgb_assert(!r);
+        }
+
+        struct jgb::frame frm;
+        jgb::reader* rd = buf->add_reader();
+        r = rd->seek(jgb::reader::seek_oldest);
+        jgb_assert(!r);
+        jgb_assert(rd->stored_ == 10);
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r);
+        jgb_assert(frm.buf[0] == 0);
+        // 持有帧时不能移动。
+        r = rd->seek(jgb::reader::seek_latest);
+        jgb_assert(r == JGB_ERR_DENIED);
+        rd->release();
+
+        r = rd->seek(jgb::reader::seek_latest);
+        jgb_assert(!r);
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r);
+        jgb_assert(frm.buf[0] == 9);
+        rd->release();
+
+        r = rd->seek(jgb::reader::seek_time, t5);
+        jgb_assert(!r);
+        for(int i=5; i<10; i++)
+        {
+            r = rd->request_frame(&frm, 0);
+            jgb_assert(!r);
+            jgb_assert(frm.buf[0] == i);
+            jgb_assert(frm.timestamp >= t5);
+            rd->release();
+        }
+
+        // 晚于最后一帧的时间：从下一帧开始读取。
+        r = rd->seek(jgb::reader::seek_time, jgb::frame_clock());
+        jgb_assert(!r);
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(r == JGB_ERR_TIMEOUT);
+        data[0] = 10;
+        r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r);
+        jgb_assert(frm.buf[0] == 10);
+        rd->release();
+        buf->remove_reader(rd);
+
+        // 绕回后被覆盖的帧从索引中删除，最早的帧仍然可以按顺序读取。
+        for(int i=11; i<100; i++)
+        {
+            data[0] = i;
+            r = wr->put(data, sizeof(data), 0);
+            jgb_assert(!r);
+        }
+        rd = buf->add_reader();
+        r = rd->seek(jgb::reader::seek_oldest);
+        jgb_assert(!r);
+        int n = rd->stored_;
+        jgb_assert(n > 1 && n * jgb::writer::frame_size(sizeof(data)) <= buf->len_);
+        for(int i=100-n; i<100; i++)
+        {
+            r = rd->request_frame(&frm, 0);
+            jgb_assert(!r);
+            jgb_assert(frm.buf[0] == i);
+            rd->release();
+        }
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(r == JGB_ERR_TIMEOUT);
+        buf->remove_reader(rd);
+    },
+    [](jgb::buffer* buf)
+    {
+        buf->index_size_ = 50;
+    });
+}
+
+// 帧标志：落后的可丢弃读者跳到关键帧，后加入的读者从最近的关键帧开始读取。
+static void test_19()
+{
+    each_mode("test#19", 12 * jgb::writer::frame_size(16) + jgb::writer::fixed_header_size() + 8,
+              [](jgb::buffer* buf, jgb::writer* wr)
+    {
+        jgb::reader_options opt;
+        opt.discard = true;
+        opt.discard_keyframe = true;
+        jgb::reader* rd = buf->add_reader(opt);
+
+        auto put = [wr](int i, int flags)
+        {
+            uint8_t* p;
+            int r = wr->request_buffer(&p, 16, 0);
+            jgb_assert(!r);
+            p[0] = i;
+            r = wr->commit(16, 0, flags);
+            jgb_assert(!r);
+        };
+
+        // 内部使用的帧标志。
+        uint8_t* p;
+        int r = wr->request_buffer(&p, 16, 0);
+        jgb_assert(!r);
+        r = wr->commit(16, 0, 0x1);
+        jgb_assert(r == JGB_ERR_INVALID);
+        r = wr->cancel();
+        jgb_assert(!r);
+
+        // 每 5 帧一个关键帧：落后的读者跳到关键帧，此后的帧连续。
+        for(int i=0; i<30; i++)
+        {
+            put(i, (i % 5) ? 0 : JGB_FRAME_KEYFRAME);
+        }
+        jgb_assert(rd->stat_frames_discarded_ > 0);
+        struct jgb::frame frm;
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r);
+        jgb_assert(frm.flags == JGB_FRAME_KEYFRAME);
+        int first = frm.buf[0];
+        jgb_assert(!(first % 5));
+        rd->release();
+        for(int i=first+1; i<30; i++)
+        {
+            r = rd->request_frame(&frm, 0);
+            jgb_assert(!r);
+            jgb_assert(frm.buf[0] == i);
+            jgb_assert(frm.flags == ((i % 5) ? 0 : JGB_FRAME_KEYFRAME));
+            rd->release();
+        }
+
+        // 已提交的帧中没有关键帧：丢弃全部，直到下一个关键帧。
+        put(30, JGB_FRAME_KEYFRAME);
+        for(int i=31; i<60; i++)
+        {
+            put(i, (i == 50) ? JGB_FRAME_KEYFRAME : JGB_FRAME_DISCARDABLE);
+        }
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r);
+        jgb_assert(frm.buf[0] == 50);
+        rd->release();
+        for(int i=51; i<60; i++)
+        {
+            r = rd->request_frame(&frm, 0);
+            jgb_assert(!r);
+            jgb_assert(frm.buf[0] == i);
+            jgb_assert(frm.flags == JGB_FRAME_DISCARDABLE);
+            rd->release();
+        }
+
+        // 后加入的读者从最近的关键帧开始读取。
+        jgb::reader* rd2 = buf->add_reader();
+        r = rd2->seek(jgb::reader::seek_flags, JGB_FRAME_KEYFRAME);
+        jgb_assert(!r);
+        r = rd2->request_frame(&frm, 0);
+        jgb_assert(!r);
+        jgb_assert(frm.buf[0] == 50);
+        rd2->release();
+        r = rd2->seek(jgb::reader::seek_flags, JGB_FRAME_END_OF_UNIT);
+        jgb_assert(r == JGB_ERR_NOT_FOUND);
+
+        buf->remove_reader(rd);
+        buf->remove_reader(rd2);
+    },
+    [](jgb::buffer* buf)
+    {
+        buf->index_size_ = 64;
+    });
+}
+
+// leaky 模式：写者从不等待读者，读者检查所持有的帧是否被覆盖。
+static void test_20()
+{
+    // 加锁模式不支持 leaky 模式。
+    {
+        jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#20");
+        jgb::writer* wr = buf->add_writer();
+        buf->leaky_ = true;
+        jgb_assert(buf->resize(1024) == JGB_ERR_NOT_SUPPORT);
+        jgb_assert(!buf->start_);
+        buf->remove_writer(wr);
+        jgb::buffer_manager::get_instance()->remove_buffer(buf);
+    }
+
+    auto leaky = [](jgb::buffer* buf)
+    {
+        buf->leaky_ = true;
+    };
+    {
+        jgb::writer* wr;
+        jgb::buffer* buf = open_buffer("test#20", true, 10 * jgb::writer::frame_size(16) + jgb::writer::fixed_header_size() + 8,
+                                       &wr, leaky);
+        jgb::reader* rd = buf->add_reader();
+
+        // 写者从不等待读者。
+        uint8_t data[16] = { 0 };
+        int r;
+        for(int i=0; i<100; i++)
+        {
+            data[0] = i;
+            r = wr->put(data, sizeof(data), 0);
+            jgb_assert(!r);
+        }
+        jgb_assert(!wr->stat_timeout_);
+
+        // 被超越的读者转到最早的有效帧。
+        struct jgb::frame frm;
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r);
+        int first = frm.buf[0];
+        jgb_assert(first > 80);
+        jgb_assert(rd->stat_frames_lost_ >= first);
+        jgb_assert(!rd->overwritten());
+        rd->release();
+        for(int i=first+1; i<100; i++)
+        {
+            r = rd->request_frame(&frm, 0);
+            jgb_assert(!r);
+            jgb_assert(frm.buf[0] == i);
+            rd->release();
+        }
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(r == JGB_ERR_TIMEOUT);
+
+        // 读者持有的帧被覆盖。
+        data[0] = 100;
+        r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r);
+        jgb_assert(frm.buf[0] == 100);
+        for(int i=101; i<130; i++)
+        {
+            data[0] = i;
+            r = wr->put(data, sizeof(data), 0);
+            jgb_assert(!r);
+        }
+        jgb_assert(rd->overwritten());
+        rd->release();
+        int64_t lost = rd->stat_frames_lost_;
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r);
+        jgb_assert(frm.buf[0] > 110);
+        jgb_assert(rd->stat_frames_lost_ > lost);
+        rd->release();
+
+        close_buffer(buf, wr, rd);
+    }
+
+    // 并发：读者复制帧的数据后检查是否被覆盖，未被覆盖时数据完整，且帧的顺序不变。
+    const int frames = 50000;
+    {
+        jgb::writer* wr;
+        jgb::buffer* buf = open_buffer("test#20", true, 2048, &wr, leaky);
+        jgb::reader* rd = buf->add_reader();
+
+        boost::thread wr_thread([wr]()
+        {
+            uint8_t data[300];
+            unsigned seed = 20;
+            for(int i=0; i<frames; i++)
+            {
+                int len = 8 + rand_r(&seed) % 293;
+                memset(data, i & 0xff, len);
+                memcpy(data, &i, sizeof(i));
+                int r = wr->put(data, len, 0);
+                jgb_assert(!r);
+            }
+        });
+
+        int last = -1;
+        int read = 0;
+        int timeout = 0;
+        while(last < frames - 1 && timeout < 10)
+        {
+            struct jgb::frame frms[4];
+            uint8_t copy[4][300];
+            int got;
+            int r = rd->request_frames(frms, 4, &got, 100);
+            if(r)
+            {
+                jgb_assert(r == JGB_ERR_TIMEOUT);
+                ++ timeout;
+                continue;
+            }
+            timeout = 0;
+            int lens[4];
+            for(int i=0; i<got; i++)
+            {
+                lens[i] = std::min(frms[i].len, 300);
+                memcpy(copy[i], frms[i].buf, lens[i]);
+            }
+            bool overwritten = rd->overwritten();
+            rd->release(got);
+            if(overwritten)
+            {
+                continue;
+            }
+            for(int i=0; i<got; i++)
+            {
+                int seq;
+                memcpy(&seq, copy[i], sizeof(seq));
+                jgb_assert(seq > last && seq < frames);
+                for(int k=sizeof(seq); k<lens[i]; k++)
+                {
+                    jgb_assert(copy[i][k] == (seq & 0xff));
+                }
+                last = seq;
+                ++ read;
+            }
+        }
+        wr_thread.join();
+        jgb_assert(last == frames - 1);
+        jgb_assert(read > 0);
+        jgb_info("leaky. { read = %d, lost = %ld }", read, rd->stat_frames_lost_);
+
+        close_buffer(buf, wr, rd);
+    }
+
+    // 并发：读取期间在线调整缓冲区大小，读者跨越绕回的重定向帧、迁移帧时，帧头可能同时被覆盖。
+    {
+        jgb::writer* wr;
+        jgb::buffer* buf = open_buffer("test#20", true, 1024, &wr, leaky);
+        jgb::reader* rds[2] = { buf->add_reader(), buf->add_reader() };
+        std::atomic<bool> done(false);
+
+        boost::thread wr_thread([wr, &done]()
+        {
+            uint8_t data[300];
+            unsigned seed = 200;
+            for(int i=0; i<frames; i++)
+            {
+                // 长度不是 4 的倍数的帧带有填充。
+                int len = 5 + rand_r(&seed) % 296;
+                memset(data, i & 0xff, len);
+                memcpy(data, &i, sizeof(i));
+                int r = wr->put(data, len, 0);
+                jgb_assert(!r);
+            }
+            done = true;
+        });
+
+        // 读者 0 逐帧读取，读者 1 批量读取。
+        int read[2] = { 0, 0 };
+        boost::thread_group threads;
+        for(int k=0; k<2; k++)
+        {
+            threads.create_thread([k, &rds, &read, &done]()
+            {
+                jgb::reader* rd = rds[k];
+                int last = -1;
+                while(!done || rd->stored_ > 0)
+                {
+                    struct jgb::frame frms[4];
+                    uint8_t copy[4][300];
+                    int got = 1;
+                    int r = k ? rd->request_frames(frms, 4, &got, 10) : rd->request_frame(frms, 10);
+                    if(r)
+                    {
+                        jgb_assert(r == JGB_ERR_TIMEOUT);
+                        continue;
+                    }
+                    int lens[4];
+                    for(int i=0; i<got; i++)
+                    {
+                        lens[i] = std::min(std::max(frms[i].len, 0), 300);
+                        memcpy(copy[i], frms[i].buf, lens[i]);
+                    }
+                    bool overwritten = rd->overwritten();
+                    rd->release(got);
+                    if(overwritten)
+                    {
+                        continue;
+                    }
+                    for(int i=0; i<got; i++)
+                    {
+                        int seq;
+                        jgb_assert(lens[i] >= static_cast<int>(sizeof(seq)));
+                        memcpy(&seq, copy[i], sizeof(seq));
+                        jgb_assert(seq > last && seq < frames);
+                        for(int j=sizeof(seq); j<lens[i]; j++)
+                        {
+                            jgb_assert(copy[i][j] == (seq & 0xff));
+                        }
+                        last = seq;
+                        ++ read[k];
+                    }
+                }
+            });
+        }
+
+        unsigned seed = 201;
+        for(int i=0; i<50 && !done; i++)
+        {
+            int r = buf->resize(512 + rand_r(&seed) % 2048);
+            jgb_assert(!r);
+            jgb::sleep(1);
+        }
+        wr_thread.join();
+        threads.join_all();
+        jgb_assert(read[0] > 0 && read[1] > 0);
+        jgb_info("leaky resize. { read = %d/%d, lost = %ld/%ld }", read[0], read[1],
+                 rds[0]->stat_frames_lost_, rds[1]->stat_frames_lost_);
+
+        buf->remove_reader(rds[0]);
+        close_buffer(buf, wr, rds[1]);
+    }
+}
+
+// 文件描述符 fd 是否可读。
+static bool fd_readable(int fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+// 读者、写者的 eventfd：一个线程以 poll() 同时等待多个缓冲区。
+static void test_21()
+{
+    const int len = 4 * jgb::writer::frame_size(16) + jgb::writer::fixed_header_size() + 8;
+    each_mode("test#21.0", len, [&](jgb::buffer* buf0, jgb::writer* wr0)
+    {
+        jgb::buffer* buf[2];
+        jgb::writer* wr[2];
+        jgb::reader* rd[2];
+        struct pollfd pfds[2];
+        buf[0] = buf0;
+        wr[0] = wr0;
+        buf[1] = open_buffer("test#21.1", buf0->lock_free_, len, &wr[1]);
+        for(int i=0; i<2; i++)
+        {
+            rd[i] = buf[i]->add_reader();
+            pfds[i].fd = rd[i]->event_fd();
+            pfds[i].events = POLLIN;
+            jgb_assert(pfds[i].fd >= 0);
+            jgb_assert(rd[i]->event_fd() == pfds[i].fd);
+            jgb_assert(!fd_readable(pfds[i].fd));
+        }
+
+        // 一个线程同时等待两个缓冲区。
+        uint8_t data[16] = { 0 };
+        boost::thread wr_thread([&]()
+        {
+            jgb::sleep(20);
+            data[0] = 1;
+            int r = wr[1]->put(data, sizeof(data), 0);
+            jgb_assert(!r);
+        });
+        int r = poll(pfds, 2, 1000);
+        jgb_assert(r == 1);
+        jgb_assert(!(pfds[0].revents & POLLIN) && (pfds[1].revents & POLLIN));
+        wr_thread.join();
+
+        struct jgb::frame frm;
+        r = rd[1]->request_frame(&frm, 0);
+        jgb_assert(!r);
+        jgb_assert(frm.buf[0] == 1);
+        // 持有帧期间仍然可读。
+        jgb_assert(fd_readable(pfds[1].fd));
+        rd[1]->release();
+        jgb_assert(!fd_readable(pfds[1].fd));
+
+        // 写者等待空间。
+        int wfd = wr[0]->event_fd();
+        jgb_assert(wfd >= 0);
+        int n = 0;
+        while(!wr[0]->put(data, sizeof(data), 0))
+        {
+            ++ n;
+        }
+        jgb_assert(n > 0);
+        jgb_assert(fd_readable(pfds[0].fd));
+        jgb_assert(!fd_readable(wfd));
+        r = rd[0]->request_frame(&frm, 0);
+        jgb_assert(!r);
+        jgb_assert(!fd_readable(wfd));
+        rd[0]->release();
+        jgb_assert(fd_readable(wfd));
+        r = wr[0]->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+        jgb_assert(!fd_readable(wfd));
+
+        // 读完全部帧后不可读。
+        int count;
+        struct jgb::frame frms[8];
+        r = rd[0]->request_frames(frms, 8, &count, 0);
+        jgb_assert(!r);
+        rd[0]->release(count);
+        jgb_assert(!fd_readable(pfds[0].fd));
+
+        buf[0]->remove_reader(rd[0]);
+        close_buffer(buf[1], wr[1], rd[1]);
+    });
+}
+
+// 按 id 索引缓冲区：大量缓冲区的查找、增加引用及删除。
+static void test_22()
+{
+    jgb::buffer_manager* mgr = jgb::buffer_manager::get_instance();
+    const int count = 3000;
+    std::vector<jgb::buffer*> bufs(count);
+    for(int i=0; i<count; i++)
+    {
+        std::string id = "test#22." + std::to_string(i);
+        jgb_assert(!mgr->find_buffer(id));
+        bufs[i] = mgr->add_buffer(id);
+        jgb_assert(bufs[i] && bufs[i]->ref_ == 1);
+    }
+    for(int i=0; i<count; i++)
+    {
+        std::string id = "test#22." + std::to_string(i);
+        // 查找不增加引用。
+        jgb_assert(mgr->find_buffer(id) == bufs[i]);
+        jgb_assert(bufs[i]->ref_ == 1);
+        jgb_assert(mgr->add_buffer(id) == bufs[i]);
+        jgb_assert(bufs[i]->ref_ == 2);
+    }
+
+    // 删除一部分后，其他缓冲区不变。
+    for(int i=0; i<count; i+=2)
+    {
+        jgb_assert(!mgr->remove_buffer(bufs[i]));
+        jgb_assert(!mgr->remove_buffer(bufs[i]));
+    }
+    for(int i=0; i<count; i++)
+    {
+        std::string id = "test#22." + std::to_string(i);
+        jgb_assert(mgr->find_buffer(id) == ((i % 2) ? bufs[i] : nullptr));
+    }
+    jgb::buffer other("test#22.x");
+    jgb_assert(mgr->remove_buffer(&other) == -1);
+    jgb_assert(mgr->remove_buffer(nullptr) == -1);
+
+    for(int i=1; i<count; i+=2)
+    {
+        jgb_assert(!mgr->remove_buffer(bufs[i]));
+        jgb_assert(!mgr->remove_buffer(bufs[i]));
+        jgb_assert(!mgr->find_buffer("test#22." + std::to_string(i)));
+    }
+}
+
+// 多写者模式：多个写者同时持有缓冲区，按申请的先后对读者可见。
+static void test_23()
+{
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#23");
+    jgb::writer* wr_a = buf->add_writer();
+    jgb::writer* wr_b = buf->add_writer();
+    jgb::reader* rd = buf->add_reader();
+    buf->multi_writer_ = true;
+    buf->resize(8 * jgb::writer::frame_size(64) + jgb::writer::fixed_header_size() + 8);
+
+    // 两个写者同时持有缓冲区，按申请的先后对读者可见。
+    uint8_t* pa;
+    uint8_t* pb;
+    int r = wr_a->request_buffer(&pa, 64, 0);
+    jgb_assert(!r);
+    r = wr_b->request_buffer(&pb, 64, 0);
+    jgb_assert(!r);
+    jgb_assert(pa != pb);
+    memset(pb, 'b', 64);
+    r = wr_b->commit(16, 0, JGB_FRAME_KEYFRAME);
+    jgb_assert(!r);
+
+    struct jgb::frame frm;
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(r == JGB_ERR_TIMEOUT);
+
+    memset(pa, 'a', 64);
+    r = wr_a->commit(40);
+    jgb_assert(!r);
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(!r);
+    jgb_assert(frm.len == 40 && frm.buf[0] == 'a' && !frm.flags);
+    rd->release();
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(!r);
+    jgb_assert(frm.len == 16 && frm.buf[0] == 'b' && frm.flags == JGB_FRAME_KEYFRAME);
+    rd->release();
+
+    // 取消提交的缓冲区由读者跳过。
+    r = wr_a->request_buffer(&pa, 64, 0);
+    jgb_assert(!r);
+    r = wr_b->request_buffer(&pb, 64, 0);
+    jgb_assert(!r);
+    memset(pb, 'c', 64);
+    r = wr_b->commit(64);
+    jgb_assert(!r);
+    r = wr_a->cancel();
+    jgb_assert(!r);
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(!r);
+    jgb_assert(frm.len == 64 && frm.buf[0] == 'c');
+    rd->release();
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(r == JGB_ERR_TIMEOUT);
+
+    buf->remove_writer(wr_a);
+    buf->remove_writer(wr_b);
+    buf->remove_reader(rd);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+
+    // 并发：各写者的帧按顺序、完整地到达读者。
+    const int writers = 4;
+    const int frames = 20000;
+    buf = jgb::buffer_manager::get_instance()->add_buffer("test#23");
+    rd = buf->add_reader();
+    buf->multi_writer_ = true;
+    buf->resize(4096);
+    jgb::writer* wrs[writers];
+    for(int w=0; w<writers; w++)
+    {
+        wrs[w] = buf->add_writer();
+    }
+
+    boost::thread_group threads;
+    for(int w=0; w<writers; w++)
+    {
+        threads.create_thread([w, &wrs]()
+        {
+            jgb::writer* wr = wrs[w];
+            unsigned seed = 23 + w;
+            for(int i=0; i<frames; )
+            {
+                int max_len = 8 + rand_r(&seed) % 200;
+                uint8_t* p;
+                int r = wr->request_buffer(&p, max_len, 1000);
+                if(r)
+                {
+                    jgb_assert(r == JGB_ERR_TIMEOUT);
+                    continue;
+                }
+                if(rand_r(&seed) % 16 == 0)
+                {
+                    r = wr->cancel();
+                    jgb_assert(!r);
+                    continue;
+                }
+                int len = 8 + rand_r(&seed) % (max_len - 7);
+                memset(p, w * 16 + (i & 0xf), len);
+                memcpy(p, &w, sizeof(w));
+                memcpy(p + sizeof(w), &i, sizeof(i));
+                r = wr->commit(len);
+                jgb_assert(!r);
+                ++ i;
+            }
+        });
+    }
+
+    int next[writers] = { 0 };
+    int read = 0;
+    int64_t last_timestamp = 0;
+    while(read < writers * frames)
+    {
+        r = rd->request_frame(&frm, 1000);
+        jgb_assert(!r);
+        int w;
+        int i;
+        memcpy(&w, frm.buf, sizeof(w));
+        memcpy(&i, frm.buf + sizeof(w), sizeof(i));
+        jgb_assert(w >= 0 && w < writers);
+        jgb_assert(i == next[w]);
+        for(int k=sizeof(w)+sizeof(i); k<frm.len; k++)
+        {
+            jgb_assert(frm.buf[k] == w * 16 + (i & 0xf));
+        }
+        jgb_assert(frm.timestamp >= last_timestamp);
+        last_timestamp = frm.timestamp;
+        rd->release();
+        ++ next[w];
+        ++ read;
+    }
+    threads.join_all();
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(r == JGB_ERR_TIMEOUT);
+
+    for(int w=0; w<writers; w++)
+    {
+        buf->remove_writer(wrs[w]);
+    }
+    buf->remove_reader(rd);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+}
+
+// 帧句柄：被引用的帧由写者跳过，释放最后一个引用后才可以覆盖。
+static void test_24()
+{
+    each_mode("test#24", 8 * jgb::writer::frame_size(16) + jgb::writer::fixed_header_size() + 8,
+              [](jgb::buffer* buf, jgb::writer* wr)
+    {
+        jgb::reader* rd = buf->add_reader();
+
+        uint8_t data[16];
+        memset(data, 0, sizeof(data));
+        int r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+
+        // 句柄引用帧之后，读者不再持有该帧。
+        jgb::frame_handle h1;
+        jgb_assert(!h1.valid());
+        r = rd->request_frame(&h1, 0);
+        jgb_assert(!r);
+        jgb_assert(h1.valid() && !rd->holding_);
+        jgb_assert(h1.get().len == 16 && h1.get().buf[0] == 0);
+        jgb::frame_handle h2 = h1;
+
+        // 写者跳过被引用的帧，读者读到的帧完整。
+        struct jgb::frame frm;
+        for(int i=1; i<50; i++)
+        {
+            memset(data, i, sizeof(data));
+            r = wr->put(data, sizeof(data), 0);
+            jgb_assert(!r);
+            r = rd->request_frame(&frm, 0);
+            jgb_assert(!r);
+            jgb_assert(frm.len == 16 && frm.buf[0] == i && frm.buf[15] == i);
+            rd->release();
+        }
+        jgb_assert(!wr->stat_timeout_);
+        for(int k=0; k<16; k++)
+        {
+            jgb_assert(h1.get().buf[k] == 0);
+        }
+
+        // 持有帧时不能引用。
+        r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r);
+        jgb::frame_handle h3;
+        r = rd->request_frame(&h3, 0);
+        jgb_assert(r == JGB_ERR_DENIED && !h3.valid());
+        rd->release();
+
+        // 所有帧都被引用时，无法容纳新帧。
+        std::vector<jgb::frame_handle> handles;
+        while(true)
+        {
+            r = wr->put(data, sizeof(data), 0);
+            if(r)
+            {
+                break;
+            }
+            handles.emplace_back();
+            r = rd->request_frame(&handles.back(), 0);
+            jgb_assert(!r);
+        }
+        jgb_assert(r == JGB_ERR_LIMIT);
+        jgb_assert(handles.size() >= 6);
+
+        // 释放最后一个引用后，写者可以覆盖该帧。
+        h1.reset();
+        jgb_assert(h2.valid());
+        r = wr->put(data, sizeof(data), 0);
+        jgb_assert(r == JGB_ERR_LIMIT);
+        h2 = std::move(h1);
+        jgb_assert(!h2.valid());
+        r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+        handles.clear();
+        for(int i=0; i<20; i++)
+        {
+            r = wr->put(data, sizeof(data), 0);
+            jgb_assert(!r);
+            r = rd->request_frame(&frm, 0);
+            jgb_assert(!r);
+            rd->release();
+        }
+        jgb_assert(!rd->request_frame(&frm, 0));
+        rd->release();
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(r == JGB_ERR_TIMEOUT);
+        buf->remove_reader(rd);
+    });
+
+    // 并发：读者以句柄保留最近的几个参考帧，释放时数据仍然完整。
+    const int frames = 20000;
+    each_mode("test#24", 4096, [](jgb::buffer* buf, jgb::writer* wr)
+    {
+        jgb::reader* rd = buf->add_reader();
+
+        boost::thread wr_thread([wr]()
+        {
+            uint8_t data[200];
+            unsigned seed = 24;
+            for(int i=0; i<frames; )
+            {
+                int len = 8 + rand_r(&seed) % 193;
+                memset(data, i & 0xff, len);
+                memcpy(data, &i, sizeof(i));
+                int r = wr->put(data, len, 100);
+                if(!r)
+                {
+                    ++ i;
+                }
+            }
+        });
+
+        auto check = [](const jgb::frame_handle& h)
+        {
+            const struct jgb::frame& f = h.get();
+            int seq;
+            memcpy(&seq, f.buf, sizeof(seq));
+            for(int k=sizeof(seq); k<f.len; k++)
+            {
+                jgb_assert(f.buf[k] == (seq & 0xff));
+            }
+            return seq;
+        };
+
+        jgb::frame_handle refs[3];
+        for(int i=0; i<frames; i++)
+        {
+            int seq;
+            if(i % 10 == 0)
+            {
+                jgb::frame_handle& h = refs[(i / 10) % 3];
+                if(h.valid())
+                {
+                    check(h);
+                }
+                int r = rd->request_frame(&h, 1000);
+                jgb_assert(!r);
+                seq = check(h);
+            }
+            else
+            {
+                struct jgb::frame frm;
+                int r = rd->request_frame(&frm, 1000);
+                jgb_assert(!r);
+                memcpy(&seq, frm.buf, sizeof(seq));
+                rd->release();
+            }
+            jgb_assert(seq == i);
+        }
+        wr_thread.join();
+        for(auto& h : refs)
+        {
+            check(h);
+            h.reset();
+        }
+        buf->remove_reader(rd);
+    });
+
+    // leaky 模式不支持。
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#24");
+    jgb::reader* rd = buf->add_reader();
+    buf->lock_free_ = true;
+    buf->leaky_ = true;
+    buf->resize(1024);
+    jgb::frame_handle h;
+    jgb_assert(rd->request_frame(&h, 0) == JGB_ERR_NOT_SUPPORT);
+    buf->remove_reader(rd);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+}
+
+// 消费者组：组内每一帧只交给一个成员，成员可以不按先后释放帧。
+static void test_25()
+{
+    each_mode("test#25", 4 * jgb::writer::frame_size(16) + jgb::writer::fixed_header_size() + 8,
+              [](jgb::buffer* buf, jgb::writer* wr)
+    {
+        jgb::reader* m1 = buf->add_group_reader("g");
+        jgb::reader* m2 = buf->add_group_reader("g");
+        jgb_assert(m1 && m2 && m1 != m2);
+        // 整个组只是一个读者。
+        jgb_assert(buf->readers_.size() == 1);
+        // 组内部的读者不作为 add_reader(rd) 的 rd。
+        jgb_assert(!buf->first_reader());
+        jgb::reader* other = buf->add_reader();
+        jgb_assert(buf->first_reader() == other);
+        buf->remove_reader(other);
+
+        uint8_t data[16] = { 0 };
+        int r;
+        for(int i=0; i<4; i++)
+        {
+            data[0] = i;
+            r = wr->put(data, sizeof(data), 0);
+            jgb_assert(!r);
+        }
+
+        // 每一帧只交给一个成员。
+        struct jgb::frame frm;
+        r = m1->request_frame(&frm, 0);
+        jgb_assert(!r && frm.buf[0] == 0);
+        r = m1->request_frame(&frm, 0);
+        jgb_assert(!r && frm.buf[0] == 0);
+        struct jgb::frame frms[4];
+        int count;
+        r = m2->request_frames(frms, 4, &count, 0);
+        jgb_assert(!r && count == 3);
+        for(int i=0; i<count; i++)
+        {
+            jgb_assert(frms[i].buf[0] == i + 1);
+        }
+        m2->release(count);
+        r = m2->request_frame(&frm, 0);
+        jgb_assert(r == JGB_ERR_TIMEOUT);
+
+        // 最早的帧未释放时，写者不能覆盖。
+        r = wr->put(data, sizeof(data), 0);
+        jgb_assert(r == JGB_ERR_TIMEOUT);
+        m1->release();
+        jgb_assert(m1->stat_frames_read_ == 1 && m2->stat_frames_read_ == 3);
+        data[0] = 4;
+        r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+
+        // 释放未释放的帧后离开组。
+        r = m2->request_frame(&frm, 0);
+        jgb_assert(!r && frm.buf[0] == 4);
+        jgb_assert(m1->seek(jgb::reader::seek_latest) == JGB_ERR_NOT_SUPPORT);
+        jgb_assert(!buf->remove_reader(m2));
+        data[0] = 5;
+        r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+        r = m1->request_frame(&frm, 0);
+        jgb_assert(!r && frm.buf[0] == 5);
+        m1->release();
+        jgb_assert(!buf->remove_reader(m1));
+        jgb_assert(buf->readers_.empty());
+    });
+
+    // 并发：各成员分担全部帧，每一帧恰好交给一个成员，且每个成员获取的帧按提交的先后排列。
+    const int members = 4;
+    const int frames = 40000;
+    each_mode("test#25", 4096, [](jgb::buffer* buf, jgb::writer* wr)
+    {
+        jgb::reader* rds[members];
+        for(int m=0; m<members; m++)
+        {
+            rds[m] = buf->add_group_reader("g");
+        }
+
+        std::vector<uint8_t> seen(frames, 0);
+        std::atomic<int> total(0);
+        boost::thread_group threads;
+        for(int m=0; m<members; m++)
+        {
+            threads.create_thread([m, &rds, &seen, &total]()
+            {
+                jgb::reader* rd = rds[m];
+                int last = -1;
+                while(total.load() < frames)
+                {
+                    struct jgb::frame frms[3];
+                    int count;
+                    int r = rd->request_frames(frms, 1 + m % 3, &count, 10);
+                    if(r)
+                    {
+                        jgb_assert(r == JGB_ERR_TIMEOUT);
+                        continue;
+                    }
+                    for(int i=0; i<count; i++)
+                    {
+                        int seq;
+                        memcpy(&seq, frms[i].buf, sizeof(seq));
+                        jgb_assert(seq > last && seq < frames);
+                        for(int k=sizeof(seq); k<frms[i].len; k++)
+                        {
+                            jgb_assert(frms[i].buf[k] == (seq & 0xff));
+                        }
+                        jgb_assert(!seen[seq]);
+                        seen[seq] = 1;
+                        last = seq;
+                    }
+                    rd->release(count);
+                    total.fetch_add(count);
+                }
+            });
+        }
+
+        uint8_t data[200];
+        unsigned seed = 25;
+        for(int i=0; i<frames; )
+        {
+            int len = 8 + rand_r(&seed) % 193;
+            memset(data, i & 0xff, len);
+            memcpy(data, &i, sizeof(i));
+            int r = wr->put(data, len, 100);
+            if(!r)
+            {
+                ++ i;
+            }
+        }
+        threads.join_all();
+        jgb_assert(total.load() == frames);
+        int64_t read = 0;
+        for(int m=0; m<members; m++)
+        {
+            read += rds[m]->stat_frames_read_;
+            jgb_assert(!buf->remove_reader(rds[m]));
+        }
+        jgb_assert(read == frames);
+        jgb_assert(buf->readers_.empty());
+    });
+}
+
+// 文件模式：进程崩溃后恢复，重新读取尚未读取的帧。
+static void test_26()
+{
+    std::string file = "/tmp/test-buffer-26." + std::to_string(getpid());
+    int len = 16 * jgb::writer::frame_size(16) + jgb::writer::fixed_header_size();
+    unlink(file.c_str());
+
+    pid_t pid = fork();
+    jgb_assert(pid >= 0);
+    if(!pid)
+    {
+        jgb::buffer child_buf("test#26");
+        child_buf.file_ = file;
+        if(child_buf.resize(len))
+        {
+            _exit(1);
+        }
+        jgb::reader* child_rd = child_buf.add_reader();
+        jgb::writer* child_wr = child_buf.add_writer();
+        uint8_t data[16] = { 0 };
+        struct jgb::frame frm;
+        int next = 0;
+        for(int i=0; i<11; i++)
+        {
+            data[0] = i;
+            if(child_wr->put(data, sizeof(data), 0))
+            {
+                _exit(2);
+            }
+            // 第 10 帧提交时已经读取了 0 ~ 3 帧；此后读取的 4、5 帧未被记录，恢复后重新读取。
+            for(int j=0; j<(i == 9 ? 4 : (i == 10 ? 2 : 0)); j++)
+            {
+                if(child_rd->request_frame(&frm, 0) || frm.buf[0] != next)
+                {
+                    _exit(3);
+                }
+                child_rd->release();
+                ++ next;
+            }
+        }
+        // 不清理，模拟崩溃。
+        _exit(0);
+    }
+    int status;
+    jgb_assert(waitpid(pid, &status, 0) == pid);
+    jgb_assert(WIFEXITED(status) && !WEXITSTATUS(status));
+
+    jgb::buffer* buf = new jgb::buffer("test#26");
+    buf->file_ = file;
+    int r = buf->resize(len);
+    jgb_assert(!r);
+    jgb_assert(buf->serial_ == 11);
+    jgb::reader* rd = buf->add_reader();
+    jgb::writer* wr = buf->add_writer();
+    struct jgb::frame frm;
+    for(int i=4; i<11; i++)
+    {
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r && frm.buf[0] == i);
+        rd->release();
+    }
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(r == JGB_ERR_TIMEOUT);
+
+    // 继续写入，绕回缓冲区开始位置。
+    uint8_t data[16] = { 0 };
+    for(int i=11; i<50; i++)
+    {
+        data[0] = i;
+        r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r && frm.buf[0] == i);
+        rd->release();
+    }
+    for(int i=50; i<53; i++)
+    {
+        data[0] = i;
+        r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+    }
+    // 绕回时的重定向帧也占用帧序号。
+    uint32_t serial = buf->serial_;
+    buf->remove_reader(rd);
+    buf->remove_writer(wr);
+    delete buf;
+
+    // 正常退出后同样可以恢复：读者在提交第 52 帧时尚未读取 50 ~ 52 帧。
+    buf = new jgb::buffer("test#26");
+    buf->file_ = file;
+    r = buf->resize(len);
+    jgb_assert(!r && buf->serial_ == serial);
+    int fd = open(file.c_str(), O_RDWR);
+    jgb_assert(fd >= 0);
+    uint64_t rd_pos = 0;
+    jgb_assert(pread(fd, &rd_pos, sizeof(rd_pos), 24) == sizeof(rd_pos));
+    rd = buf->add_reader();
+    for(int i=50; i<53; i++)
+    {
+        r = rd->request_frame(&frm, 0);
+        jgb_assert(!r && frm.buf[0] == i);
+        rd->release();
+    }
+    buf->remove_reader(rd);
+    delete buf;
+
+    // 恢复原来的读取位置，并破坏第 50 帧的帧序号：校验失败，丢弃未读取的帧。
+    uint32_t bad = 1234;
+    jgb_assert(pwrite(fd, &rd_pos, sizeof(rd_pos), 24) == sizeof(rd_pos));
+    jgb_assert(pwrite(fd, &bad, sizeof(bad), 64 + (rd_pos & 0xffffffff)) == sizeof(bad));
+    close(fd);
+
+    buf = new jgb::buffer("test#26");
+    buf->file_ = file;
+    r = buf->resize(len);
+    jgb_assert(!r && buf->serial_ == serial);
+    rd = buf->add_reader();
+    wr = buf->add_writer();
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(r == JGB_ERR_TIMEOUT);
+    data[0] = 53;
+    r = wr->put(data, sizeof(data), 0);
+    jgb_assert(!r);
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(!r && frm.buf[0] == 53);
+    rd->release();
+    buf->remove_reader(rd);
+    buf->remove_writer(wr);
+    delete buf;
+
+    unlink(file.c_str());
+}
+
+// 分块帧：大于缓冲区的帧分块写入，读者拼接。
+static void test_27()
+{
+    each_mode("test#27", 4 * jgb::writer::frame_size(64) + jgb::writer::fixed_header_size(),
+              [](jgb::buffer* buf, jgb::writer* wr)
+    {
+        jgb::reader* rd = buf->add_reader();
+        jgb_assert(buf->chunk_size_ == 64);
+
+        const int frames = 500;
+        boost::thread rd_thread([&]()
+        {
+            std::vector<uint8_t> data;
+            for(int i=0; i<frames; i++)
+            {
+                int flags = 0;
+                int r = rd->read_chunked(&data, &flags, 1000);
+                jgb_assert(!r);
+                int len = 1 + (i * 37) % 1000;
+                jgb_assert(static_cast<int>(data.size()) == len);
+                for(int j=0; j<len; j++)
+                {
+                    jgb_assert(data[j] == static_cast<uint8_t>(i + j));
+                }
+                jgb_assert(!flags);
+            }
+        });
+        uint8_t data[1000];
+        for(int i=0; i<frames; i++)
+        {
+            int len = 1 + (i * 37) % 1000;
+            for(int j=0; j<len; j++)
+            {
+                data[j] = i + j;
+            }
+            int r;
+            if(i & 1)
+            {
+                // 分段的边界与分块的边界不一致。
+                struct iovec iov[3] = { { data, static_cast<size_t>(len / 3) },
+                                        { data + len / 3, 0 },
+                                        { data + len / 3, static_cast<size_t>(len - len / 3) } };
+                r = wr->putv(iov, 3, 1000);
+            }
+            else
+            {
+                r = wr->put(data, len, 1000);
+            }
+            jgb_assert(!r);
+        }
+        rd_thread.join();
+        jgb_assert(!rd->stat_chunks_dropped_);
+
+        // 不完整的帧被丢弃：缺少开始的块；写者中途失败。
+        uint8_t* p;
+        int r = wr->request_buffer(&p, 8, 0);
+        jgb_assert(!r);
+        r = wr->commit(8, 0, JGB_FRAME_CHUNK);
+        jgb_assert(!r);
+        r = wr->request_buffer(&p, 8, 0);
+        jgb_assert(!r);
+        r = wr->commit(8, 0, JGB_FRAME_CONTINUED | JGB_FRAME_KEYFRAME);
+        jgb_assert(!r);
+        data[0] = 1;
+        r = wr->put(data, 1, 0);
+        jgb_assert(!r);
+        std::vector<uint8_t> v;
+        int flags = -1;
+        r = rd->read_chunked(&v, &flags, 0);
+        jgb_assert(!r && v.size() == 1 && v[0] == 1 && !flags);
+        jgb_assert(rd->stat_chunks_dropped_ == 2);
+
+        // 超时后继续拼接。
+        r = wr->request_buffer(&p, 8, 0);
+        jgb_assert(!r);
+        memset(p, 2, 8);
+        r = wr->commit(8, 0, JGB_FRAME_CONTINUED | JGB_FRAME_KEYFRAME);
+        jgb_assert(!r);
+        r = rd->read_chunked(&v, &flags, 0);
+        jgb_assert(r == JGB_ERR_TIMEOUT);
+        r = wr->request_buffer(&p, 4, 0);
+        jgb_assert(!r);
+        memset(p, 3, 4);
+        r = wr->commit(4, 0, JGB_FRAME_CHUNK | JGB_FRAME_END_OF_UNIT);
+        jgb_assert(!r);
+        r = rd->read_chunked(&v, &flags, 0);
+        jgb_assert(!r && v.size() == 12 && v[7] == 2 && v[8] == 3);
+        jgb_assert(flags == (JGB_FRAME_KEYFRAME | JGB_FRAME_END_OF_UNIT));
+        buf->remove_reader(rd);
+    },
+    [](jgb::buffer* buf)
+    {
+        buf->chunk_size_ = 64;
+    });
+}
+
+// 压缩模式：同样大小的缓冲区保留更多的帧，读者获取解压后的帧。
+static void test_28()
+{
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#28");
+    jgb::writer* wr = buf->add_writer();
+    buf->compress_ = true;
+    buf->resize(4 * jgb::writer::frame_size(1000) + jgb::writer::fixed_header_size());
+    if(!buf->compress_)
+    {
+        jgb_info("不支持压缩模式。");
+        buf->remove_writer(wr);
+        jgb::buffer_manager::get_instance()->remove_buffer(buf);
+        return;
+    }
+    jgb::reader* rd = buf->add_reader();
+    jgb::reader* raw = buf->add_reader();
+    raw->keep_compressed_ = true;
+
+    uint8_t data[1000];
+    const int frames = 20;
+    for(int i=0; i<frames; i++)
+    {
+        memset(data, i, sizeof(data));
+        int r = wr->put(data, sizeof(data), 0);
+        jgb_assert(!r);
+    }
+    // 短帧不压缩。
+    int r = wr->put(data, 16, 0);
+    jgb_assert(!r);
+    jgb_assert(wr->stat_bytes_written_ == frames * 1000 + 16);
+    jgb_assert(wr->stat_bytes_compressed_ < frames * 1000);
+
+    struct jgb::frame frms[4];
+    for(int i=0; i<frames; )
+    {
+        int count;
+        r = rd->request_frames(frms, 4, &count, 0);
+        jgb_assert(!r && count > 0);
+        for(int j=0; j<count; j++, i++)
+        {
+            jgb_assert(frms[j].len == 1000 && !(frms[j].flags & JGB_FRAME_LZ4));
+            jgb_assert(frms[j].buf[0] == i && frms[j].buf[999] == i);
+        }
+        rd->release(count);
+    }
+    struct jgb::frame frm;
+    r = rd->request_frame(&frm, 0);
+    jgb_assert(!r && frm.len == 16 && !(frm.flags & JGB_FRAME_LZ4));
+    rd->release();
+
+    r = raw->request_frame(&frm, 0);
+    jgb_assert(!r && (frm.flags & JGB_FRAME_LZ4) && frm.len < 1000);
+    uint32_t raw_len;
+    memcpy(&raw_len, frm.buf, sizeof(raw_len));
+    jgb_assert(raw_len == 1000);
+    raw->release();
+
+    buf->remove_reader(rd);
+    buf->remove_reader(raw);
+    buf->remove_writer(wr);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+}
+
+// CRC32C 及帧的完整性校验。
+static void test_29()
+{
+    // CRC32C 的标准测试向量，及分段计算。
+    jgb_assert(jgb::crc32c("123456789", 9) == 0xe3069283);
+    uint8_t data[1000];
+    unsigned int seed = 29;
+    for(size_t i=0; i<sizeof(data); i++)
+    {
+        data[i] = rand_r(&seed);
+    }
+    uint32_t whole = jgb::crc32c(data, sizeof(data));
+    for(size_t i=0; i<20; i++)
+    {
+        jgb_assert(jgb::crc32c(data + i, sizeof(data) - i, jgb::crc32c(data, i)) == whole);
+    }
+
+    // 完整性校验：载荷被破坏的帧设置 JGB_FRAME_CORRUPTED。
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#29");
+    jgb::writer* wr = buf->add_writer();
+    buf->crc_ = true;
+    buf->resize(8 * (jgb::writer::frame_size(100) + 4) + jgb::writer::fixed_header_size());
+    jgb::reader* rd = buf->add_reader();
+
+    int r = wr->put(data, 100, 0);
+    jgb_assert(!r);
+    r = wr->request_batch(2 * (jgb::writer::frame_size(100) + 4), 0);
+    jgb_assert(!r);
+    for(int i=0; i<2; i++)
+    {
+        uint8_t* p;
+        r = wr->request_batch_frame(&p, 100);
+        jgb_assert(!r);
+        memcpy(p, data + 100 * (i + 1), 100);
+    }
+    r = wr->commit_batch();
+    jgb_assert(!r);
+    // 破坏第 2 帧的载荷。
+    buf->start_[jgb::writer::frame_size(100) + 4 + jgb::writer::fixed_header_size() + 10] ^= 1;
+
+    struct jgb::frame frms[4];
+    int count;
+    r = rd->request_frames(frms, 4, &count, 0);
+    jgb_assert(!r && count == 3);
+    for(int i=0; i<3; i++)
+    {
+        jgb_assert(frms[i].len == 100);
+        jgb_assert(!!(frms[i].flags & JGB_FRAME_CORRUPTED) == (i == 1));
+    }
+    jgb_assert(!memcmp(frms[2].buf, data + 200, 100));
+    jgb_assert(rd->stat_crc_errors_ == 1);
+    rd->release(count);
+
+    buf->remove_reader(rd);
+    buf->remove_writer(wr);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+}
+
+// 缓冲区的写入统计包括已移除的写者。
+static void test_30()
+{
+    jgb::buffer* buf = jgb::buffer_manager::get_instance()->add_buffer("test#30");
+    jgb::writer* wr1 = buf->add_writer();
+    jgb::writer* wr2 = buf->add_writer();
+    buf->resize(1024);
+    jgb::reader* rd = buf->add_reader();
+
+    uint8_t data[100] = {};
+    int64_t frames;
+    int64_t bytes;
+    buf->writer_stat(&frames, &bytes);
+    jgb_assert(frames == 0 && bytes == 0);
+    for(int i=0; i<3; i++)
+    {
+        int r = wr1->put(data, 10 + i, 0);
+        jgb_assert(!r);
+        r = wr2->put(data, 100, 0);
+        jgb_assert(!r);
+        struct jgb::frame frms[2];
+        int count;
+        r = rd->request_frames(frms, 2, &count, 0);
+        jgb_assert(!r && count == 2);
+        rd->release(count);
+    }
+    buf->writer_stat(&frames, &bytes);
+    jgb_assert(frames == 6 && bytes == 333);
+
+    buf->remove_writer(wr2);
+    buf->writer_stat(&frames, &bytes);
+    jgb_assert(frames == 6 && bytes == 333);
+    int r = wr1->put(data, 1, 0);
+    jgb_assert(!r);
+    buf->writer_stat(&frames, nullptr);
+    jgb_assert(frames == 7);
+
+    buf->remove_reader(rd);
+    buf->remove_writer(wr1);
+    jgb::buffer_manager::get_instance()->remove_buffer(buf);
+}
+
 static int init(void*)
 {
+    test_30();
+    test_29();
+    test_28();
+    test_27();
+    test_26();
+    test_25();
+    test_24();
+    test_23();
+    test_22();
+    test_21();
+    test_20();
+    test_19();
+    test_18();
+    test_17();
+    test_16();
+    test_15();
+    test_14();
+    test_13();
+    test_12();
+    test_11();
+    test_10();
+    test_09();
     test_08();
     test_07();
     test_06();